@@ -40,9 +40,12 @@
   Runtime Requirements" for information about the task-related entrypoints
   that are implemented here.
 
-  There are three task systems in this file: one built using Microsoft's
-  Concurrency Runtime, one built with Apple's Grand Central Dispatch, and
-  one built on top of bare pthreads.
+  There are four task systems in this file: one built using Microsoft's
+  Concurrency Runtime, one built with Apple's Grand Central Dispatch, one
+  built on top of bare pthreads with a single shared queue, and a
+  work-stealing pool of persistent threads.  The work-stealing pool is the
+  default on Linux; compile with -DISPC_USE_PTHREADS to get the shared
+  queue instead.
 */
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -50,7 +53,9 @@
   #define ISPC_USE_CONCRT
 #elif defined(__linux__)
   #define ISPC_IS_LINUX
-  #define ISPC_USE_PTHREADS
+  #ifndef ISPC_USE_PTHREADS
+    #define ISPC_USE_WORK_STEALING
+  #endif
 #elif defined(__APPLE__)
   #define ISPC_IS_APPLE
   #define ISPC_USE_GCD
@@ -83,6 +88,15 @@
   #include <vector>
   #include <algorithm>
 #endif // ISPC_USE_PTHREADS
+#ifdef ISPC_USE_WORK_STEALING
+  #include <atomic>
+  #include <chrono>
+  #include <condition_variable>
+  #include <mutex>
+  #include <thread>
+  #include <vector>
+  #include <unistd.h>
+#endif // ISPC_USE_WORK_STEALING
 #ifdef ISPC_IS_LINUX
   #include <malloc.h>
 #endif // ISPC_IS_LINUX
@@ -92,6 +106,9 @@
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 // Signature of ispc-generated 'task' functions
 typedef void (*TaskFuncType)(void *data, int threadIndex, int threadCount,
@@ -120,6 +137,81 @@ struct TaskInfo {
 
 class TaskGroup;
 
+///////////////////////////////////////////////////////////////////////////
+// TaskArena
+
+/* Memory for ISPCAlloc() beyond the small buffer inside each task group
+   comes in blocks of power-of-two sizes from LOG_MIN_ARENA_BLOCK to
+   LOG_MAX_ARENA_BLOCK bytes.  Blocks are cached per thread, one free list
+   per size, and a task group returns its blocks when it is reset at
+   ISPCSync(); the thread that allocates from a task group is always the
+   thread that launches and syncs it (all three happen in the same ispc
+   function), so no locking is needed.  Task groups themselves are cached
+   the same way.  Once a loop of launches has run once, later iterations
+   find every block and task group they need in the cache and do not touch
+   the heap.
+
+   Requests larger than the largest block are "fallbacks": they get their
+   own heap allocation, which is freed at reset.
+
+   Setting ISPC_ARENA_STATS in the environment prints the arena statistics,
+   summed over all threads, at exit.
+ */
+
+#define LOG_MIN_ARENA_BLOCK 12
+#define LOG_MAX_ARENA_BLOCK 28
+#define NUM_ARENA_CLASSES (LOG_MAX_ARENA_BLOCK - LOG_MIN_ARENA_BLOCK + 1)
+
+struct TaskArenaStats {
+    int64_t allocations;     // ISPCAlloc() calls
+    int64_t bytesAllocated;  // bytes requested by those calls
+    int64_t highWater;       // most block bytes held by task groups at once
+                             // (summed over threads)
+    int64_t heapBlocks;      // blocks allocated from the heap
+    int64_t fallbacks;       // requests too large for any block
+};
+
+class TaskArena {
+public:
+    static TaskArena &Local() {
+        static thread_local TaskArena arena;
+        return arena;
+    }
+
+    char *AcquireBlock(int64_t *size);
+    void ReleaseBlock(char *block, int64_t size);
+
+    TaskGroup *AllocGroup();
+    void FreeGroup(TaskGroup *tg);
+
+    void NoteAlloc(int64_t size) {
+        lBump(allocations, 1);
+        lBump(bytesAllocated, size);
+    }
+
+    static TaskArenaStats TotalStats();
+
+private:
+    TaskArena();
+    ~TaskArena();
+
+    // Only the owning thread writes the counters; TotalStats() may read
+    // them from another thread.
+    static void lBump(std::atomic<int64_t> &counter, int64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta,
+                      std::memory_order_relaxed);
+    }
+
+    void AddTo(TaskArenaStats *stats) const;
+
+    char *freeBlocks[NUM_ARENA_CLASSES];
+    std::vector<TaskGroup *> freeGroups;
+
+    std::atomic<int64_t> allocations, bytesAllocated;
+    std::atomic<int64_t> bytesInUse, highWater;
+    std::atomic<int64_t> heapBlocks, fallbacks;
+};
+
 /** The TaskGroupBase structure provides common functionality for "task
     groups"; a task group is the set of tasks launched from within a single
     ispc function.  When the function is ready to return, it waits for all
@@ -153,8 +245,9 @@ private:
        of this array is initialized to point to mem and then any subsequent
        elements required are initialized with dynamic allocation.
      */
-    int curMemBuffer, curMemBufferOffset;
-    int memBufferSize[NUM_MEM_BUFFERS];
+    int curMemBuffer;
+    int64_t curMemBufferOffset;
+    int64_t memBufferSize[NUM_MEM_BUFFERS];
     char *memBuffers[NUM_MEM_BUFFERS];
     char mem[256];
 };
@@ -178,16 +271,21 @@ inline TaskGroupBase::TaskGroupBase() {
 
 
 inline TaskGroupBase::~TaskGroupBase() {
-    // Note: don't delete memBuffers[0], since it points to the start of
-    // the "mem" member!
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i)
-        delete[] memBuffers[i];
+    Reset();
 }
 
 
 inline void
 TaskGroupBase::Reset() {
     nextTaskInfoIndex = 0; 
+
+    // Note: memBuffers[0] points to the start of the "mem" member; the
+    // others go back to the arena.
+    for (int i = 1; i <= curMemBuffer; ++i) {
+        TaskArena::Local().ReleaseBlock(memBuffers[i], memBufferSize[i]);
+        memBuffers[i] = NULL;
+        memBufferSize[i] = 0;
+    }
     curMemBuffer = 0; 
     curMemBufferOffset = 0;
 }
@@ -225,10 +323,10 @@ inline void *
 TaskGroupBase::AllocMemory(int64_t size, int32_t alignment) {
     char *basePtr = memBuffers[curMemBuffer];
     int64_t iptr = (int64_t)(basePtr + curMemBufferOffset);
-    iptr = (iptr + (alignment-1)) & ~(alignment-1);
+    iptr = (iptr + (alignment-1)) & ~(int64_t)(alignment-1);
 
-    int newOffset = int(iptr + size - (int64_t)basePtr);
-    if (newOffset < memBufferSize[curMemBuffer]) {
+    int64_t newOffset = iptr + size - (int64_t)basePtr;
+    if (newOffset <= memBufferSize[curMemBuffer]) {
         curMemBufferOffset = newOffset;
         return (char *)iptr;
     }
@@ -237,11 +335,12 @@ TaskGroupBase::AllocMemory(int64_t size, int32_t alignment) {
     curMemBufferOffset = 0;
     assert(curMemBuffer < NUM_MEM_BUFFERS);
 
-    int allocSize = 1 << (12 + curMemBuffer);
-    allocSize = std::max(int(size+alignment), allocSize);
-    char *newBuf = new char[allocSize];
+    // Blocks still double in size as a group needs more of them, so a
+    // group makes O(log n) trips to the arena.
+    int64_t allocSize = std::max(size + alignment,
+                                 (int64_t)1 << (LOG_MIN_ARENA_BLOCK + curMemBuffer - 1));
+    memBuffers[curMemBuffer] = TaskArena::Local().AcquireBlock(&allocSize);
     memBufferSize[curMemBuffer] = allocSize;
-    memBuffers[curMemBuffer] = newBuf;
     return AllocMemory(size, alignment);
 }
 
@@ -257,40 +356,7 @@ lMemFence() {
 #endif // !ISPC_IS_WINDOWS
 
 
-#if (__SIZEOF_POINTER__ == 4) || defined(__i386__) || defined(_WIN32)
-#define ISPC_POINTER_BYTES 4
-#elif (__SIZEOF_POINTER__ == 8) || defined(__x86_64__) || defined(__amd64__) || defined(_WIN64)
-#define ISPC_POINTER_BYTES 8
-#else
-#error "Pointer size unknown!"
-#endif // __SIZEOF_POINTER__
-
-
-static void *
-lAtomicCompareAndSwapPointer(void **v, void *newValue, void *oldValue) {
-#ifdef ISPC_IS_WINDOWS
-    return InterlockedCompareExchangePointer(v, newValue, oldValue);
-#else
-    void *result;
-#if (ISPC_POINTER_BYTES == 4)
-    __asm__ __volatile__("lock\ncmpxchgd %2,%1"
-                          : "=a"(result), "=m"(*v)
-                          : "q"(newValue), "0"(oldValue)
-                          : "memory");
-#else
-    __asm__ __volatile__("lock\ncmpxchgq %2,%1"
-                          : "=a"(result), "=m"(*v)
-                          : "q"(newValue), "0"(oldValue)
-                          : "memory");
-#endif // ISPC_POINTER_BYTES
-    lMemFence();
-    return result;
-#endif // ISPC_IS_WINDOWS
-}
-
-
-
-#ifndef ISPC_IS_WINDOWS
+#if !defined(ISPC_IS_WINDOWS) && !defined(ISPC_USE_WORK_STEALING)
 static int32_t 
 lAtomicCompareAndSwap32(volatile int32_t *v, int32_t newValue, int32_t oldValue) {
     int32_t result;
@@ -301,7 +367,7 @@ lAtomicCompareAndSwap32(volatile int32_t *v, int32_t newValue, int32_t oldValue)
     lMemFence();
     return result;
 }
-#endif // !ISPC_IS_WINDOWS
+#endif // !ISPC_IS_WINDOWS && !ISPC_USE_WORK_STEALING
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -366,6 +432,34 @@ private:
 
 #endif // ISPC_USE_PTHREADS
 
+#ifdef ISPC_USE_WORK_STEALING
+struct TaskRange;
+static void lRunRange(int threadIndex, TaskRange range);
+
+/* With the work-stealing pool, a task group only counts its unfinished
+   tasks; the tasks themselves live in the per-thread deques as ranges of
+   task indices, so no TaskInfo is allocated per task and there is no
+   limit on the number of tasks launched from one function.
+ */
+class TaskGroup : public TaskGroupBase {
+public:
+    TaskGroup() : numUnfinishedTasks(0) { }
+
+    void Reset() {
+        TaskGroupBase::Reset();
+        numUnfinishedTasks = 0;
+    }
+
+    void Launch(TaskFuncType func, void *data, int count);
+    void Sync();
+
+private:
+    friend void lRunRange(int threadIndex, TaskRange range);
+
+    std::atomic<int32_t> numUnfinishedTasks;
+};
+#endif // ISPC_USE_WORK_STEALING
+
 
 ///////////////////////////////////////////////////////////////////////////
 // Grand Central Dispatch
@@ -772,40 +866,454 @@ TaskGroup::Sync() {
 #endif // ISPC_USE_PTHREADS
 
 ///////////////////////////////////////////////////////////////////////////
+// Work stealing
+
+#ifdef ISPC_USE_WORK_STEALING
+
+/* A work-stealing task system.  Each pool thread owns a deque of task
+   ranges; a launch pushes one range holding all of its tasks onto the
+   deque of the launching thread.  The owner pops from the back and splits
+   the range in halves, pushing the upper half back and running the lower
+   one, so a range of N tasks costs O(log N) deque operations to spread
+   out, and idle threads steal the oldest (largest) range from the front of
+   another deque.
+
+   Pool threads are spawned lazily, on the first launch that has work for
+   them, and live until the process exits.  Threads outside the pool (the
+   application's main thread) all share deque 0 and run with threadIndex
+   0; pool threads have threadIndex 1 .. threadCount-1.  The pool size is
+   the number of online cpus, or ISPC_NUM_THREADS if set.
+
+   A thread waiting in ISPCSync() runs tasks from its own deque first (for
+   a nested launch, those are its own children) and then steals, so tasks
+   that launch and sync more tasks never block a pool thread.
+ */
 
-#define MAX_FREE_TASK_GROUPS 64
-static TaskGroup *freeTaskGroups[MAX_FREE_TASK_GROUPS];
+struct TaskRange {
+    TaskGroup *group;
+    TaskFuncType func;
+    void *data;
+    int begin, end;
+    int count;
+};
 
-static inline TaskGroup *
-AllocTaskGroup() {
-    for (int i = 0; i < MAX_FREE_TASK_GROUPS; ++i) {
-        TaskGroup *tg = freeTaskGroups[i];
-        if (tg != NULL) {
-            void *ptr = lAtomicCompareAndSwapPointer((void **)(&freeTaskGroups[i]), NULL, tg);
-            if (ptr != NULL) {
-                assert(ptr == tg);
-                return (TaskGroup *)ptr;
-            }
+/* Deque of ranges guarded by a lock.  The ring buffer only grows, so a
+   program that relaunches the same shape of work stops allocating after
+   the first launch.  `size` mirrors the number of ranges so that idle
+   threads can look for work without taking the lock.
+ */
+class RangeDeque {
+public:
+    RangeDeque() : size(0), head(0), numItems(0) {
+        items.resize(64);
+    }
+
+    void PushBack(const TaskRange &range) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (numItems == (int)items.size()) {
+            std::vector<TaskRange> grown(items.size() * 2);
+            for (int i = 0; i < numItems; ++i)
+                grown[i] = items[(head + i) % items.size()];
+            items.swap(grown);
+            head = 0;
         }
+        items[(head + numItems) % items.size()] = range;
+        size.store(++numItems);
+    }
+
+    bool PopBack(TaskRange *range) {
+        if (size.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::lock_guard<std::mutex> guard(lock);
+        if (numItems == 0)
+            return false;
+        *range = items[(head + numItems - 1) % items.size()];
+        size.store(--numItems);
+        return true;
+    }
+
+    bool PopFront(TaskRange *range) {
+        if (size.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::lock_guard<std::mutex> guard(lock);
+        if (numItems == 0)
+            return false;
+        *range = items[head];
+        head = (head + 1) % items.size();
+        size.store(--numItems);
+        return true;
     }
 
-    return new TaskGroup;
+    std::atomic<int> size;
+
+private:
+    std::mutex lock;
+    std::vector<TaskRange> items;
+    int head, numItems;
+    // Keep the locks of neighbouring deques on separate cache lines
+    char pad[64];
+};
+
+// Number of failed attempts to find work before a thread blocks
+#define WS_SPIN_ROUNDS 64
+
+static int wsThreadCount;
+static RangeDeque *wsDeques;
+static std::atomic<int> wsNumSpawned(0);
+static std::mutex *wsSpawnMutex;
+
+// Idle pool threads sleep here until a range is pushed
+static std::mutex *wsSleepMutex;
+static std::condition_variable *wsSleepCond;
+static std::atomic<int> wsNumSleeping(0);
+
+// Threads in ISPCSync() with nothing to run wait here for a group to finish
+static std::mutex *wsDoneMutex;
+static std::condition_variable *wsDoneCond;
+static std::atomic<int> wsNumBlockedSyncs(0);
+
+static thread_local int wsThreadIndex = 0;
+static thread_local unsigned int wsRandomState = 0;
+
+static void lWorkerEntry(int threadIndex);
+
+
+static bool
+lCreatePool() {
+    const char *env = getenv("ISPC_NUM_THREADS");
+    wsThreadCount = env != NULL ? atoi(env) : 0;
+    if (wsThreadCount <= 0)
+        wsThreadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    wsThreadCount = std::max(1, wsThreadCount);
+
+    // The pool is never destroyed: pool threads may still be waiting on
+    // these when static destructors run at exit.
+    wsDeques = new RangeDeque[wsThreadCount];
+    wsSpawnMutex = new std::mutex;
+    wsSleepMutex = new std::mutex;
+    wsSleepCond = new std::condition_variable;
+    wsDoneMutex = new std::mutex;
+    wsDoneCond = new std::condition_variable;
+    return true;
 }
 
 
-static inline void
-FreeTaskGroup(TaskGroup *tg) {
-    tg->Reset();
+static void
+InitTaskSystem() {
+    static bool initialized = lCreatePool();
+    (void)initialized;
+}
+
+
+/* Makes sure at least `wanted` pool threads are running. */
+static void
+lSpawnWorkers(int wanted) {
+    wanted = std::min(wanted, wsThreadCount - 1);
+    if (wsNumSpawned.load(std::memory_order_acquire) >= wanted)
+        return;
+
+    std::lock_guard<std::mutex> guard(*wsSpawnMutex);
+    for (int i = wsNumSpawned.load(); i < wanted; ++i) {
+        std::thread(lWorkerEntry, i + 1).detach();
+        wsNumSpawned.store(i + 1, std::memory_order_release);
+    }
+}
+
+
+static void
+lPushRange(int threadIndex, const TaskRange &range) {
+    wsDeques[threadIndex].PushBack(range);
+    if (wsNumSleeping.load() > 0) {
+        // Taking the lock orders this push against a thread that has
+        // checked the deques and is about to wait.
+        { std::lock_guard<std::mutex> guard(*wsSleepMutex); }
+        wsSleepCond->notify_one();
+    }
+}
 
-    for (int i = 0; i < MAX_FREE_TASK_GROUPS; ++i) {
-        if (freeTaskGroups[i] == NULL) {
-            void *ptr = lAtomicCompareAndSwapPointer((void **)&freeTaskGroups[i], tg, NULL);
-            if (ptr == NULL)
-                return;
+
+static bool
+lAnyQueuedWork() {
+    int n = wsNumSpawned.load(std::memory_order_acquire) + 1;
+    for (int i = 0; i < n; ++i)
+        if (wsDeques[i].size.load() > 0)
+            return true;
+    return false;
+}
+
+
+/* Pops a range from the thread's own deque, or steals one from the front
+   of another deque, starting at a random victim. */
+static bool
+lFindWork(int threadIndex, TaskRange *range) {
+    if (wsDeques[threadIndex].PopBack(range))
+        return true;
+
+    int n = wsNumSpawned.load(std::memory_order_acquire) + 1;
+    if (wsRandomState == 0)
+        wsRandomState = 2654435761u * (threadIndex + 1);
+    wsRandomState ^= wsRandomState << 13;
+    wsRandomState ^= wsRandomState >> 17;
+    wsRandomState ^= wsRandomState << 5;
+    int start = wsRandomState % n;
+    for (int i = 0; i < n; ++i) {
+        int victim = (start + i) % n;
+        if (victim != threadIndex && wsDeques[victim].PopFront(range))
+            return true;
+    }
+    return false;
+}
+
+
+/* Splits `range` down to a single task, leaving the upper halves in the
+   thread's deque, runs that task and retires it from its group. */
+static void
+lRunRange(int threadIndex, TaskRange range) {
+    while (range.end - range.begin > 1) {
+        TaskRange upper = range;
+        upper.begin = range.begin + (range.end - range.begin) / 2;
+        lPushRange(threadIndex, upper);
+        range.end = upper.begin;
+    }
+
+    DBG(fprintf(stderr, "running task %d from group %p on thread %d\n", range.begin,
+                range.group, threadIndex));
+    range.func(range.data, threadIndex, wsThreadCount, range.begin, range.count);
+
+    // The syncing thread may free the group as soon as the count reaches
+    // zero, so it must not be touched after the decrement.
+    if (range.group->numUnfinishedTasks.fetch_sub(1) == 1 && wsNumBlockedSyncs.load() > 0) {
+        { std::lock_guard<std::mutex> guard(*wsDoneMutex); }
+        wsDoneCond->notify_all();
+    }
+}
+
+
+static void
+lWorkerEntry(int threadIndex) {
+    wsThreadIndex = threadIndex;
+    int failures = 0;
+
+    while (1) {
+        TaskRange range;
+        if (lFindWork(threadIndex, &range)) {
+            lRunRange(threadIndex, range);
+            failures = 0;
+            continue;
+        }
+        if (++failures < WS_SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(*wsSleepMutex);
+        wsNumSleeping.fetch_add(1);
+        while (!lAnyQueuedWork())
+            wsSleepCond->wait(guard);
+        wsNumSleeping.fetch_sub(1);
+        failures = 0;
+    }
+}
+
+
+inline void
+TaskGroup::Launch(TaskFuncType func, void *data, int count) {
+    if (count <= 0)
+        return;
+
+    numUnfinishedTasks.fetch_add(count);
+    // The launching thread runs tasks too when it syncs
+    lSpawnWorkers(std::min(count, wsThreadCount) - 1);
+
+    TaskRange range;
+    range.group = this;
+    range.func = func;
+    range.data = data;
+    range.begin = 0;
+    range.end = count;
+    range.count = count;
+    lPushRange(wsThreadIndex, range);
+}
+
+
+inline void
+TaskGroup::Sync() {
+    int threadIndex = wsThreadIndex;
+    int failures = 0;
+
+    while (numUnfinishedTasks.load(std::memory_order_acquire) > 0) {
+        TaskRange range;
+        if (lFindWork(threadIndex, &range)) {
+            lRunRange(threadIndex, range);
+            failures = 0;
+            continue;
+        }
+        if (++failures < WS_SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // The remaining tasks are running elsewhere.  Wake up periodically
+        // in case one of them launches more work we could help with.
+        wsNumBlockedSyncs.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> guard(*wsDoneMutex);
+            if (numUnfinishedTasks.load() > 0)
+                wsDoneCond->wait_for(guard, std::chrono::microseconds(100));
+        }
+        wsNumBlockedSyncs.fetch_sub(1);
+        failures = 0;
+    }
+}
+
+#endif // ISPC_USE_WORK_STEALING
+
+///////////////////////////////////////////////////////////////////////////
+
+// Arenas of live threads, and the totals of threads that have exited
+static std::mutex *arenaRegistryMutex = new std::mutex;
+static std::vector<TaskArena *> *arenaRegistry = new std::vector<TaskArena *>;
+static TaskArenaStats retiredArenaStats;
+
+
+static void
+lPrintArenaStats() {
+    TaskArenaStats stats = TaskArena::TotalStats();
+    fprintf(stderr, "ISPCAlloc arena: %lld allocations, %lld bytes, high-water %lld bytes, "
+            "%lld heap blocks, %lld fallbacks\n", (long long)stats.allocations,
+            (long long)stats.bytesAllocated, (long long)stats.highWater,
+            (long long)stats.heapBlocks, (long long)stats.fallbacks);
+}
+
+
+TaskArena::TaskArena()
+    : allocations(0), bytesAllocated(0), bytesInUse(0), highWater(0),
+      heapBlocks(0), fallbacks(0) {
+    for (int i = 0; i < NUM_ARENA_CLASSES; ++i)
+        freeBlocks[i] = NULL;
+    freeGroups.reserve(16);
+
+    std::lock_guard<std::mutex> guard(*arenaRegistryMutex);
+    static bool printAtExit = getenv("ISPC_ARENA_STATS") != NULL && atexit(lPrintArenaStats) == 0;
+    (void)printAtExit;
+    arenaRegistry->push_back(this);
+}
+
+
+TaskArena::~TaskArena() {
+    // Cached task groups have already been reset, so deleting them does not
+    // call back into this arena.
+    for (size_t i = 0; i < freeGroups.size(); ++i)
+        delete freeGroups[i];
+    for (int i = 0; i < NUM_ARENA_CLASSES; ++i) {
+        while (freeBlocks[i] != NULL) {
+            char *next = *(char **)freeBlocks[i];
+            delete[] freeBlocks[i];
+            freeBlocks[i] = next;
         }
     }
 
-    delete tg;
+    std::lock_guard<std::mutex> guard(*arenaRegistryMutex);
+    AddTo(&retiredArenaStats);
+    arenaRegistry->erase(std::find(arenaRegistry->begin(), arenaRegistry->end(), this));
+}
+
+
+/* Returns a block of at least *size bytes, and sets *size to its actual
+   size. */
+char *
+TaskArena::AcquireBlock(int64_t *size) {
+    int sizeClass = 0;
+    while (sizeClass < NUM_ARENA_CLASSES &&
+           ((int64_t)1 << (LOG_MIN_ARENA_BLOCK + sizeClass)) < *size)
+        ++sizeClass;
+
+    char *block;
+    if (sizeClass == NUM_ARENA_CLASSES) {
+        block = new char[*size];
+        lBump(fallbacks, 1);
+    }
+    else {
+        *size = (int64_t)1 << (LOG_MIN_ARENA_BLOCK + sizeClass);
+        block = freeBlocks[sizeClass];
+        if (block != NULL)
+            freeBlocks[sizeClass] = *(char **)block;
+        else {
+            block = new char[*size];
+            lBump(heapBlocks, 1);
+        }
+    }
+
+    lBump(bytesInUse, *size);
+    if (bytesInUse.load(std::memory_order_relaxed) > highWater.load(std::memory_order_relaxed))
+        highWater.store(bytesInUse.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return block;
+}
+
+
+void
+TaskArena::ReleaseBlock(char *block, int64_t size) {
+    lBump(bytesInUse, -size);
+    if (size > ((int64_t)1 << LOG_MAX_ARENA_BLOCK)) {
+        delete[] block;
+        return;
+    }
+
+    int sizeClass = 0;
+    while (((int64_t)1 << (LOG_MIN_ARENA_BLOCK + sizeClass)) < size)
+        ++sizeClass;
+    // The free list is threaded through the first bytes of each block
+    *(char **)block = freeBlocks[sizeClass];
+    freeBlocks[sizeClass] = block;
+}
+
+
+inline TaskGroup *
+TaskArena::AllocGroup() {
+    if (freeGroups.empty())
+        return new TaskGroup;
+    TaskGroup *tg = freeGroups.back();
+    freeGroups.pop_back();
+    return tg;
+}
+
+
+inline void
+TaskArena::FreeGroup(TaskGroup *tg) {
+    tg->Reset();
+    freeGroups.push_back(tg);
+}
+
+
+void
+TaskArena::AddTo(TaskArenaStats *stats) const {
+    stats->allocations += allocations.load(std::memory_order_relaxed);
+    stats->bytesAllocated += bytesAllocated.load(std::memory_order_relaxed);
+    stats->highWater += highWater.load(std::memory_order_relaxed);
+    stats->heapBlocks += heapBlocks.load(std::memory_order_relaxed);
+    stats->fallbacks += fallbacks.load(std::memory_order_relaxed);
+}
+
+
+TaskArenaStats
+TaskArena::TotalStats() {
+    std::lock_guard<std::mutex> guard(*arenaRegistryMutex);
+    TaskArenaStats stats = retiredArenaStats;
+    for (size_t i = 0; i < arenaRegistry->size(); ++i)
+        (*arenaRegistry)[i]->AddTo(&stats);
+    return stats;
+}
+
+
+static inline TaskGroup *
+AllocTaskGroup() {
+    return TaskArena::Local().AllocGroup();
+}
+
+
+static inline void
+FreeTaskGroup(TaskGroup *tg) {
+    TaskArena::Local().FreeGroup(tg);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -828,6 +1336,9 @@ ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count) {
     else
         taskGroup = (TaskGroup *)(*taskGroupPtr);
 
+#ifdef ISPC_USE_WORK_STEALING
+    taskGroup->Launch((TaskFuncType)func, data, count);
+#else
     int baseIndex = taskGroup->AllocTaskInfo(count);
     for (int i = 0; i < count; ++i) {
         TaskInfo *ti = taskGroup->GetTaskInfo(baseIndex+i);
@@ -837,6 +1348,7 @@ ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count) {
         ti->taskCount = count;
     }
     taskGroup->Launch(baseIndex, count);
+#endif // ISPC_USE_WORK_STEALING
 }
 
 
@@ -861,5 +1373,6 @@ ISPCAlloc(void **taskGroupPtr, int64_t size, int32_t alignment) {
     else
         taskGroup = (TaskGroup *)(*taskGroupPtr);
 
+    TaskArena::Local().NoteAlloc(size);
     return taskGroup->AllocMemory(size, alignment);
 }
@@ -18,6 +18,8 @@ extern void mandelbrotThread(
     int maxIterations,
     int output[]);
 
+extern void printMandelbrotThreadReport();
+
 extern void writePPMImage(
     int* data,
     int width, int height,
@@ -153,6 +155,7 @@ int main(int argc, char** argv) {
     }
 
     printf("[mandelbrot thread]:\t\t[%.3f] ms\n", minThread * 1000);
+    printMandelbrotThreadReport();
     writePPMImage(output_thread, width, height, "mandelbrot-thread.ppm", maxIterations);
 
     if (! verifyResult (output_serial, output_thread, width, height)) {
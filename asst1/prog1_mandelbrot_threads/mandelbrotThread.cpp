@@ -1,20 +1,15 @@
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include "CycleTimer.h"
 
-typedef struct {
-    float x0, x1;
-    float y0, y1;
-    unsigned int width;
-    unsigned int height;
-    int maxIterations;
-    int* output;
-    int threadId;
-    int numThreads;
-} WorkerArgs;
-
-
 static inline int mandel(float c_re, float c_im, int count)
 {
     float z_re = c_re, z_im = c_im;
@@ -33,18 +28,25 @@ static inline int mandel(float c_re, float c_im, int count)
     return i;
 }
 
-// 每个线程按照step进行跳跃处理
-static void mandelbrotSerial(
+// 图像上的一个矩形块 [x_begin, x_end) x [y_begin, y_end)，cost是估计的迭代次数
+struct Tile {
+    int x_begin, x_end;
+    int y_begin, y_end;
+    float cost;
+};
+
+// 和mandelbrotSerial()用同样的公式算坐标，保证结果逐像素一致
+static void mandelbrotTile(
     float x0, float y0, float x1, float y1,
     int width, int height,
-    int startRow, int step,
+    const Tile& tile,
     int maxIterations,
     int output[]) {
     float dx = (x1 - x0) / width;
     float dy = (y1 - y0) / height;
 
-    for (int j = startRow; j < height; j += step) {
-        for (int i = 0; i < width; ++i) {
+    for (int j = tile.y_begin; j < tile.y_end; j++) {
+        for (int i = tile.x_begin; i < tile.x_end; ++i) {
             float x = x0 + i * dx;
             float y = y0 + j * dy;
             int index = (j * width + i);
@@ -53,85 +55,235 @@ static void mandelbrotSerial(
     }
 }
 
-
 //
-// workerThreadStart --
+// planTiles --
 //
-// Thread entrypoint.
-void workerThreadStart(WorkerArgs * const args) {
+// Splits the image into tiles for numThreads threads.  The iteration count
+// is sampled on a coarse grid first; tiles are sized so that a tile in the
+// most expensive region costs about 1/kTilesPerThread of a thread's share
+// of the estimated total, which keeps the last tiles to finish short.
+// Tiles are returned most expensive first, so cheap tiles fill in at the
+// end of the dynamic hand-out.
+static std::vector<Tile> planTiles(
+    int numThreads,
+    float x0, float y0, float x1, float y1,
+    int width, int height,
+    int maxIterations) {
+    const int kSamples = 32;
+    const int kTilesPerThread = 8;
+    const int kMinTileSide = 8;
 
-    // TODO FOR CS149 STUDENTS: Implement the body of the worker
-    // thread here. Each thread should make a call to mandelbrotSerial()
-    // to compute a part of the output image.  For example, in a
-    // program that uses two threads, thread 0 could compute the top
-    // half of the image and thread 1 could compute the bottom half.
+    float dx = (x1 - x0) / width;
+    float dy = (y1 - y0) / height;
+    int sx = std::min(kSamples, width);
+    int sy = std::min(kSamples, height);
 
-    printf("Hello world from thread %d\n", args->threadId);
-    double startTime = CycleTimer::currentSeconds();
-    // method1.
-    // unsigned int dh = (args->height + args->numThreads - 1) / args->numThreads;
-    // mandelbrotSerial(args->x0, args->y0, args->x1, args->y1, args->width, args->height, args->threadId * dh,
-    // std::min(args->height, (args->threadId + 1) * dh) - args->threadId * dh, args->maxIterations, args->output);
-    // method2
-    mandelbrotSerial(args->x0, args->y0, args->x1, args->y1, args->width, args->height, args->threadId,
-    args->numThreads, args->maxIterations, args->output);
-    double endTime = CycleTimer::currentSeconds();
-
-    printf("[mandelbrot threadid %d]: [%.3lf] ms\n", args->threadId, (endTime - startTime) * 1000);
+    // 每个采样点代表一块像素的平均代价，+1算上每个像素固定的开销
+    std::vector<float> density(sx * sy);
+    double total = 0;
+    float max_density = 0;
+    for (int j = 0; j < sy; j++) {
+        for (int i = 0; i < sx; i++) {
+            int px = (int)((i + 0.5f) * width / sx);
+            int py = (int)((j + 0.5f) * height / sy);
+            float d = mandel(x0 + px * dx, y0 + py * dy, maxIterations) + 1.f;
+            density[j * sx + i] = d;
+            total += d;
+            max_density = std::max(max_density, d);
+        }
+    }
+    double total_cost = total / (sx * sy) * width * height;
+
+    double target_cost = total_cost / ((double)numThreads * kTilesPerThread);
+    double area = std::max(target_cost / max_density, (double)kMinTileSide * kMinTileSide);
+    int tile_w = std::min(width, std::max(kMinTileSide, (int)std::sqrt(area)));
+    int tile_h = std::min(height, std::max(kMinTileSide, (int)(area / tile_w)));
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tile_h) {
+        for (int x = 0; x < width; x += tile_w) {
+            Tile t;
+            t.x_begin = x;
+            t.x_end = std::min(width, x + tile_w);
+            t.y_begin = y;
+            t.y_end = std::min(height, y + tile_h);
+            // 用tile中心所在采样格的密度估计代价
+            int i = std::min(sx - 1, (t.x_begin + t.x_end) / 2 * sx / width);
+            int j = std::min(sy - 1, (t.y_begin + t.y_end) / 2 * sy / height);
+            t.cost = density[j * sx + i] * (t.x_end - t.x_begin) * (t.y_end - t.y_begin);
+            tiles.push_back(t);
+        }
+    }
+    std::stable_sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) {
+        return a.cost > b.cost;
+    });
+    return tiles;
 }
 
+//
+// ThreadPool --
+//
+// Persistent workers for mandelbrotThread().  run(numThreads, body) calls
+// body(threadId) on the calling thread (threadId 0) and on numThreads-1
+// workers, and returns once all of them have returned.  Workers are
+// created the first time a call needs them and then sleep between calls,
+// so repeated calls do not pay for thread creation.
+class ThreadPool {
+    public:
+        static ThreadPool& instance() {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        void run(int numThreads, const std::function<void(int)>& body) {
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                while ((int)workers_.size() < numThreads - 1) {
+                    int id = workers_.size() + 1;
+                    workers_.push_back(std::thread(&ThreadPool::workerLoop, this, id));
+                }
+                body_ = &body;
+                participants_ = numThreads;
+                running_ = numThreads - 1;
+                generation_++;
+            }
+            cv_.notify_all();
+
+            body(0);
+
+            std::unique_lock<std::mutex> lk(mutex_);
+            done_cv_.wait(lk, [this] { return running_ == 0; });
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (std::thread& t : workers_) {
+                t.join();
+            }
+        }
+
+    private:
+        ThreadPool(): body_(NULL), participants_(0), running_(0), generation_(0), stop_(false) {}
+
+        void workerLoop(int id) {
+            int seen = 0;
+            while (true) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                cv_.wait(lk, [&] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+                // 这次调用用不到这么多线程
+                if (id >= participants_) {
+                    continue;
+                }
+                const std::function<void(int)>* body = body_;
+                lk.unlock();
+
+                (*body)(id);
+
+                lk.lock();
+                if (--running_ == 0) {
+                    done_cv_.notify_one();
+                }
+            }
+        }
+
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::condition_variable done_cv_;
+        const std::function<void(int)>* body_;
+        int participants_;
+        int running_; // 还没做完的worker数，不含调用线程
+        int generation_;
+        bool stop_;
+};
+
+// 每个线程的统计，按cache line对齐避免伪共享
+struct alignas(64) ThreadStats {
+    double busy_ms;
+    int tiles;
+    long pixels;
+};
+
+// 最近一次mandelbrotThread()调用的统计，由printMandelbrotThreadReport()输出
+static struct {
+    std::vector<ThreadStats> threads;
+    int num_tiles;
+    int tile_w, tile_h;
+    double elapsed_ms;
+} lastReport;
+
 //
 // MandelbrotThread --
 //
 // Multi-threaded implementation of mandelbrot set image generation.
-// Threads of execution are created by spawning std::threads.
+// The image is cut into tiles (see planTiles()) that numThreads threads of
+// a persistent pool claim one at a time from a shared counter, so threads
+// that draw cheap tiles simply take more of them.
 void mandelbrotThread(
     int numThreads,
     float x0, float y0, float x1, float y1,
     int width, int height,
     int maxIterations, int output[])
 {
-    static constexpr int MAX_THREADS = 32;
+    numThreads = std::max(1, numThreads);
+    double startTime = CycleTimer::currentSeconds();
 
-    if (numThreads > MAX_THREADS)
-    {
-        fprintf(stderr, "Error: Max allowed threads is %d\n", MAX_THREADS);
-        exit(1);
-    }
+    std::vector<Tile> tiles = planTiles(numThreads, x0, y0, x1, y1, width, height, maxIterations);
+    std::vector<ThreadStats> stats(numThreads);
+    std::atomic<int> next(0);
 
-    // Creates thread objects that do not yet represent a thread.
-    std::thread workers[MAX_THREADS];
-    WorkerArgs args[MAX_THREADS];
-
-    for (int i=0; i<numThreads; i++) {
-
-        // TODO FOR CS149 STUDENTS: You may or may not wish to modify
-        // the per-thread arguments here.  The code below copies the
-        // same arguments for each thread
-        args[i].x0 = x0;
-        args[i].y0 = y0;
-        args[i].x1 = x1;
-        args[i].y1 = y1;
-        args[i].width = width;
-        args[i].height = height;
-        args[i].maxIterations = maxIterations;
-        args[i].numThreads = numThreads;
-        args[i].output = output;
-        args[i].threadId = i;
-    }
+    ThreadPool::instance().run(numThreads, [&](int threadId) {
+        ThreadStats& s = stats[threadId];
+        s.busy_ms = 0;
+        s.tiles = 0;
+        s.pixels = 0;
+        double threadStart = CycleTimer::currentSeconds();
+        int t;
+        while ((t = next.fetch_add(1, std::memory_order_relaxed)) < (int)tiles.size()) {
+            const Tile& tile = tiles[t];
+            mandelbrotTile(x0, y0, x1, y1, width, height, tile, maxIterations, output);
+            s.tiles++;
+            s.pixels += (long)(tile.x_end - tile.x_begin) * (tile.y_end - tile.y_begin);
+        }
+        s.busy_ms = (CycleTimer::currentSeconds() - threadStart) * 1000;
+    });
 
-    // Spawn the worker threads.  Note that only numThreads-1 std::threads
-    // are created and the main application thread is used as a worker
-    // as well.
-    for (int i=1; i<numThreads; i++) {
-        workers[i] = std::thread(workerThreadStart, &args[i]);
-    }
+    lastReport.threads = stats;
+    lastReport.num_tiles = tiles.size();
+    lastReport.tile_w = tiles.empty() ? 0 : tiles[0].x_end - tiles[0].x_begin;
+    lastReport.tile_h = tiles.empty() ? 0 : tiles[0].y_end - tiles[0].y_begin;
+    lastReport.elapsed_ms = (CycleTimer::currentSeconds() - startTime) * 1000;
+}
 
-    workerThreadStart(&args[0]);
+//
+// printMandelbrotThreadReport --
+//
+// Prints the tiling and per-thread work of the most recent
+// mandelbrotThread() call, and the load imbalance (slowest thread's busy
+// time over the mean).
+void printMandelbrotThreadReport()
+{
+    const std::vector<ThreadStats>& threads = lastReport.threads;
+    if (threads.empty()) {
+        return;
+    }
+    printf("[mandelbrot thread report]:\t%d tiles of up to %dx%d px, [%.3f] ms\n",
+           lastReport.num_tiles, lastReport.tile_w, lastReport.tile_h, lastReport.elapsed_ms);
 
-    // join worker threads
-    for (int i=1; i<numThreads; i++) {
-        workers[i].join();
+    double total = 0, slowest = 0;
+    for (size_t i = 0; i < threads.size(); i++) {
+        printf("    thread %2zu:\t[%.3f] ms\t%4d tiles\t%8ld px\n",
+               i, threads[i].busy_ms, threads[i].tiles, threads[i].pixels);
+        total += threads[i].busy_ms;
+        slowest = std::max(slowest, threads[i].busy_ms);
     }
+    printf("    imbalance (max/mean busy):\t%.3f\n", slowest / (total / threads.size()));
 }
-
@@ -0,0 +1,154 @@
+#ifndef _CORO_H
+#define _CORO_H
+
+/*
+ * C++20 coroutine front end for ITaskSystem.
+ *
+ *     Pipeline stage(AsyncTaskSystem ts, IRunnable* a, IRunnable* b) {
+ *         TaskID id = co_await ts.launch(a, 64);
+ *         co_await ts.launch(b, 64, {id});
+ *     }
+ *
+ * `co_await ts.launch(runnable, n, deps)` submits the bulk launch with
+ * runAsyncWithDeps() together with a one-task launch that depends on it
+ * and resumes the coroutine, so the coroutine continues on a worker of the
+ * task system once its launch is done, and no thread blocks while it is
+ * suspended.  The co_await evaluates to the TaskID of the bulk launch.
+ *
+ * A Pipeline starts running on the calling thread and finishes on a
+ * worker.  Every launch it issues, including the ones that resume it, is
+ * submitted before the previous one completes, so ITaskSystem::sync()
+ * returns only after every pipeline has run to completion; call it before
+ * destroying the Pipeline objects.
+ *
+ * Task systems whose runAsyncWithDeps() runs the launch synchronously
+ * (Serial, Persistent Pool) run the resume task before co_await has
+ * finished submitting it.  The awaiter then continues the coroutine on the
+ * submitting thread instead of resuming it from inside the resume task, so
+ * a long pipeline does not nest one launch per co_await.
+ *
+ * Only available when compiled as C++20 (`make CORO=1`), which defines
+ * TASKSYS_HAS_COROUTINES.
+ */
+
+#include "itasksys.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#define TASKSYS_HAS_COROUTINES
+
+/*
+ * Coroutine return type for a logical pipeline of launches.  It starts
+ * eagerly and stays suspended at its end until the Pipeline is destroyed.
+ */
+class Pipeline {
+    public:
+        struct promise_type {
+            Pipeline get_return_object() {
+                return Pipeline(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        Pipeline(Pipeline&& other) noexcept: handle_(std::exchange(other.handle_, nullptr)) {}
+        Pipeline& operator=(Pipeline&& other) noexcept {
+            std::swap(handle_, other.handle_);
+            return *this;
+        }
+        ~Pipeline() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        // 只有在sync()之后读才有意义
+        bool done() const { return handle_.done(); }
+
+    private:
+        explicit Pipeline(std::coroutine_handle<promise_type> handle): handle_(handle) {}
+        std::coroutine_handle<promise_type> handle_;
+};
+
+/*
+ * Awaitable returned by AsyncTaskSystem::launch().  It is also the
+ * runnable of the one-task launch that resumes the coroutine, which lives
+ * in the coroutine frame while the coroutine is suspended.
+ */
+class LaunchAwaiter: public IRunnable {
+    public:
+        LaunchAwaiter(ITaskSystem* t, IRunnable* runnable, int num_total_tasks,
+                      std::vector<TaskID> deps)
+            : t_(t), runnable_(runnable), num_total_tasks_(num_total_tasks),
+              deps_(std::move(deps)), id_(-1), state_(kSubmitting) {}
+        LaunchAwaiter(LaunchAwaiter&& other)
+            : t_(other.t_), runnable_(other.runnable_), num_total_tasks_(other.num_total_tasks_),
+              deps_(std::move(other.deps_)), id_(other.id_), state_(kSubmitting) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            handle_ = handle;
+            id_ = t_->runAsyncWithDeps(runnable_, num_total_tasks_, deps_);
+            state_.store(kSubmitting, std::memory_order_relaxed);
+            std::vector<TaskID> resume_deps(1, id_);
+            t_->runAsyncWithDeps(this, 1, resume_deps);
+            // runTask()看到kSubmitted之前不会恢复协程，所以这里访问成员是安全的；
+            // 如果恢复任务已经执行过了，就不挂起，直接继续协程
+            return state_.exchange(kSubmitted, std::memory_order_acq_rel) != kRan;
+        }
+
+        TaskID await_resume() const noexcept { return id_; }
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (state_.exchange(kRan, std::memory_order_acq_rel) == kSubmitting) {
+                return;
+            }
+            handle_.resume();
+        }
+
+    private:
+        enum { kSubmitting, kSubmitted, kRan };
+
+        ITaskSystem* t_;
+        IRunnable* runnable_;
+        int num_total_tasks_;
+        std::vector<TaskID> deps_;
+        TaskID id_;
+        std::coroutine_handle<> handle_;
+        // await_suspend()和恢复任务谁后到谁负责继续协程
+        std::atomic<int> state_;
+};
+
+/*
+ * Thin handle that lets coroutines co_await launches on an ITaskSystem.
+ * Cheap to copy; pass it to Pipeline coroutines by value.
+ */
+class AsyncTaskSystem {
+    public:
+        explicit AsyncTaskSystem(ITaskSystem* t): t_(t) {}
+
+        LaunchAwaiter launch(IRunnable* runnable, int num_total_tasks,
+                             std::vector<TaskID> deps = {}) const {
+            return LaunchAwaiter(t_, runnable, num_total_tasks, std::move(deps));
+        }
+
+        ITaskSystem* taskSystem() const { return t_; }
+
+    private:
+        ITaskSystem* t_;
+};
+
+#endif
+#endif
+
+#endif
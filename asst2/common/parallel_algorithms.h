@@ -0,0 +1,175 @@
+#ifndef _PARALLEL_ALGORITHMS_H
+#define _PARALLEL_ALGORITHMS_H
+
+#include "itasksys.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/*
+ * Loop templates on top of ITaskSystem::run().
+ *
+ *     parallel_for(t, 0, n, 1024, [&](int i) { out[i] = f(in[i]); });
+ *
+ *     double sum = parallel_reduce(t, IndexRange(0, n, 1024), 0.0,
+ *         [&](double& acc, int i) { acc += in[i]; },
+ *         [](double& acc, const double& other) { acc += other; });
+ *
+ * The loop body is a template parameter, so it is inlined into the loop
+ * over a claimed range: there is one virtual call per range of task ids,
+ * not one per element.  Both calls are synchronous, like run(), and may be
+ * used from inside runTask() on task systems that support nested
+ * launches.
+ */
+
+/*
+ * Iteration space [begin, end), handed out in chunks of `grain`
+ * consecutive indices.
+ */
+struct IndexRange {
+    int begin;
+    int end;
+    int grain;
+
+    IndexRange(int begin, int end, int grain = 1)
+        : begin(begin), end(end), grain(std::max(1, grain)) {}
+
+    int numChunks() const {
+        return end > begin ? (end - begin + grain - 1) / grain : 0;
+    }
+};
+
+namespace parallel_detail {
+
+template <typename F>
+class ForRunnable: public IRunnable {
+    public:
+        ForRunnable(const IndexRange& range, F& f): range_(range), f_(f) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            runTasks(task_id, task_id + 1, num_total_tasks);
+        }
+
+        // 一个range内的所有chunk是连续的下标，直接一个循环跑完
+        void runTasks(int begin, int end, int num_total_tasks) {
+            int first = range_.begin + begin * range_.grain;
+            int last = std::min(range_.end, range_.begin + end * range_.grain);
+            for (int i = first; i < last; i++) {
+                f_(i);
+            }
+        }
+
+    private:
+        IndexRange range_;
+        F& f_;
+};
+
+/*
+ * Each task of the launch owns one accumulator slot and keeps claiming
+ * chunks of the range until none are left, so the number of slots (and of
+ * combine() calls) does not depend on the size of the range, and uneven
+ * chunks are balanced dynamically.  Slots are padded so that workers never
+ * write to the same cache line.
+ */
+template <typename T, typename Fold>
+class ReduceRunnable: public IRunnable {
+    public:
+        struct Slot {
+            T value;
+            bool used;
+            char pad[64];
+            Slot(const T& identity): value(identity), used(false) {}
+        };
+
+        ReduceRunnable(const IndexRange& range, const T& identity, Fold& fold, int num_slots)
+            : range_(range), fold_(fold), num_chunks_(range.numChunks()) {
+            next_.value = 0;
+            slots_.reserve(num_slots);
+            for (int i = 0; i < num_slots; i++) {
+                slots_.emplace_back(identity);
+            }
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            Slot& slot = slots_[task_id];
+            int chunk;
+            while ((chunk = next_.value.fetch_add(1, std::memory_order_relaxed)) < num_chunks_) {
+                int first = range_.begin + chunk * range_.grain;
+                int last = std::min(range_.end, first + range_.grain);
+                for (int i = first; i < last; i++) {
+                    fold_(slot.value, i);
+                }
+                slot.used = true;
+            }
+        }
+
+        std::vector<Slot>& slots() { return slots_; }
+
+    private:
+        struct Counter {
+            char pad0[64];
+            std::atomic<int> value;
+            char pad1[64];
+        };
+
+        IndexRange range_;
+        Fold& fold_;
+        int num_chunks_;
+        Counter next_;
+        std::vector<Slot> slots_;
+};
+
+} // namespace parallel_detail
+
+/*
+ * Calls f(i) for every i in [begin, end), `grain` consecutive indices per
+ * task.
+ */
+template <typename F>
+void parallel_for(ITaskSystem* t, int begin, int end, int grain, F f) {
+    IndexRange range(begin, end, grain);
+    int num_chunks = range.numChunks();
+    if (num_chunks == 0) {
+        return;
+    }
+    parallel_detail::ForRunnable<F> runnable(range, f);
+    t->run(&runnable, num_chunks);
+}
+
+/*
+ * Reduces the indices of `range`: each worker starts from a copy of
+ * `identity` and folds indices into it with fold(T& acc, int i); the
+ * per-worker results are then merged on the calling thread with
+ * combine(T& acc, const T& other), in worker order.  fold and combine
+ * must together be associative; the grouping of indices into partial
+ * results is unspecified.
+ *
+ * `max_workers` bounds the number of accumulators (and of tasks in the
+ * launch); by default it is t->numThreads(), one accumulator per thread
+ * that can run the launch.
+ */
+template <typename T, typename Fold, typename Combine>
+T parallel_reduce(ITaskSystem* t, const IndexRange& range, const T& identity,
+                  Fold fold, Combine combine, int max_workers = 0) {
+    int num_chunks = range.numChunks();
+    if (max_workers <= 0) {
+        max_workers = t->numThreads();
+    }
+    int num_slots = std::min(num_chunks, max_workers);
+    T result = identity;
+    if (num_slots == 0) {
+        return result;
+    }
+
+    parallel_detail::ReduceRunnable<T, Fold> runnable(range, identity, fold, num_slots);
+    t->run(&runnable, num_slots);
+    for (auto& slot : runnable.slots()) {
+        // 没抢到chunk的slot还是identity，不用合并
+        if (slot.used) {
+            combine(result, slot.value);
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef _TASKSYS_OPTIONS_H
+#define _TASKSYS_OPTIONS_H
+
+#include <algorithm>
+#include <atomic>
+
+/*
+ * How a task system hands out the task ids of a bulk launch to workers.
+ *
+ *  - GRAIN_SINGLE: one task id per claim.
+ *
+ *  - GRAIN_GUIDED: a worker claims a contiguous range of task ids with a
+ *    single atomic operation.  The range size is the number of unclaimed
+ *    tasks divided by 2 * num_threads (but at least min_grain), so claims
+ *    start large and shrink as the launch drains, like OpenMP's guided
+ *    schedule.
+ */
+enum GrainMode {
+    GRAIN_SINGLE,
+    GRAIN_GUIDED,
+};
+
+/*
+ * What an idle worker does while it waits for work.
+ *
+ *  - IDLE_SPIN: spins (with a pause hint) until work shows up and never
+ *    gives up its core.
+ *
+ *  - IDLE_PARK: goes to sleep right away.
+ *
+ *  - IDLE_HYBRID: spins for spin_us microseconds, then yields its core for
+ *    another yield_us microseconds, then goes to sleep.
+ *
+ * A sleeping worker is woken individually when new work is published for
+ * it, instead of waking every worker.
+ */
+enum IdleMode {
+    IDLE_SPIN,
+    IDLE_PARK,
+    IDLE_HYBRID,
+};
+
+/*
+ * Where a pool pins its worker threads (see topology.h).
+ *
+ *  - PLACEMENT_NONE: threads are not pinned; the OS places them.
+ *
+ *  - PLACEMENT_COMPACT: workers are packed onto as few cores and sockets
+ *    as possible, sharing caches.
+ *
+ *  - PLACEMENT_SCATTER: workers are spread round-robin across sockets and
+ *    physical cores, maximizing memory bandwidth.
+ */
+enum PlacementMode {
+    PLACEMENT_NONE,
+    PLACEMENT_COMPACT,
+    PLACEMENT_SCATTER,
+};
+
+/*
+ * In which order a task system starts launches whose dependencies are all
+ * done.  Launches with a higher runAsyncWithDeps() priority always go
+ * first; this decides between launches of equal priority.
+ *
+ *  - READY_FIFO: in the order they became ready.
+ *
+ *  - READY_CRITICAL_PATH: longest estimated downstream critical path
+ *    first, where a launch's path is its task count plus the longest path
+ *    among the launches that depend on it.  Each submission carries the
+ *    increase up through the unfinished launches it depends on (a bounded
+ *    number of them per submission), re-ranking those that are already
+ *    ready.  Launches on the longest chain of a DAG then start early
+ *    instead of leaving the tail of the graph running on a few cores.
+ */
+enum ReadyOrder {
+    READY_FIFO,
+    READY_CRITICAL_PATH,
+};
+
+/*
+ * Knobs shared by the parallel task systems.  Implementations ignore the
+ * fields they do not support.
+ */
+struct TaskSystemOptions {
+    GrainMode grain_mode;
+    int min_grain;
+    IdleMode idle_mode;
+    int spin_us;
+    int yield_us;
+    PlacementMode placement;
+    ReadyOrder ready_order;
+
+    TaskSystemOptions(): grain_mode(GRAIN_GUIDED), min_grain(1),
+        idle_mode(IDLE_HYBRID), spin_us(20), yield_us(50),
+        placement(PLACEMENT_NONE), ready_order(READY_FIFO) {}
+};
+
+/*
+ * Number of task ids the next claim should take when `remaining` tasks
+ * of the launch are still unclaimed.
+ */
+static inline int grainSize(const TaskSystemOptions& options,
+                            int remaining, int num_threads) {
+    if (options.grain_mode == GRAIN_SINGLE) {
+        return 1;
+    }
+    int guided = (remaining + 2 * num_threads - 1) / (2 * num_threads);
+    return std::max(std::max(1, options.min_grain), guided);
+}
+
+/*
+ * Claims the next range [*begin, *end) of task ids from the shared counter
+ * `next`.  Returns false once all num_total_tasks ids have been claimed.
+ */
+static inline bool claimTasks(std::atomic<int>& next, int num_total_tasks,
+                              int num_threads, const TaskSystemOptions& options,
+                              int* begin, int* end) {
+    if (options.grain_mode == GRAIN_SINGLE) {
+        int cur = next.fetch_add(1);
+        if (cur >= num_total_tasks) {
+            return false;
+        }
+        *begin = cur;
+        *end = cur + 1;
+        return true;
+    }
+
+    int cur = next.load(std::memory_order_relaxed);
+    while (cur < num_total_tasks) {
+        int chunk = grainSize(options, num_total_tasks - cur, num_threads);
+        int last = std::min(num_total_tasks, cur + chunk);
+        if (next.compare_exchange_weak(cur, last)) {
+            *begin = cur;
+            *end = last;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
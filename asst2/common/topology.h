@@ -0,0 +1,245 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include "tasksys_options.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * CPU topology, discovered from /sys/devices/system (Linux only).  Each
+ * logical cpu the process may run on is described by its physical core,
+ * socket and NUMA node.  Elsewhere, or when /sys cannot be read, every
+ * logical cpu is treated as its own core on socket 0, and pinning is a
+ * no-op.
+ */
+struct CpuInfo {
+    int cpu; // 逻辑cpu编号
+    int core; // 同一个socket内的物理core编号
+    int socket;
+    int node; // NUMA node
+};
+
+class Topology {
+    public:
+        static const Topology& instance() {
+            static Topology topology;
+            return topology;
+        }
+
+        const std::vector<CpuInfo>& cpus() const { return cpus_; }
+        int numSockets() const { return num_sockets_; }
+
+        /*
+         * Logical cpu for each of num_threads workers under `mode`, or an
+         * empty vector for PLACEMENT_NONE.  Threads wrap around when there
+         * are more threads than cpus.
+         *
+         *  - PLACEMENT_COMPACT: fill all hyper-threads of a core, then all
+         *    cores of a socket, before moving to the next socket.
+         *  - PLACEMENT_SCATTER: round-robin across sockets, using one
+         *    hyper-thread of every core before doubling up on a core.
+         */
+        std::vector<int> placement(PlacementMode mode, int num_threads) const {
+            std::vector<int> result;
+            if (mode == PLACEMENT_NONE || cpus_.empty()) {
+                return result;
+            }
+
+            std::vector<CpuInfo> order = cpus_;
+            if (mode == PLACEMENT_COMPACT) {
+                std::sort(order.begin(), order.end(), [](const CpuInfo& a, const CpuInfo& b) {
+                    if (a.socket != b.socket) return a.socket < b.socket;
+                    if (a.core != b.core) return a.core < b.core;
+                    return a.cpu < b.cpu;
+                });
+            } else {
+                // 先按 (hyper-thread序号, core) 排每个socket内部，再在socket之间轮转
+                std::vector<std::vector<CpuInfo>> per_socket(num_sockets_);
+                for (const CpuInfo& c : cpus_) {
+                    per_socket[c.socket].push_back(c);
+                }
+                std::vector<std::vector<std::pair<int, CpuInfo>>> ranked(num_sockets_);
+                for (int s = 0; s < num_sockets_; s++) {
+                    std::vector<CpuInfo>& v = per_socket[s];
+                    std::sort(v.begin(), v.end(), [](const CpuInfo& a, const CpuInfo& b) {
+                        return a.core != b.core ? a.core < b.core : a.cpu < b.cpu;
+                    });
+                    for (size_t i = 0; i < v.size(); i++) {
+                        int sibling = 0;
+                        while (i > (size_t)sibling && v[i - sibling - 1].core == v[i].core) {
+                            sibling++;
+                        }
+                        ranked[s].push_back(std::make_pair(sibling, v[i]));
+                    }
+                    std::stable_sort(ranked[s].begin(), ranked[s].end(),
+                        [](const std::pair<int, CpuInfo>& a, const std::pair<int, CpuInfo>& b) {
+                            return a.first < b.first;
+                        });
+                }
+                order.clear();
+                for (size_t i = 0; order.size() < cpus_.size(); i++) {
+                    for (int s = 0; s < num_sockets_; s++) {
+                        if (i < ranked[s].size()) {
+                            order.push_back(ranked[s][i].second);
+                        }
+                    }
+                }
+            }
+
+            for (int i = 0; i < num_threads; i++) {
+                result.push_back(order[i % order.size()].cpu);
+            }
+            return result;
+        }
+
+        // 逻辑cpu所在的socket，未知时返回0
+        int socketOf(int cpu) const {
+            for (const CpuInfo& c : cpus_) {
+                if (c.cpu == cpu) {
+                    return c.socket;
+                }
+            }
+            return 0;
+        }
+
+    private:
+        static constexpr int kMaxNodes = 64;
+
+        Topology(): num_sockets_(1) {
+            discover();
+            if (cpus_.empty()) {
+                int n = std::max(1u, std::thread::hardware_concurrency());
+                for (int i = 0; i < n; i++) {
+                    cpus_.push_back(CpuInfo{i, i, 0, 0});
+                }
+            }
+        }
+
+        static bool readInt(const std::string& path, int* value) {
+            FILE* f = fopen(path.c_str(), "r");
+            if (f == NULL) {
+                return false;
+            }
+            bool ok = fscanf(f, "%d", value) == 1;
+            fclose(f);
+            return ok;
+        }
+
+        // 解析 "0-3,8,10-11" 这样的cpu列表
+        static std::vector<int> readCpuList(const std::string& path) {
+            std::vector<int> result;
+            FILE* f = fopen(path.c_str(), "r");
+            if (f == NULL) {
+                return result;
+            }
+            int lo, hi;
+            while (fscanf(f, "%d", &lo) == 1) {
+                hi = lo;
+                int c = fgetc(f);
+                if (c == '-') {
+                    if (fscanf(f, "%d", &hi) != 1) {
+                        break;
+                    }
+                    c = fgetc(f);
+                }
+                for (int i = lo; i <= hi; i++) {
+                    result.push_back(i);
+                }
+                if (c != ',') {
+                    break;
+                }
+            }
+            fclose(f);
+            return result;
+        }
+
+        void discover() {
+#ifdef __linux__
+            const std::string cpu_dir = "/sys/devices/system/cpu/";
+            std::vector<int> online = readCpuList(cpu_dir + "online");
+
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+            std::vector<int> node_of;
+            // node编号可能不连续，所以每个可能的编号都试一下
+            for (int node = 0; node < kMaxNodes; node++) {
+                std::vector<int> list = readCpuList("/sys/devices/system/node/node" +
+                                                   std::to_string(node) + "/cpulist");
+                for (int cpu : list) {
+                    if (cpu >= (int)node_of.size()) {
+                        node_of.resize(cpu + 1, 0);
+                    }
+                    node_of[cpu] = node;
+                }
+            }
+
+            std::vector<int> socket_ids;
+            for (int cpu : online) {
+                if (have_mask && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))) {
+                    continue;
+                }
+                std::string topo = cpu_dir + "cpu" + std::to_string(cpu) + "/topology/";
+                int core = cpu, package = 0;
+                readInt(topo + "core_id", &core);
+                readInt(topo + "physical_package_id", &package);
+                int node = cpu < (int)node_of.size() ? node_of[cpu] : 0;
+                cpus_.push_back(CpuInfo{cpu, core, package, node});
+                socket_ids.push_back(package);
+            }
+
+            // socket编号压缩成 0..num_sockets_-1
+            std::sort(socket_ids.begin(), socket_ids.end());
+            socket_ids.erase(std::unique(socket_ids.begin(), socket_ids.end()), socket_ids.end());
+            for (CpuInfo& c : cpus_) {
+                c.socket = std::lower_bound(socket_ids.begin(), socket_ids.end(), c.socket) -
+                           socket_ids.begin();
+            }
+            num_sockets_ = std::max<int>(1, socket_ids.size());
+#endif
+        }
+
+        std::vector<CpuInfo> cpus_;
+        int num_sockets_;
+};
+
+/*
+ * Pins `thread` to logical cpu `cpu`.  A negative cpu, or a platform
+ * without thread affinity, leaves the thread unpinned.
+ */
+static inline void pinThread(std::thread& thread, int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+/*
+ * Pins the threads of a pool according to options.placement, thread i to
+ * the i-th cpu of the placement order.
+ */
+static inline void placeThreads(std::vector<std::thread>& threads,
+                                const TaskSystemOptions& options) {
+    std::vector<int> cpus = Topology::instance().placement(options.placement, threads.size());
+    for (size_t i = 0; i < cpus.size(); i++) {
+        pinThread(threads[i], cpus[i]);
+    }
+}
+
+#endif
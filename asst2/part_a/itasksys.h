@@ -1,5 +1,6 @@
 #ifndef _ITASKSYS_H
 #define _ITASKSYS_H
+#include <chrono>
 #include <vector>
 
 typedef int TaskID;
@@ -18,6 +19,16 @@ class IRunnable {
              task launch.
          */
         virtual void runTask(int task_id, int num_total_tasks) = 0;
+
+        /*
+          Executes the instances [begin, end) of the task as part of a
+          bulk task launch.  Task systems that hand out ranges of task
+          ids call this once per range.  The default implementation
+          calls runTask() for every id in the range; runnables may
+          override it to process a whole range at once (e.g. to
+          vectorize across tasks).
+         */
+        virtual void runTasks(int begin, int end, int num_total_tasks);
 };
 
 class ITaskSystem {
@@ -61,10 +72,104 @@ class ITaskSystem {
         virtual TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                         const std::vector<TaskID>& deps) = 0;
 
+        /*
+          Same as runAsyncWithDeps() above, but with a scheduling
+          priority.  Among launches whose dependencies are all done,
+          task systems that support priorities start higher-priority
+          launches first.  The three-argument form uses priority 0.
+          The default implementation ignores the priority.
+         */
+        virtual TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                        const std::vector<TaskID>& deps, int priority);
+
         /*
           Blocks until all tasks created as a result of **any prior**
           runXXX calls are done.
          */
         virtual void sync() = 0;
+
+        /*
+          Blocks until the bulk task launch `task_id` (and therefore
+          everything it depends on) is complete, without waiting for
+          unrelated launches.  The default implementation calls sync().
+         */
+        virtual void wait(TaskID task_id);
+
+        /*
+          Blocks until at least one of the bulk task launches in
+          `task_ids` is complete and returns its TaskID, or returns -1
+          if `task_ids` is empty.  The default implementation calls
+          sync() and returns the first TaskID.
+         */
+        virtual TaskID waitAny(const std::vector<TaskID>& task_ids);
+
+        /*
+          Cooperatively cancels the bulk task launch `task_id`.  Task ids of
+          the launch that have not been handed to a worker yet are skipped,
+          and so is every launch that (transitively) depends on it, without
+          running any of its tasks; tasks that are already running finish
+          normally.  A cancelled launch counts as complete for wait(),
+          waitAny() and sync().  A launch submitted later with a dependency on
+          a cancelled launch is skipped too, unless the cancellation was
+          already reported by sync().  Returns true if the launch had not
+          completed yet.  The default implementation does nothing and
+          returns false.
+         */
+        virtual bool cancel(TaskID task_id);
+
+        /*
+          Cancels the bulk task launch `task_id`, as with cancel(), if it has
+          not completed by `deadline`.  Task systems check the deadline
+          whenever they hand out task ids of the launch, so an expired launch
+          stops within one claimed range of tasks.  Returns true if the launch
+          had not completed yet.  The default implementation does nothing and
+          returns false.
+         */
+        virtual bool setDeadline(TaskID task_id,
+                                 std::chrono::steady_clock::time_point deadline);
+
+        /*
+          Same as sync(), and also stores in `cancelled` the TaskIDs of the
+          launches that were cancelled since the previous sync(): explicitly,
+          by a deadline, or because a dependency was cancelled.  The default
+          implementation calls sync() and reports nothing.
+         */
+        virtual void sync(std::vector<TaskID>* cancelled);
+
+        /*
+          Creates a scheduling group named `name` and returns its id.  Task
+          systems with fair sharing divide worker time among the groups that
+          have ready work in proportion to their weights (at least 1), so a
+          large launch in one group cannot starve the others.  Launches
+          submitted without a group belong to group 0, which always exists
+          and has weight 1.  The default implementation returns 0.
+         */
+        virtual int createGroup(const char* name, int weight);
+
+        /*
+          Same as runAsyncWithDeps(), but the launch belongs to `group`.
+          Dependencies may name launches of any group.  The default
+          implementation ignores the group.
+         */
+        virtual TaskID runAsyncInGroup(int group, IRunnable* runnable, int num_total_tasks,
+                                       const std::vector<TaskID>& deps);
+
+        /*
+          Blocks until all launches submitted to `group` so far are complete,
+          without waiting for other groups.  The default implementation calls
+          sync().
+         */
+        virtual void syncGroup(int group);
+
+        /*
+          Returns the number of threads that can run tasks of this task
+          system at the same time, e.g. to size per-worker state.  The
+          default implementation returns the num_threads passed to the
+          constructor (at least 1).
+         */
+        virtual int numThreads();
+
+    private:
+        int num_threads_;
 };
 #endif
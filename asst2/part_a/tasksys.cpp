@@ -1,13 +1,68 @@
 #include "tasksys.h"
+#include <algorithm>
 #include <cassert>
 #include <thread>
 
 
 IRunnable::~IRunnable() {}
 
-ITaskSystem::ITaskSystem(int num_threads) {}
+void IRunnable::runTasks(int begin, int end, int num_total_tasks) {
+    for (int i = begin; i < end; i++) {
+        runTask(i, num_total_tasks);
+    }
+}
+
+ITaskSystem::ITaskSystem(int num_threads): num_threads_(std::max(1, num_threads)) {}
 ITaskSystem::~ITaskSystem() {}
 
+TaskID ITaskSystem::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                     const std::vector<TaskID>& deps, int priority) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void ITaskSystem::wait(TaskID task_id) {
+    sync();
+}
+
+TaskID ITaskSystem::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+    sync();
+    return task_ids[0];
+}
+
+bool ITaskSystem::cancel(TaskID task_id) {
+    return false;
+}
+
+bool ITaskSystem::setDeadline(TaskID task_id,
+                              std::chrono::steady_clock::time_point deadline) {
+    return false;
+}
+
+void ITaskSystem::sync(std::vector<TaskID>* cancelled) {
+    sync();
+    cancelled->clear();
+}
+
+int ITaskSystem::createGroup(const char* name, int weight) {
+    return 0;
+}
+
+TaskID ITaskSystem::runAsyncInGroup(int group, IRunnable* runnable, int num_total_tasks,
+                                    const std::vector<TaskID>& deps) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void ITaskSystem::syncGroup(int group) {
+    sync();
+}
+
+int ITaskSystem::numThreads() {
+    return num_threads_;
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -38,6 +93,11 @@ void TaskSystemSerial::sync() {
     return;
 }
 
+// 串行实现只有调用线程在跑任务
+int TaskSystemSerial::numThreads() {
+    return 1;
+}
+
 /*
  * ================================================================
  * Parallel Task System Implementation
@@ -48,7 +108,8 @@ const char* TaskSystemParallelSpawn::name() {
     return "Parallel + Always Spawn";
 }
 
-TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads): ITaskSystem(num_threads), num_thread_(num_threads), task_idx_(0) {
+TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
+    num_thread_(num_threads), options_(options), task_idx_(0) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
@@ -72,15 +133,13 @@ void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
     task_idx_ = 0;
     for (int i = 0; i < num_thread_; ++i) {
         threads[i] = std::thread([&](){
-            while (true) {
-                int cur_task_index = task_idx_++;
-                if (cur_task_index >= num_total_tasks) {
-                    return;
-                }
-                runnable->runTask(cur_task_index, num_total_tasks);
+            int begin, end;
+            while (claimTasks(task_idx_, num_total_tasks, num_thread_, options_, &begin, &end)) {
+                runnable->runTasks(begin, end, num_total_tasks);
             }
         });
     }
+    placeThreads(threads, options_);
     for (int i = 0; i < num_thread_; ++i) {
         threads[i].join();
     }
@@ -105,7 +164,7 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads),
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
     runnable_(nullptr), stop_(false), task_done_(0) {
     //
     // TODO: CS149 student implementations may decide to perform setup
@@ -131,6 +190,7 @@ TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int n
             }
        }});
     }
+    placeThreads(threads_, options);
 }
 
 TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
@@ -181,7 +241,7 @@ const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads),
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
     stop_(false),
     global_task_id_(0),
     num_all_undone_task(0) {
@@ -242,6 +302,7 @@ TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int n
     for (int i = 0; i < num_threads; ++i) {
         threads_.emplace_back(worker);
     }
+    placeThreads(threads_, options);
 }
 
 TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
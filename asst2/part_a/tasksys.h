@@ -2,6 +2,8 @@
 #define _TASKSYS_H
 
 #include "itasksys.h"
+#include "tasksys_options.h"
+#include "topology.h"
 #include <atomic>
 #include <queue>
 #include <vector>
@@ -24,6 +26,7 @@ class TaskSystemSerial: public ITaskSystem {
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        int numThreads();
 };
 
 /*
@@ -34,7 +37,8 @@ class TaskSystemSerial: public ITaskSystem {
  */
 class TaskSystemParallelSpawn: public ITaskSystem {
     public:
-        TaskSystemParallelSpawn(int num_threads);
+        TaskSystemParallelSpawn(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelSpawn();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -43,6 +47,7 @@ class TaskSystemParallelSpawn: public ITaskSystem {
         void sync();
 private:
     int num_thread_;
+    TaskSystemOptions options_;
     std::atomic<int> task_idx_;
 };
 
@@ -54,7 +59,8 @@ private:
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -79,7 +85,8 @@ private:
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
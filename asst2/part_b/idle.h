@@ -0,0 +1,85 @@
+#ifndef _IDLE_H
+#define _IDLE_H
+
+#include <atomic>
+#include <thread>
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+/*
+ * Hint to the CPU that the caller is in a spin-wait loop (`pause` on x86,
+ * `yield` on ARM), which saves power and frees pipeline resources for the
+ * sibling hyper-thread.
+ */
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+/*
+ * Parker: lets one thread block until another thread unparks it.  On Linux
+ * this is a futex on a single word, so unpark() wakes exactly this thread
+ * and costs one syscall; elsewhere it falls back to a mutex and condition
+ * variable owned by the parker.
+ *
+ * prepare() must be called before the thread publishes itself as parked;
+ * an unpark() that happens between prepare() and park() makes park()
+ * return immediately.
+ */
+class Parker {
+    public:
+        Parker(): state_(0) {}
+
+        void prepare() {
+            state_.store(1);
+        }
+
+        void park() {
+#ifdef __linux__
+            while (state_.load() == 1) {
+                syscall(SYS_futex, reinterpret_cast<int*>(&state_),
+                        FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+            }
+#else
+            std::unique_lock<std::mutex> lk(lk_);
+            cv_.wait(lk, [&]() {
+                return state_.load() == 0;
+            });
+#endif
+        }
+
+        void unpark() {
+#ifdef __linux__
+            state_.store(0);
+            syscall(SYS_futex, reinterpret_cast<int*>(&state_),
+                    FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+            {
+                std::lock_guard<std::mutex> lk(lk_);
+                state_.store(0);
+            }
+            cv_.notify_one();
+#endif
+        }
+
+    private:
+        std::atomic<int> state_; // 1表示已经准备睡眠，0表示被唤醒
+#ifndef __linux__
+        std::mutex lk_;
+        std::condition_variable cv_;
+#endif
+};
+
+#endif
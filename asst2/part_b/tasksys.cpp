@@ -1,15 +1,80 @@
 #include "tasksys.h"
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <thread>
 
 // #define DEBUG
 
+/*
+ * The pool whose worker is running on this thread (nullptr on threads that
+ * no task system created), and the worker's index within that pool.  A
+ * run() that sees its own pool here was called from inside runTask(), so
+ * it must not block the worker: the pools below either help execute queued
+ * work until the nested launch is done or run the launch inline.
+ */
+static thread_local ITaskSystem* current_pool = nullptr;
+static thread_local int current_worker = -1;
 
 IRunnable::~IRunnable() {}
 
-ITaskSystem::ITaskSystem(int num_threads) {}
+void IRunnable::runTasks(int begin, int end, int num_total_tasks) {
+    for (int i = begin; i < end; i++) {
+        runTask(i, num_total_tasks);
+    }
+}
+
+ITaskSystem::ITaskSystem(int num_threads): num_threads_(std::max(1, num_threads)) {}
 ITaskSystem::~ITaskSystem() {}
 
+TaskID ITaskSystem::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                     const std::vector<TaskID>& deps, int priority) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void ITaskSystem::wait(TaskID task_id) {
+    sync();
+}
+
+TaskID ITaskSystem::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+    sync();
+    return task_ids[0];
+}
+
+bool ITaskSystem::cancel(TaskID task_id) {
+    return false;
+}
+
+bool ITaskSystem::setDeadline(TaskID task_id,
+                              std::chrono::steady_clock::time_point deadline) {
+    return false;
+}
+
+void ITaskSystem::sync(std::vector<TaskID>* cancelled) {
+    sync();
+    cancelled->clear();
+}
+
+int ITaskSystem::createGroup(const char* name, int weight) {
+    return 0;
+}
+
+TaskID ITaskSystem::runAsyncInGroup(int group, IRunnable* runnable, int num_total_tasks,
+                                    const std::vector<TaskID>& deps) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void ITaskSystem::syncGroup(int group) {
+    sync();
+}
+
+int ITaskSystem::numThreads() {
+    return num_threads_;
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -41,6 +106,11 @@ void TaskSystemSerial::sync() {
     return;
 }
 
+// 串行实现只有调用线程在跑任务
+int TaskSystemSerial::numThreads() {
+    return 1;
+}
+
 /*
  * ================================================================
  * Parallel Task System Implementation
@@ -51,7 +121,8 @@ const char* TaskSystemParallelSpawn::name() {
     return "Parallel + Always Spawn";
 }
 
-TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads): ITaskSystem(num_threads), num_thread_(num_threads), task_idx_(0) {
+TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
+    num_thread_(num_threads), options_(options), task_idx_(0) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
@@ -71,19 +142,24 @@ void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
     // tasks sequentially on the calling thread.
     //
 
+    if (current_pool == this) {
+        // 嵌套的launch直接在当前线程上执行，task_idx_正在被外层使用
+        runnable->runTasks(0, num_total_tasks, num_total_tasks);
+        return;
+    }
+
     std::vector<std::thread> threads(num_thread_);
     task_idx_ = 0;
     for (int i = 0; i < num_thread_; ++i) {
         threads[i] = std::thread([&](){
-            while (true) {
-                int cur_task_index = task_idx_++;
-                if (cur_task_index >= num_total_tasks) {
-                    return;
-                }
-                runnable->runTask(cur_task_index, num_total_tasks);
+            current_pool = this;
+            int begin, end;
+            while (claimTasks(task_idx_, num_total_tasks, num_thread_, options_, &begin, &end)) {
+                runnable->runTasks(begin, end, num_total_tasks);
             }
         });
     }
+    placeThreads(threads, options_);
     for (int i = 0; i < num_thread_; ++i) {
         threads[i].join();
     }
@@ -109,7 +185,7 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads),
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
     runnable_(nullptr), stop_(false), task_done_(0) {
     //
     // TODO: CS149 student implementations may decide to perform setup
@@ -120,6 +196,7 @@ TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int n
     threads_.reserve(num_threads);
     for (int i = 0; i < num_threads; ++i) {
        threads_.emplace_back([&]() {
+           current_pool = this;
            while (!stop_) {
             int task_index = -1;
             {
@@ -135,6 +212,7 @@ TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int n
             }
        }});
     }
+    placeThreads(threads_, options);
 }
 
 TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
@@ -152,6 +230,12 @@ void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_tota
     // method in Part A.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
+    if (current_pool == this) {
+        // 嵌套的launch直接在当前线程上执行，不能覆盖外层launch的状态
+        runnable->runTasks(0, num_total_tasks, num_total_tasks);
+        return;
+    }
+
     num_total_tasks_ = num_total_tasks;
     runnable_ = runnable;
     task_done_ = 0;
@@ -186,10 +270,17 @@ const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads),
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
     stop_(false),
-    global_task_id_(0),
-    num_all_undone_task(0) {
+    num_threads_(num_threads),
+    options_(options),
+    num_all_undone_task(0),
+    num_waiters_(0),
+    num_nested_waiters_(0),
+    num_ready_(0),
+    parkers_(num_threads),
+    vtime_(0),
+    next_ready_seq_(0) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
@@ -198,72 +289,34 @@ TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int n
     //
     threads_.reserve(num_threads);
     graph_.reserve(N);
+    preds_.reserve(N);
     in_degree_.reserve(N);
     task_info_.reserve(N);
+    generation_.reserve(N);
+    groups_.emplace_back("default", 1);
+    parked_.reserve(num_threads);
 
-    auto worker = [&]() {
-        IRunnable *runnable;
-        int cur_index;
-        TaskID task_id;
+    auto worker = [this](int id) {
+        current_pool = this;
+        TRACE_SPAN_BEGIN(lock_start);
+        std::unique_lock<std::mutex> lk(lk_);
+        TRACE_SPAN_END(lock_start, TRACE_LOCK_WAIT, -1, 0, 0);
         while (!stop_) {
-
-            std::unique_lock<std::mutex> lk(lk_);
-            if (tasks_.empty()) {
-                cv_worker_.wait(lk, [&]() {
-                    return stop_ || !tasks_.empty();
-                });
-            }
-
-            if (stop_) {
-                return;
-            }
-
-            auto& work = tasks_.front();
-            task_id = work.id;
-            runnable = task_info_[task_id].runnable;
-            cur_index = work.cur_index++;
-            if (work.cur_index >= task_info_[task_id].num_total_task) {
-               tasks_.pop();
-            }
-            #ifdef DEBUG
-            printf("TaskID: %d, cur_index: %d be called\n", task_id, cur_index);
-            #endif
-            lk.unlock();
-
-            runnable->runTask(cur_index, task_info_[task_id].num_total_task);
-
-            lk.lock();
-            task_info_[task_id].num_done_work++;
-            if (task_info_[task_id].num_done_work == task_info_[task_id].num_total_task) {
-                // lk.lock();
-                #ifdef DEBUG
-                printf("TaskID: %d Done\n", task_id);
-                #endif
-                // 当前task的所有work都已经被做完了
-                for (auto x : graph_[task_id]) {
-                    in_degree_[x]--;
-                    if (in_degree_[x] == 0) {
-
-                        #ifdef DEBUG
-                        printf("TaskID: %d enqueue\n", x);
-                        #endif
-
-                        tasks_.push({x, 0});
-                        cv_worker_.notify_all();
-                    }
-                }
-                num_all_undone_task -= 1;
-                if (num_all_undone_task == 0) {
-                    cv_main_.notify_one();
-                }
+            if (num_ready_ == 0) {
+                TRACE_SPAN_BEGIN(idle_start);
+                idleWait(id, lk);
+                TRACE_SPAN_END(idle_start, TRACE_IDLE, -1, 0, 0);
+                continue;
             }
+            runClaimedWork(lk);
         }
     };
 
 
     for (int i = 0; i < num_threads; ++i) {
-        threads_.emplace_back(worker);
+        threads_.emplace_back(worker, i);
     }
+    placeThreads(threads_, options_);
 }
 
 TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
@@ -274,13 +327,260 @@ TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
     // (requiring changes to tasksys.h).
     //
     sync();
-    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lk(lk_);
+        stop_ = true;
+        for (int id : parked_) {
+            parkers_[id].unpark();
+        }
+        parked_.clear();
+    }
     cv_worker_.notify_all();
     for (auto& thread : threads_) {
         thread.join();
     }
 }
 
+/*
+ * Waits until there may be ready work, following options_.idle_mode:
+ * spins and then yields without holding lk_, then parks until
+ * wakeWorkers() picks this worker.  Called and returns with lk_ held.
+ */
+void TaskSystemParallelThreadPoolSleeping::idleWait(int id, std::unique_lock<std::mutex>& lk) {
+    if (options_.idle_mode != IDLE_PARK) {
+        lk.unlock();
+        auto start = std::chrono::steady_clock::now();
+        while (!stop_ && num_ready_.load(std::memory_order_relaxed) == 0) {
+            if (options_.idle_mode == IDLE_SPIN) {
+                for (int i = 0; i < 32; ++i) {
+                    cpuRelax();
+                }
+                continue;
+            }
+
+            long elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed_us < options_.spin_us) {
+                for (int i = 0; i < 32; ++i) {
+                    cpuRelax();
+                }
+            } else if (elapsed_us < options_.spin_us + options_.yield_us) {
+                std::this_thread::yield();
+            } else {
+                break;
+            }
+        }
+        lk.lock();
+        if (stop_ || num_ready_ > 0) {
+            return;
+        }
+    }
+
+    // 在lk_下登记，wakeWorkers()也在lk_下唤醒，不会错过
+    parkers_[id].prepare();
+    parked_.push_back(id);
+    lk.unlock();
+    parkers_[id].park();
+    lk.lock();
+}
+
+// 唤醒最多count个睡眠的worker，优先唤醒最近睡眠的（cache更热）。调用时持有lk_
+void TaskSystemParallelThreadPoolSleeping::wakeWorkers(int count) {
+    while (count-- > 0 && !parked_.empty()) {
+        int id = parked_.back();
+        parked_.pop_back();
+        parkers_[id].unpark();
+    }
+}
+
+/*
+ * Claims the next range of the highest-priority ready launch of the group
+ * whose turn it is, runs it with lk_ released, and records its completion.
+ * Called with lk_ held and num_ready_ > 0; returns with lk_ held.
+ */
+void TaskSystemParallelThreadPoolSleeping::runClaimedWork(std::unique_lock<std::mutex>& lk) {
+    IRunnable *runnable;
+    int begin, end, num_total_task;
+    TaskID task_id;
+    int slot;
+
+    // 一次领取一段连续的任务，减少加锁的次数
+    int group = pickGroup();
+    const WorkInfo& top = groups_[group].ready.top();
+    task_id = top.id;
+    slot = slotOf(task_id);
+    TaskInfo& info = task_info_[slot];
+    if (info.id != task_id || info.cancelled || top.path != info.path) {
+        // 被取消的launch剩下的任务已经被跳过了；path变大后已经用新的path重新入队，
+        // 队列里的这一项作废
+        popReady(group);
+        return;
+    }
+    if (info.deadline != std::chrono::steady_clock::time_point::max() &&
+        std::chrono::steady_clock::now() >= info.deadline) {
+        popReady(group);
+        markCancelled(slot);
+        skipUnclaimed(slot);
+        return;
+    }
+    runnable = info.runnable;
+    num_total_task = info.num_total_task;
+    begin = info.next_index;
+    end = std::min(num_total_task,
+                   begin + grainSize(options_, num_total_task - begin, num_threads_));
+    info.next_index = end;
+    if (end >= num_total_task) {
+       popReady(group);
+       info.queued = false;
+    }
+
+    // 只有一个组时不需要计费
+    bool fair_share = groups_.size() > 1;
+    double charge = 0;
+    if (fair_share) {
+        Group& g = groups_[group];
+        vtime_ = g.pass;
+        charge = (end - begin) * g.ns_per_task / g.weight;
+        g.pass += charge;
+    }
+    #ifdef DEBUG
+    printf("TaskID: %lld, tasks [%d, %d) be called\n", task_id, begin, end);
+    #endif
+    lk.unlock();
+
+    if (begin == 0) {
+        TRACE_INSTANT(TRACE_LAUNCH_START, task_id);
+    }
+    std::chrono::steady_clock::time_point run_begin;
+    if (fair_share) {
+        run_begin = std::chrono::steady_clock::now();
+    }
+    TRACE_SPAN_BEGIN(run_start);
+    runnable->runTasks(begin, end, num_total_task);
+    TRACE_SPAN_END(run_start, TRACE_TASK_RUN, task_id, begin, end);
+    double run_ns = 0;
+    if (fair_share) {
+        run_ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - run_begin).count();
+    }
+
+    TRACE_SPAN_BEGIN(relock_start);
+    lk.lock();
+    TRACE_SPAN_END(relock_start, TRACE_LOCK_WAIT, -1, 0, 0);
+    if (fair_share) {
+        // 用实际耗时修正预先计的费用
+        Group& g = groups_[group];
+        g.pass += run_ns / g.weight - charge;
+        g.ns_per_task += (run_ns / (end - begin) - g.ns_per_task) / 8;
+    }
+    task_info_[slot].num_done_work += end - begin;
+    if (task_info_[slot].num_done_work == task_info_[slot].num_total_task) {
+        // lk.lock();
+        #ifdef DEBUG
+        printf("TaskID: %lld Done\n", task_id);
+        #endif
+        completeLaunch(slot);
+    }
+}
+
+/*
+ * Records that every task of the launch in `slot` has finished (or was
+ * skipped), releases its dependents and frees the slot.  Dependents of a
+ * cancelled launch are cancelled too; those that become ready are
+ * completed right here without running, iteratively, so a long cancelled
+ * chain does not recurse.  Called with lk_ held.
+ */
+void TaskSystemParallelThreadPoolSleeping::completeLaunch(int slot) {
+    completing_.push_back(slot);
+    while (!completing_.empty()) {
+        int cur = completing_.back();
+        completing_.pop_back();
+        bool cancelled = task_info_[cur].cancelled;
+        TRACE_INSTANT(TRACE_LAUNCH_FINISH, task_info_[cur].id);
+        // 当前task的所有work都已经被做完了
+        for (int next : graph_[cur]) {
+            if (cancelled) {
+                markCancelled(next);
+            }
+            in_degree_[next]--;
+            if (in_degree_[next] == 0) {
+
+                #ifdef DEBUG
+                printf("TaskID: %lld enqueue\n", task_info_[next].id);
+                #endif
+
+                if (task_info_[next].cancelled) {
+                    completing_.push_back(next);
+                } else {
+                    enqueueReady(next);
+                }
+            }
+        }
+        groups_[task_info_[cur].group].num_undone--;
+        // 没有launch会再依赖它了，slot可以直接回收
+        freeSlot(cur);
+        num_all_undone_task -= 1;
+    }
+
+    if (num_all_undone_task == 0) {
+        cv_main_.notify_all();
+    }
+    // 有线程在wait()/waitAny()中等待某个launch完成
+    if (num_waiters_ > 0) {
+        cv_main_.notify_all();
+    }
+    if (num_nested_waiters_ > 0) {
+        cv_worker_.notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::markCancelled(int slot) {
+    TaskInfo& info = task_info_[slot];
+    if (!info.cancelled) {
+        info.cancelled = true;
+        cancelled_.push_back(info.id);
+        cancelled_set_.insert(info.id);
+    }
+}
+
+/*
+ * Marks the unclaimed tasks of the cancelled launch in `slot` as done.  A
+ * launch that is still waiting for its dependencies is left alone; it is
+ * skipped as a whole once they complete.  Called with lk_ held.
+ */
+void TaskSystemParallelThreadPoolSleeping::skipUnclaimed(int slot) {
+    if (in_degree_[slot] > 0) {
+        return;
+    }
+    TaskInfo& info = task_info_[slot];
+    info.num_done_work += info.num_total_task - info.next_index;
+    info.next_index = info.num_total_task;
+    // 没有正在执行的range时就可以直接完成，否则由最后一个range完成
+    if (info.num_done_work == info.num_total_task) {
+        completeLaunch(slot);
+    }
+}
+
+bool TaskSystemParallelThreadPoolSleeping::cancel(TaskID task_id) {
+    std::unique_lock<std::mutex> lk(lk_);
+    if (!isLive(task_id)) {
+        return false;
+    }
+    markCancelled(slotOf(task_id));
+    skipUnclaimed(slotOf(task_id));
+    return true;
+}
+
+bool TaskSystemParallelThreadPoolSleeping::setDeadline(TaskID task_id,
+                                                       std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lk(lk_);
+    if (!isLive(task_id)) {
+        return false;
+    }
+    task_info_[slotOf(task_id)].deadline = deadline;
+    return true;
+}
+
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
 
 
@@ -289,57 +589,304 @@ void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_tota
     // method in Parts A and B.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
-    runAsyncWithDeps(runnable, num_total_tasks, {});
+    TaskID id = runAsyncWithDeps(runnable, num_total_tasks, {});
+    if (current_pool == this) {
+        waitFor(&id, 1);
+        return;
+    }
     sync();
 }
 
+void TaskSystemParallelThreadPoolSleeping::wait(TaskID task_id) {
+    waitFor(&task_id, 1);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+    return waitFor(task_ids.data(), task_ids.size());
+}
+
+/*
+ * Blocks until one of the launches ids[0..n) is done and returns it.  A
+ * finished launch's slot has been freed, so "done" is simply !isLive().
+ *
+ * When called by a worker (a nested run() or wait() from inside
+ * runTask()), sleeping could leave no thread to run the awaited launch,
+ * so the worker keeps executing ready work, including the awaited
+ * launch's own tasks, and only sleeps when nothing is ready.
+ */
+TaskID TaskSystemParallelThreadPoolSleeping::waitFor(const TaskID* ids, int n) {
+    std::unique_lock<std::mutex> lk(lk_);
+    bool helping = current_pool == this;
+    int& num_waiters = helping ? num_nested_waiters_ : num_waiters_;
+    num_waiters++;
+    while (true) {
+        for (int i = 0; i < n; i++) {
+            if (!isLive(ids[i])) {
+                num_waiters--;
+                return ids[i];
+            }
+        }
+        if (helping) {
+            if (num_ready_ > 0) {
+                runClaimedWork(lk);
+            } else {
+                cv_worker_.wait(lk);
+            }
+        } else {
+            cv_main_.wait(lk);
+        }
+    }
+}
+
 TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                                     const std::vector<TaskID>& deps) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps, 0);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                    const std::vector<TaskID>& deps, int priority) {
+    return submit(runnable, num_total_tasks, deps, priority, 0);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncInGroup(int group, IRunnable* runnable,
+                                                             int num_total_tasks,
+                                                             const std::vector<TaskID>& deps) {
+    return submit(runnable, num_total_tasks, deps, 0, group);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::submit(IRunnable* runnable, int num_total_tasks,
+                                                    const std::vector<TaskID>& deps,
+                                                    int priority, int group) {
 
 
     //
     // TODO: CS149 students will implement this method in Part B.
     //
-    std::lock_guard<std::mutex> lk(lk_);
-    TaskID cur_task_id = global_task_id_++;
+    TRACE_SPAN_BEGIN(lock_start);
+    std::unique_lock<std::mutex> lk(lk_);
+    TRACE_SPAN_END(lock_start, TRACE_LOCK_WAIT, -1, 0, 0);
+    int cur_slot = allocSlot(lk);
+    TaskID cur_task_id = (generation_[cur_slot] << kSlotBits) | cur_slot;
 
     #ifdef DEBUG
-    printf("TaskID: %d Call Async\n", cur_task_id);
+    printf("TaskID: %lld Call Async\n", cur_task_id);
     #endif
+    TRACE_INSTANT(TRACE_LAUNCH_SUBMIT, cur_task_id);
 
-    task_info_.emplace_back(cur_task_id, runnable, num_total_tasks, 0);
-    in_degree_.emplace_back(0);
-    graph_.emplace_back();
+    task_info_[cur_slot] = TaskInfo(cur_task_id, runnable, num_total_tasks, 0);
+    task_info_[cur_slot].priority = priority;
+    if (group < 0 || group >= (int)groups_.size()) {
+        group = 0;
+    }
+    task_info_[cur_slot].group = group;
+    groups_[group].num_undone++;
+    in_degree_[cur_slot] = 0;
 
     #ifdef DEBUG
-    assert(task_info_.size() == global_task_id_);
-    assert(in_degree_.size() == global_task_id_);
-    assert(graph_.size() == global_task_id_);
+    assert(graph_[cur_slot].empty());
     #endif
 
+    bool critical_path = options_.ready_order == READY_CRITICAL_PATH;
+    if (critical_path) {
+        task_info_[cur_slot].path = std::max(1, num_total_tasks);
+    }
+
     for (auto x : deps) {
-        auto& task = task_info_[x];
-        if (task.num_total_task != task.num_done_work) {
-            graph_[x].push_back(cur_task_id);
-            in_degree_[cur_task_id]++;
+        // 已经完成的launch的slot可能已经被回收了，甚至就是刚分配的cur_slot
+        if (slotOf(x) != cur_slot && isLive(x)) {
+            graph_[slotOf(x)].push_back(cur_slot);
+            in_degree_[cur_slot]++;
+            if (critical_path) {
+                preds_[cur_slot].push_back(x);
+                TaskInfo& dep = task_info_[slotOf(x)];
+                propagatePath(slotOf(x), std::max(1, dep.num_total_task) + task_info_[cur_slot].path);
+            }
+        } else if (cancelled_set_.count(x)) {
+            markCancelled(cur_slot);
         }
     }
 
-    if (in_degree_[cur_task_id] == 0) {
+    num_all_undone_task += 1;
+    if (in_degree_[cur_slot] == 0) {
 
         #ifdef DEBUG
-        printf("TaskID: %d, enqueue\n", cur_task_id);
+        printf("TaskID: %lld, enqueue\n", cur_task_id);
         #endif
 
-        tasks_.push({cur_task_id, 0});
-        cv_worker_.notify_all();
+        if (task_info_[cur_slot].cancelled) {
+            completeLaunch(cur_slot);
+        } else {
+            enqueueReady(cur_slot);
+        }
     }
-    num_all_undone_task += 1;
 
     return cur_task_id;
 }
 
+int TaskSystemParallelThreadPoolSleeping::allocSlot(std::unique_lock<std::mutex>& lk) {
+    if (free_slots_.empty() && (int)task_info_.size() == kMaxSlots) {
+        // 在执行的launch太多了，等有launch完成再分配
+        cv_main_.wait(lk, [&]() {
+            return !free_slots_.empty();
+        });
+    }
+
+    if (!free_slots_.empty()) {
+        int slot = free_slots_.front();
+        free_slots_.pop_front();
+        return slot;
+    }
+
+    task_info_.emplace_back(-1, nullptr, 0, 0);
+    in_degree_.emplace_back(0);
+    graph_.emplace_back();
+    preds_.emplace_back();
+    generation_.emplace_back(0);
+    return task_info_.size() - 1;
+}
+
+void TaskSystemParallelThreadPoolSleeping::freeSlot(int slot) {
+    task_info_[slot].id = -1;
+    graph_[slot].clear();
+    preds_[slot].clear();
+    if (generation_[slot] == kMaxGeneration) {
+        // generation用完了，这个slot不再使用，旧的TaskID永远不会重新有效
+        return;
+    }
+    generation_[slot]++;
+    free_slots_.push_back(slot);
+    if ((int)task_info_.size() == kMaxSlots) {
+        cv_main_.notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::enqueueReady(int slot) {
+    TaskInfo& info = task_info_[slot];
+    TRACE_INSTANT(TRACE_LAUNCH_READY, info.id);
+    if (options_.ready_order == READY_CRITICAL_PATH) {
+        refreshPath(slot);
+    }
+    Group& group = groups_[info.group];
+    if (group.ready.empty() && group.pass < vtime_) {
+        // 空闲期间没有用掉的份额不能攒下来，否则重新活跃时会独占worker
+        group.pass = vtime_;
+    }
+    group.ready.push({info.id, info.priority, info.path, next_ready_seq_++});
+    num_ready_++;
+    info.queued = true;
+
+    // 每段range最多需要一个worker，没有任务的launch也要有worker来完成它
+    int remaining = info.num_total_task - info.next_index;
+    int grain = std::max(1, grainSize(options_, remaining, num_threads_));
+    wakeWorkers(std::max(1, (remaining + grain - 1) / grain));
+    if (num_nested_waiters_ > 0) {
+        cv_worker_.notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::popReady(int group) {
+    groups_[group].ready.pop();
+    num_ready_--;
+}
+
+// 有就绪launch的组中pass最小的，调用时num_ready_ > 0
+int TaskSystemParallelThreadPoolSleeping::pickGroup() {
+    if (groups_.size() == 1) {
+        return 0;
+    }
+    int best = -1;
+    for (int i = 0; i < (int)groups_.size(); i++) {
+        if (!groups_[i].ready.empty() && (best < 0 || groups_[i].pass < groups_[best].pass)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int TaskSystemParallelThreadPoolSleeping::createGroup(const char* name, int weight) {
+    std::unique_lock<std::mutex> lk(lk_);
+    groups_.emplace_back(name, std::max(1, weight));
+    groups_.back().pass = vtime_;
+    return groups_.size() - 1;
+}
+
+void TaskSystemParallelThreadPoolSleeping::syncGroup(int group) {
+    std::unique_lock<std::mutex> lk(lk_);
+    if (group < 0 || group >= (int)groups_.size()) {
+        return;
+    }
+    // completeLaunch()在有等待者时会通知cv_main_
+    num_waiters_++;
+    cv_main_.wait(lk, [&]() {
+        return groups_[group].num_undone == 0;
+    });
+    num_waiters_--;
+}
+
+/*
+ * Raises the path of the launch in `slot` to `path` and carries the
+ * increase up through its unfinished dependencies, so a launch's path is
+ * the longest chain of task counts from it down to the newest
+ * submissions.  A launch that is already in a ready queue is queued again
+ * under its new path; runClaimedWork() drops the outdated entry.  At most
+ * kPathBudget launches are updated per call, which bounds submitting a
+ * long chain ahead of its execution to O(kPathBudget) per launch; paths
+ * further up are caught up by refreshPath() when they become ready.
+ */
+void TaskSystemParallelThreadPoolSleeping::propagatePath(int slot, long long path) {
+    raising_.push_back({slot, path});
+    for (int budget = kPathBudget; budget > 0 && !raising_.empty(); --budget) {
+        int cur = raising_.back().first;
+        long long cur_path = raising_.back().second;
+        raising_.pop_back();
+        TaskInfo& info = task_info_[cur];
+        if (cur_path <= info.path) {
+            continue;
+        }
+        info.path = cur_path;
+        if (info.queued && !info.cancelled) {
+            groups_[info.group].ready.push({info.id, info.priority, info.path, next_ready_seq_++});
+            num_ready_++;
+        }
+        for (TaskID pred : preds_[cur]) {
+            if (isLive(pred)) {
+                const TaskInfo& pred_info = task_info_[slotOf(pred)];
+                raising_.push_back({slotOf(pred), std::max(1, pred_info.num_total_task) + cur_path});
+            }
+        }
+    }
+    raising_.clear();
+}
+
+/*
+ * Recomputes the path of the launch in `slot` from its direct dependents
+ * when it becomes ready, for the paths that propagatePath() stopped short
+ * of.
+ */
+void TaskSystemParallelThreadPoolSleeping::refreshPath(int slot) {
+    TaskInfo& info = task_info_[slot];
+    long long cost = std::max(1, info.num_total_task);
+    for (int next : graph_[slot]) {
+        info.path = std::max(info.path, cost + task_info_[next].path);
+    }
+}
+
+bool TaskSystemParallelThreadPoolSleeping::isLive(TaskID id) const {
+    if (id < 0) {
+        return false;
+    }
+    int slot = slotOf(id);
+    return slot < (int)task_info_.size() && task_info_[slot].id == id;
+}
+
 void TaskSystemParallelThreadPoolSleeping::sync() {
+    sync(nullptr);
+}
+
+void TaskSystemParallelThreadPoolSleeping::sync(std::vector<TaskID>* cancelled) {
 
     //
     // TODO: CS149 students will modify the implementation of this method in Part B.
@@ -355,5 +902,938 @@ void TaskSystemParallelThreadPoolSleeping::sync() {
     assert(num_all_undone_task == 0);
     #endif
 
+    if (cancelled != nullptr) {
+        *cancelled = cancelled_;
+    }
+    cancelled_.clear();
+    cancelled_set_.clear();
+    return;
+}
+
+/*
+ * ================================================================
+ * Parallel Work Stealing Task System Implementation
+ * ================================================================
+ */
+
+const char* TaskSystemParallelWorkStealing::name() {
+    return "Parallel + Work Stealing";
+}
+
+TaskSystemParallelWorkStealing::TaskSystemParallelWorkStealing(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
+    options_(options),
+    stop_(false),
+    next_inbox_(0),
+    epoch_(0),
+    num_parked_(0),
+    chunks_(new std::atomic<std::atomic<Launch*>*>[kNumChunks]()),
+    num_slots_(0),
+    free_head_(0),
+    num_in_flight_(0),
+    num_waiters_(0),
+    num_cancelled_(0) {
+    num_threads = std::max(1, num_threads);
+    workers_.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        workers_.push_back(new Worker(2654435761u * (i + 1)));
+    }
+
+    // 绑核后，同一个socket上的worker互为优先窃取的对象
+    std::vector<int> cpus = Topology::instance().placement(options_.placement, num_threads);
+    if (!cpus.empty() && Topology::instance().numSockets() > 1) {
+        for (int i = 0; i < num_threads; ++i) {
+            for (int j = 0; j < num_threads; ++j) {
+                if (j != i && Topology::instance().socketOf(cpus[j]) ==
+                              Topology::instance().socketOf(cpus[i])) {
+                    workers_[i]->neighbors.push_back(j);
+                }
+            }
+        }
+    }
+
+    threads_.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        threads_.emplace_back(&TaskSystemParallelWorkStealing::workerLoop, this, i);
+        if (!cpus.empty()) {
+            pinThread(threads_.back(), cpus[i]);
+        }
+    }
+}
+
+TaskSystemParallelWorkStealing::~TaskSystemParallelWorkStealing() {
+    sync();
+    {
+        std::lock_guard<std::mutex> lk(idle_lk_);
+        stop_ = true;
+        for (auto id : parked_) {
+            workers_[id]->parker.unpark();
+        }
+        parked_.clear();
+        num_parked_ = 0;
+    }
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    for (auto worker : workers_) {
+        for (auto range : worker->free_ranges) {
+            delete range;
+        }
+        delete worker;
+    }
+    for (int slot = 0; slot < num_slots_; ++slot) {
+        delete launchSlot(slot).load();
+    }
+    for (int i = 0; i < kNumChunks; ++i) {
+        delete [] chunks_[i].load();
+    }
+    delete [] chunks_;
+}
+
+void TaskSystemParallelWorkStealing::workerLoop(int id) {
+    current_pool = this;
+    current_worker = id;
+    while (true) {
+        WorkRange* range = findWork(id);
+        if (range == nullptr) {
+            TRACE_SPAN_BEGIN(idle_start);
+            range = waitForWork(id);
+            TRACE_SPAN_END(idle_start, TRACE_IDLE, -1, 0, 0);
+            if (range == nullptr) {
+                return;
+            }
+        }
+        execute(id, range);
+    }
+}
+
+TaskSystemParallelWorkStealing::WorkRange* TaskSystemParallelWorkStealing::waitForWork(int id) {
+    WorkRange* range;
+
+    // 先自旋，再让出CPU，最后睡眠
+    if (options_.idle_mode != IDLE_PARK) {
+        auto start = std::chrono::steady_clock::now();
+        while (!stop_) {
+            range = findWork(id);
+            if (range != nullptr) {
+                return range;
+            }
+            if (options_.idle_mode == IDLE_SPIN) {
+                for (int i = 0; i < 32; ++i) {
+                    cpuRelax();
+                }
+                continue;
+            }
+
+            long elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed_us < options_.spin_us) {
+                for (int i = 0; i < 32; ++i) {
+                    cpuRelax();
+                }
+            } else if (elapsed_us < options_.spin_us + options_.yield_us) {
+                std::this_thread::yield();
+            } else {
+                break;
+            }
+        }
+    }
+
+    Worker* self = workers_[id];
+    while (true) {
+        // 先记下epoch再检查一次，避免在检查和睡眠之间错过新的work
+        unsigned int epoch = epoch_.load();
+        range = scanAllWorkers(id);
+        if (range != nullptr) {
+            return range;
+        }
+
+        {
+            TRACE_SPAN_BEGIN(lock_start);
+            std::lock_guard<std::mutex> lk(idle_lk_);
+            TRACE_SPAN_END(lock_start, TRACE_LOCK_WAIT, -1, 0, 0);
+            if (stop_) {
+                return nullptr;
+            }
+            num_parked_++;
+            if (epoch_.load() != epoch) {
+                num_parked_--;
+                continue;
+            }
+            self->parker.prepare();
+            parked_.push_back(id);
+        }
+        self->parker.park();
+    }
+}
+
+TaskSystemParallelWorkStealing::WorkRange* TaskSystemParallelWorkStealing::findWork(int id) {
+    Worker* self = workers_[id];
+    WorkRange* range = self->deque.take();
+    if (range != nullptr) {
+        return range;
+    }
+    range = drainInbox(id, id);
+    if (range != nullptr) {
+        return range;
+    }
+
+    // 先在同一个socket内随机选择victim，再跨socket
+    int num_neighbors = self->neighbors.size();
+    for (int attempt = 0; attempt < 2 * num_neighbors; ++attempt) {
+        range = stealFrom(id, self->neighbors[nextRandom(self) % num_neighbors]);
+        if (range != nullptr) {
+            return range;
+        }
+    }
+    int num_workers = workers_.size();
+    for (int attempt = 0; attempt < 2 * num_workers; ++attempt) {
+        int victim = nextRandom(self) % num_workers;
+        if (victim == id) {
+            continue;
+        }
+        range = stealFrom(id, victim);
+        if (range != nullptr) {
+            return range;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Like findWork(), but visits every worker once instead of picking
+ * victims at random.  Used before parking: notifyWorkers() wakes only as
+ * many workers as there are new ranges, so a woken worker that missed
+ * the inbox holding its range at random could otherwise park with the
+ * range still queued and every other worker asleep.
+ */
+TaskSystemParallelWorkStealing::WorkRange* TaskSystemParallelWorkStealing::scanAllWorkers(int id) {
+    WorkRange* range = findWork(id);
+    if (range != nullptr) {
+        return range;
+    }
+    int num_workers = workers_.size();
+    for (int i = 1; i < num_workers; ++i) {
+        range = stealFrom(id, (id + i) % num_workers);
+        if (range != nullptr) {
+            return range;
+        }
+    }
+    return nullptr;
+}
+
+unsigned int TaskSystemParallelWorkStealing::nextRandom(Worker* self) {
+    self->rng ^= self->rng << 13;
+    self->rng ^= self->rng >> 17;
+    self->rng ^= self->rng << 5;
+    return self->rng;
+}
+
+TaskSystemParallelWorkStealing::WorkRange* TaskSystemParallelWorkStealing::stealFrom(int id, int victim) {
+    WorkRange* range = workers_[victim]->deque.steal();
+    if (range != nullptr) {
+        return range;
+    }
+    return drainInbox(id, victim);
+}
+
+void TaskSystemParallelWorkStealing::execute(int id, WorkRange* range) {
+    Launch* launch = range->launch;
+    Worker* self = workers_[id];
+
+    if (isCancelled(launch)) {
+        // 不执行，直接当作完成
+        int count = range->end - range->begin;
+        freeRange(id, range);
+        if (launch->num_remaining.fetch_sub(count) == count) {
+            completeLaunch(launch);
+        }
+        return;
+    }
+
+    // 把后一半留给thief，自己继续处理前一半
+    while (range->end - range->begin > launch->grain) {
+        int mid = range->begin + (range->end - range->begin) / 2;
+        self->deque.push(allocRange(id, launch, mid, range->end));
+        range->end = mid;
+        notifyWorkers(1);
+    }
+
+    if (range->begin == 0) {
+        TRACE_INSTANT(TRACE_LAUNCH_START, launch->id.load());
+    }
+    TRACE_SPAN_BEGIN(run_start);
+    launch->runnable->runTasks(range->begin, range->end, launch->num_total_tasks);
+    TRACE_SPAN_END(run_start, TRACE_TASK_RUN, launch->id.load(), range->begin, range->end);
+
+    int count = range->end - range->begin;
+    freeRange(id, range);
+    if (launch->num_remaining.fetch_sub(count) == count) {
+        completeLaunch(launch);
+    }
+}
+
+/*
+ * WorkRanges are recycled through the free list of the worker `id` that
+ * runs them, so splitting and finishing a range does not go through the
+ * allocator.  id is -1 on threads that are not workers of this pool,
+ * which allocate and free normally; each free list is capped so that
+ * ranges created by the submitting thread and freed by workers do not
+ * pile up.
+ */
+TaskSystemParallelWorkStealing::WorkRange* TaskSystemParallelWorkStealing::allocRange(int id, Launch* launch, int begin, int end) {
+    if (id >= 0) {
+        std::vector<WorkRange*>& free_ranges = workers_[id]->free_ranges;
+        if (!free_ranges.empty()) {
+            WorkRange* range = free_ranges.back();
+            free_ranges.pop_back();
+            *range = WorkRange{launch, begin, end, nullptr};
+            return range;
+        }
+    }
+    return new WorkRange{launch, begin, end, nullptr};
+}
+
+void TaskSystemParallelWorkStealing::freeRange(int id, WorkRange* range) {
+    if (id >= 0 && (int)workers_[id]->free_ranges.size() < kMaxFreeRanges) {
+        workers_[id]->free_ranges.push_back(range);
+        return;
+    }
+    delete range;
+}
+
+void TaskSystemParallelWorkStealing::pushInbox(int id, WorkRange* range) {
+    std::atomic<WorkRange*>& inbox = workers_[id]->inbox;
+    range->next = inbox.load(std::memory_order_relaxed);
+    while (!inbox.compare_exchange_weak(range->next, range,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+TaskSystemParallelWorkStealing::WorkRange* TaskSystemParallelWorkStealing::drainInbox(int id, int from) {
+    // 整体交换出来，多个消费者之间不存在ABA问题
+    WorkRange* list = workers_[from]->inbox.exchange(nullptr, std::memory_order_acquire);
+    if (list == nullptr) {
+        return nullptr;
+    }
+    WorkRange* rest = list->next;
+    if (rest != nullptr) {
+        while (rest != nullptr) {
+            WorkRange* next = rest->next;
+            workers_[id]->deque.push(rest);
+            rest = next;
+        }
+        notifyWorkers(1);
+    }
+    return list;
+}
+
+void TaskSystemParallelWorkStealing::notifyWorkers(int count) {
+    epoch_++;
+    if (num_parked_.load() == 0) {
+        return;
+    }
+    // 只唤醒需要的worker，优先唤醒最近睡眠的（cache更热）
+    TRACE_SPAN_BEGIN(lock_start);
+    std::lock_guard<std::mutex> lk(idle_lk_);
+    TRACE_SPAN_END(lock_start, TRACE_LOCK_WAIT, -1, 0, 0);
+    while (count-- > 0 && !parked_.empty()) {
+        int id = parked_.back();
+        parked_.pop_back();
+        num_parked_--;
+        workers_[id]->parker.unpark();
+    }
+}
+
+void TaskSystemParallelWorkStealing::schedule(Launch* launch) {
+    TRACE_INSTANT(TRACE_LAUNCH_READY, launch->id.load());
+    int num_total_tasks = launch->num_total_tasks;
+    if (num_total_tasks <= 0 || isCancelled(launch)) {
+        completeLaunch(launch);
+        return;
+    }
+
+    // 把launch一次性切分给所有的worker
+    int num_workers = workers_.size();
+    int pieces = std::min(num_workers, num_total_tasks);
+    // guided模式下叶子range约为每个worker四份，single模式下切到单个任务
+    launch->grain = grainSize(options_, num_total_tasks, 2 * num_workers);
+    unsigned int start = next_inbox_++;
+    int self = current_pool == this ? current_worker : -1;
+    for (int i = 0; i < pieces; ++i) {
+        int begin = (long long)num_total_tasks * i / pieces;
+        int end = (long long)num_total_tasks * (i + 1) / pieces;
+        pushInbox((start + i) % num_workers, allocRange(self, launch, begin, end));
+    }
+    notifyWorkers(pieces);
+}
+
+std::atomic<TaskSystemParallelWorkStealing::Launch*>& TaskSystemParallelWorkStealing::launchSlot(int slot) {
+    std::atomic<std::atomic<Launch*>*>& chunk = chunks_[slot >> kChunkBits];
+    std::atomic<Launch*>* slots = chunk.load(std::memory_order_acquire);
+    if (slots == nullptr) {
+        // 多个提交者可能同时分配同一个chunk，CAS失败的一方释放自己的
+        std::atomic<Launch*>* fresh = new std::atomic<Launch*>[1 << kChunkBits]();
+        if (chunk.compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+            slots = fresh;
+        } else {
+            delete [] fresh;
+        }
+    }
+    return slots[slot & ((1 << kChunkBits) - 1)];
+}
+
+/*
+ * Takes a free launch record, or a new one if none is free, and stores
+ * the TaskID it will carry in *id.  The caller owns the record (its
+ * reference count is 0) until it stores that TaskID and raises the count.
+ */
+TaskSystemParallelWorkStealing::Launch* TaskSystemParallelWorkStealing::allocLaunch(TaskID* id) {
+    while (true) {
+        unsigned long long head = free_head_.load(std::memory_order_acquire);
+        while ((head & 0xffffffffu) != 0) {
+            Launch* launch = launchSlot((int)(head & 0xffffffffu) - 1).load(std::memory_order_acquire);
+            // next_free可能已经被复用了这个slot的线程改掉，这时版本号也变了，CAS会失败
+            unsigned long long next = (((head >> 32) + 1) << 32) |
+                                      (unsigned int)(launch->next_free.load() + 1);
+            if (free_head_.compare_exchange_weak(head, next, std::memory_order_acq_rel)) {
+                *id = launch->id.load() + (1LL << kSlotBits);
+                return launch;
+            }
+        }
+
+        int slot = num_slots_.load();
+        if (slot >= kMaxSlots) {
+            // 在执行的launch太多了，等有launch完成再分配
+            std::this_thread::yield();
+            continue;
+        }
+        if (num_slots_.compare_exchange_weak(slot, slot + 1)) {
+            Launch* launch = new Launch();
+            launchSlot(slot).store(launch, std::memory_order_release);
+            *id = slot;
+            return launch;
+        }
+    }
+}
+
+/*
+ * Returns the record of launch `id` with a reference held, or nullptr if
+ * its record has already been recycled (so the launch is complete) or
+ * `id` was never returned by runAsyncWithDeps().
+ */
+TaskSystemParallelWorkStealing::Launch* TaskSystemParallelWorkStealing::pinLaunch(TaskID id) {
+    if (id < 0 || slotOf(id) >= num_slots_.load()) {
+        return nullptr;
+    }
+    Launch* launch = launchSlot(slotOf(id)).load(std::memory_order_acquire);
+    if (launch == nullptr) {
+        return nullptr;
+    }
+    int refs = launch->refs.load();
+    do {
+        if (refs == 0) {
+            return nullptr;
+        }
+    } while (!launch->refs.compare_exchange_weak(refs, refs + 1));
+    // 持有引用之后记录不会被回收，再确认它还是要找的launch
+    if (launch->id.load() != id) {
+        releaseLaunch(launch);
+        return nullptr;
+    }
+    return launch;
+}
+
+void TaskSystemParallelWorkStealing::releaseLaunch(Launch* launch) {
+    if (launch->refs.fetch_sub(1) != 1) {
+        return;
+    }
+    TaskID id = launch->id.load();
+    if ((id >> kSlotBits) == kMaxGeneration) {
+        // generation用完了，这个slot不再使用，旧的TaskID永远不会重新有效
+        return;
+    }
+    unsigned long long slot_tag = slotOf(id) + 1;
+    unsigned long long head = free_head_.load(std::memory_order_relaxed);
+    do {
+        launch->next_free.store((int)(head & 0xffffffffu) - 1);
+    } while (!free_head_.compare_exchange_weak(head, (((head >> 32) + 1) << 32) | slot_tag,
+                                               std::memory_order_acq_rel));
+}
+
+bool TaskSystemParallelWorkStealing::addSuccessor(Launch* dep, Launch* launch) {
+    SuccNode* head = dep->successors.load(std::memory_order_acquire);
+    if (head == &closed_) {
+        return false;
+    }
+    SuccNode* node = new SuccNode{launch, head};
+    while (!dep->successors.compare_exchange_weak(node->next, node,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_acquire)) {
+        if (node->next == &closed_) {
+            delete node;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Closes the successor list of a finished launch and releases its
+ * successors.  Successors of a cancelled launch are cancelled too, and
+ * successors that become ready while cancelled (or with no tasks) are
+ * completed by this loop instead of being scheduled, so a long cancelled
+ * chain does not recurse.
+ */
+void TaskSystemParallelWorkStealing::completeLaunch(Launch* launch) {
+    launch->next_done = nullptr;
+    while (launch != nullptr) {
+        Launch* next_done = launch->next_done;
+        TRACE_INSTANT(TRACE_LAUNCH_FINISH, launch->id.load());
+        bool cancelled = launch->cancelled.load();
+        // 关闭后继链表，之后提交的launch会看到这个依赖已经完成
+        SuccNode* list = launch->successors.exchange(&closed_);
+
+        // 链表是按提交顺序倒序的，先反转，让先提交的后继先就绪
+        SuccNode* reversed = nullptr;
+        while (list != nullptr) {
+            SuccNode* next = list->next;
+            list->next = reversed;
+            reversed = list;
+            list = next;
+        }
+        while (reversed != nullptr) {
+            SuccNode* next = reversed->next;
+            Launch* x = reversed->launch;
+            delete reversed;
+            if (cancelled) {
+                markCancelled(x);
+            }
+            if (x->num_deps.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (x->num_total_tasks <= 0 || isCancelled(x)) {
+                    x->next_done = next_done;
+                    next_done = x;
+                } else {
+                    schedule(x);
+                }
+            }
+            reversed = next;
+        }
+
+        // 放掉完成时持有的引用之后，记录随时可能被复用，不再访问它
+        releaseLaunch(launch);
+
+        // 和waitFor()中对num_waiters_的递增构成Dekker式的配对，不会丢失唤醒
+        bool idle = num_in_flight_.fetch_sub(1) == 1;
+        if (idle || num_waiters_.load() > 0) {
+            std::lock_guard<std::mutex> lk(main_lk_);
+            cv_main_.notify_all();
+        }
+        launch = next_done;
+    }
+}
+
+/*
+ * Whether the ranges of `launch` should be skipped.  An expired deadline
+ * cancels the launch here, so it is noticed the next time a worker picks
+ * up one of its ranges.
+ */
+bool TaskSystemParallelWorkStealing::isCancelled(Launch* launch) {
+    if (launch->cancelled.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    long long deadline = launch->deadline_ns.load(std::memory_order_relaxed);
+    if (deadline != kNoDeadline &&
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() >= deadline) {
+        markCancelled(launch);
+        return true;
+    }
+    return false;
+}
+
+void TaskSystemParallelWorkStealing::markCancelled(Launch* launch) {
+    if (!launch->cancelled.exchange(true)) {
+        std::lock_guard<std::mutex> lk(cancel_lk_);
+        cancelled_.push_back(launch->id.load());
+        cancelled_set_.insert(launch->id.load());
+        num_cancelled_++;
+    }
+}
+
+bool TaskSystemParallelWorkStealing::cancel(TaskID task_id) {
+    Launch* launch = pinLaunch(task_id);
+    if (launch == nullptr) {
+        return false;
+    }
+    bool pending = launch->successors.load() != &closed_;
+    if (pending) {
+        // 还在等依赖的launch在schedule()时被跳过，已经分发的range在execute()时被跳过
+        markCancelled(launch);
+    }
+    releaseLaunch(launch);
+    return pending;
+}
+
+bool TaskSystemParallelWorkStealing::setDeadline(TaskID task_id,
+                                                 std::chrono::steady_clock::time_point deadline) {
+    Launch* launch = pinLaunch(task_id);
+    if (launch == nullptr) {
+        return false;
+    }
+    bool pending = launch->successors.load() != &closed_;
+    if (pending) {
+        launch->deadline_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline.time_since_epoch()).count());
+    }
+    releaseLaunch(launch);
+    return pending;
+}
+
+void TaskSystemParallelWorkStealing::run(IRunnable* runnable, int num_total_tasks) {
+    TaskID id = runAsyncWithDeps(runnable, num_total_tasks, {});
+    if (current_pool == this) {
+        waitFor(&id, 1);
+        return;
+    }
+    sync();
+}
+
+void TaskSystemParallelWorkStealing::wait(TaskID task_id) {
+    waitFor(&task_id, 1);
+}
+
+TaskID TaskSystemParallelWorkStealing::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+    return waitFor(task_ids.data(), task_ids.size());
+}
+
+bool TaskSystemParallelWorkStealing::isDone(TaskID id) {
+    Launch* launch = pinLaunch(id);
+    if (launch == nullptr) {
+        return true;
+    }
+    bool done = launch->successors.load() == &closed_;
+    releaseLaunch(launch);
+    return done;
+}
+
+/*
+ * Blocks until one of the launches ids[0..n) is done and returns it.
+ *
+ * A worker (nested run() or wait() from inside runTask()) waits
+ * help-first: it keeps taking and stealing work, which includes the
+ * ranges of the awaited launch, instead of blocking.  Other threads sleep
+ * on cv_main_; completeLaunch() notifies it while num_waiters_ > 0.
+ */
+TaskID TaskSystemParallelWorkStealing::waitFor(const TaskID* ids, int n) {
+    auto find_done = [&]() {
+        for (int i = 0; i < n; i++) {
+            if (isDone(ids[i])) {
+                return i;
+            }
+        }
+        return -1;
+    };
+
+    int done;
+    if (current_pool == this) {
+        int idle_rounds = 0;
+        while ((done = find_done()) < 0) {
+            WorkRange* range = findWork(current_worker);
+            if (range != nullptr) {
+                execute(current_worker, range);
+                idle_rounds = 0;
+            } else if (++idle_rounds < 64) {
+                cpuRelax();
+            } else {
+                // 剩下的range都在其他worker手里，不需要一直占着CPU
+                std::this_thread::yield();
+            }
+        }
+        return ids[done];
+    }
+
+    num_waiters_++;
+    {
+        std::unique_lock<std::mutex> lk(main_lk_);
+        cv_main_.wait(lk, [&]() {
+            return (done = find_done()) >= 0;
+        });
+    }
+    num_waiters_--;
+    return ids[done];
+}
+
+TaskID TaskSystemParallelWorkStealing::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                        const std::vector<TaskID>& deps) {
+    TaskID cur_task_id;
+    Launch* launch = allocLaunch(&cur_task_id);
+    launch->runnable = runnable;
+    launch->num_total_tasks = num_total_tasks;
+    launch->grain = 1;
+    launch->num_remaining.store(num_total_tasks, std::memory_order_relaxed);
+    launch->num_deps.store(1, std::memory_order_relaxed);
+    launch->successors.store(nullptr, std::memory_order_relaxed);
+    launch->cancelled.store(false, std::memory_order_relaxed);
+    launch->deadline_ns.store(kNoDeadline, std::memory_order_relaxed);
+    launch->next_done = nullptr;
+    launch->id.store(cur_task_id);
+    // 完成之前持有的引用；设置之后其他线程才能通过pinLaunch()拿到这个记录
+    launch->refs.store(1);
+    num_in_flight_++;
+    TRACE_INSTANT(TRACE_LAUNCH_SUBMIT, cur_task_id);
+
+    for (auto x : deps) {
+        Launch* dep = pinLaunch(x);
+        if (dep == nullptr) {
+            // 记录已经被回收，dep早就完成了；它被取消的话，在sync()报告之前都记得
+            if (num_cancelled_.load() > 0) {
+                std::lock_guard<std::mutex> lk(cancel_lk_);
+                if (cancelled_set_.count(x)) {
+                    markCancelled(launch);
+                }
+            }
+            continue;
+        }
+        // 先加计数再挂到链表上，否则dep可能在这之间完成并把计数减到负数
+        launch->num_deps.fetch_add(1, std::memory_order_relaxed);
+        if (!addSuccessor(dep, launch)) {
+            launch->num_deps.fetch_sub(1, std::memory_order_relaxed);
+            if (dep->cancelled.load()) {
+                markCancelled(launch);
+            }
+        }
+        releaseLaunch(dep);
+    }
+
+    // 释放提交时持有的那一个计数
+    if (launch->num_deps.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        schedule(launch);
+    }
+    return cur_task_id;
+}
+
+void TaskSystemParallelWorkStealing::sync() {
+    sync(nullptr);
+}
+
+void TaskSystemParallelWorkStealing::sync(std::vector<TaskID>* cancelled) {
+    std::unique_lock<std::mutex> lk(main_lk_);
+    cv_main_.wait(lk, [&]() {
+        return num_in_flight_.load() == 0;
+    });
+    lk.unlock();
+
+    std::lock_guard<std::mutex> cancel_lk(cancel_lk_);
+    if (cancelled != nullptr) {
+        *cancelled = cancelled_;
+    }
+    cancelled_.clear();
+    cancelled_set_.clear();
+    num_cancelled_ = 0;
+}
+
+/*
+ * ================================================================
+ * Parallel Persistent Pool Task System Implementation
+ * ================================================================
+ */
+
+const char* TaskSystemParallelPersistent::name() {
+    return "Parallel + Persistent Pool";
+}
+
+TaskSystemParallelPersistent::TaskSystemParallelPersistent(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads),
+    num_threads_(std::max(1, num_threads)),
+    options_(options),
+    next_desc_(0),
+    parkers_(num_threads_),
+    stop_(false),
+    epoch_(0),
+    num_parked_(0) {
+    parked_.reserve(num_threads_);
+    threads_.reserve(num_threads_);
+    for (int i = 0; i < num_threads_; ++i) {
+        threads_.emplace_back(&TaskSystemParallelPersistent::workerLoop, this, i);
+    }
+    placeThreads(threads_, options_);
+}
+
+TaskSystemParallelPersistent::~TaskSystemParallelPersistent() {
+    {
+        std::lock_guard<std::mutex> lk(idle_lk_);
+        stop_ = true;
+        for (auto id : parked_) {
+            parkers_[id].unpark();
+        }
+        parked_.clear();
+        num_parked_ = 0;
+    }
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+/*
+ * Claims and runs ranges of `desc` until none are left.  num_active is
+ * raised before re-checking `published`, so the owner of the descriptor
+ * (which clears `published` and then waits for num_active to drop to 0)
+ * never recycles it under a worker that is still reading it.
+ */
+bool TaskSystemParallelPersistent::runSome(LaunchDesc& desc) {
+    if (!desc.published.load(std::memory_order_acquire)) {
+        return false;
+    }
+    desc.num_active.fetch_add(1);
+    bool ran = false;
+    if (desc.published.load()) {
+        int begin, end;
+        while (claimTasks(desc.next_task, desc.num_total_tasks, num_threads_, options_, &begin, &end)) {
+            desc.runnable->runTasks(begin, end, desc.num_total_tasks);
+            desc.num_done.fetch_add(end - begin, std::memory_order_release);
+            ran = true;
+        }
+    }
+    desc.num_active.fetch_sub(1);
+    return ran;
+}
+
+bool TaskSystemParallelPersistent::runAny() {
+    bool ran = false;
+    for (int i = 0; i < kRingSize; ++i) {
+        ran |= runSome(ring_[i]);
+    }
+    return ran;
+}
+
+void TaskSystemParallelPersistent::notifyWorkers() {
+    epoch_++;
+    if (num_parked_.load() == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lk(idle_lk_);
+    for (auto id : parked_) {
+        parkers_[id].unpark();
+    }
+    parked_.clear();
+    num_parked_ = 0;
+}
+
+void TaskSystemParallelPersistent::workerLoop(int id) {
+    current_pool = this;
+    current_worker = id;
+    auto idle_start = std::chrono::steady_clock::now();
+    while (!stop_) {
+        // 先记下epoch再扫描，扫描之后发布的launch一定会改变epoch
+        unsigned int epoch = epoch_.load();
+        if (runAny()) {
+            idle_start = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        long idle_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - idle_start).count();
+        if (options_.idle_mode == IDLE_SPIN ||
+            (options_.idle_mode == IDLE_HYBRID && idle_us < options_.spin_us)) {
+            for (int i = 0; i < 32; ++i) {
+                cpuRelax();
+            }
+            continue;
+        }
+        if (options_.idle_mode == IDLE_HYBRID && idle_us < options_.spin_us + options_.yield_us) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(idle_lk_);
+            if (stop_) {
+                return;
+            }
+            num_parked_++;
+            if (epoch_.load() != epoch) {
+                num_parked_--;
+                continue;
+            }
+            parkers_[id].prepare();
+            parked_.push_back(id);
+        }
+        parkers_[id].park();
+        idle_start = std::chrono::steady_clock::now();
+    }
+}
+
+void TaskSystemParallelPersistent::run(IRunnable* runnable, int num_total_tasks) {
+    if (num_total_tasks <= 0) {
+        return;
+    }
+
+    // 调用run()的线程也会执行任务，它在任务里再调用run()同样是嵌套的
+    bool nested = current_pool == this;
+
+    // 找一个空闲的descriptor，同时在执行的launch超过kRingSize个时等待
+    unsigned int start = next_desc_++;
+    LaunchDesc* desc = nullptr;
+    while (desc == nullptr) {
+        for (int i = 0; i < kRingSize; ++i) {
+            LaunchDesc& d = ring_[(start + i) % kRingSize];
+            bool expected = false;
+            if (!d.busy.load(std::memory_order_relaxed) &&
+                d.busy.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                desc = &d;
+                break;
+            }
+        }
+        if (desc == nullptr) {
+            if (nested) {
+                // 嵌套的run()：descriptor可能全被等待子launch的外层run()占着，
+                // 等下去会死锁，直接在当前线程上执行
+                runnable->runTasks(0, num_total_tasks, num_total_tasks);
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    desc->runnable = runnable;
+    desc->num_total_tasks = num_total_tasks;
+    desc->next_task.store(0, std::memory_order_relaxed);
+    desc->num_done.store(0, std::memory_order_relaxed);
+    desc->published.store(true, std::memory_order_release);
+    notifyWorkers();
+
+    // 调用者也参与执行，然后等其他worker手里的range完成
+    ITaskSystem* caller_pool = current_pool;
+    current_pool = this;
+    runSome(*desc);
+    int spins = 0;
+    while (desc->num_done.load(std::memory_order_acquire) != num_total_tasks) {
+        if (nested) {
+            // 嵌套的run()：等待期间继续执行其他launch的任务
+            runAny();
+        } else if (++spins < 1024) {
+            cpuRelax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    desc->published.store(false);
+    while (desc->num_active.load() != 0) {
+        cpuRelax();
+    }
+    desc->busy.store(false, std::memory_order_release);
+    current_pool = caller_pool;
+}
+
+TaskID TaskSystemParallelPersistent::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                      const std::vector<TaskID>& deps) {
+    run(runnable, num_total_tasks);
+    return 0;
+}
+
+void TaskSystemParallelPersistent::sync() {
     return;
 }
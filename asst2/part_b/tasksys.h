@@ -2,13 +2,31 @@
 #define _TASKSYS_H
 
 #include "itasksys.h"
+#include "tasksys_options.h"
+#include "topology.h"
+#include "wsdeque.h"
+#include "idle.h"
+#include "trace.h"
 #include <atomic>
 #include <queue>
+#include <deque>
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <chrono>
+
+// Lets ../tests/main.cpp register the task systems that only exist in part_b.
+#define TASKSYS_HAS_WORK_STEALING
+// TaskSystemParallelThreadPoolSleeping honors priorities and ready_order.
+#define TASKSYS_HAS_PRIORITIES
+// run() may be called from inside runTask() on the same task system.
+#define TASKSYS_HAS_NESTED_LAUNCHES
+// TaskSystemParallelThreadPoolSleeping shares workers fairly between groups.
+#define TASKSYS_HAS_GROUPS
 
 /*
  * TaskSystemSerial: This class is the student's implementation of a
@@ -24,6 +42,7 @@ class TaskSystemSerial: public ITaskSystem {
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        int numThreads();
 };
 
 /*
@@ -34,7 +53,8 @@ class TaskSystemSerial: public ITaskSystem {
  */
 class TaskSystemParallelSpawn: public ITaskSystem {
     public:
-        TaskSystemParallelSpawn(int num_threads);
+        TaskSystemParallelSpawn(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelSpawn();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -43,6 +63,7 @@ class TaskSystemParallelSpawn: public ITaskSystem {
         void sync();
 private:
     int num_thread_;
+    TaskSystemOptions options_;
     std::atomic<int> task_idx_;
 };
 
@@ -54,7 +75,8 @@ private:
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -76,55 +98,378 @@ private:
  * optimized implementation of a parallel task execution engine that uses
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * Idle workers follow options.idle_mode.  A parked worker sleeps on its
+ * own Parker, and a newly ready launch unparks only as many workers as it
+ * has ranges to hand out.
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps, int priority);
         void sync();
+        void wait(TaskID task_id);
+        TaskID waitAny(const std::vector<TaskID>& task_ids);
+        bool cancel(TaskID task_id);
+        bool setDeadline(TaskID task_id, std::chrono::steady_clock::time_point deadline);
+        void sync(std::vector<TaskID>* cancelled);
+        int createGroup(const char* name, int weight);
+        TaskID runAsyncInGroup(int group, IRunnable* runnable, int num_total_tasks,
+                               const std::vector<TaskID>& deps);
+        void syncGroup(int group);
 private:
 
     struct TaskInfo {
-        TaskID id; // task的ID
+        TaskID id; // task的ID，slot空闲时为-1
         IRunnable* runnable;
         int num_total_task; // 所有的任务数
         int num_done_work; // 当前task已经完成的任务
+        int next_index; // 下一个要领取的任务
+        int priority; // runAsyncWithDeps()传入的优先级
+        long long path; // 估计的下游关键路径长度（任务数），只在READY_CRITICAL_PATH下维护
+        bool cancelled; // 被取消后不再领取新的任务，后继也全部跳过
+        bool queued; // 在就绪队列中且还有任务没被领取
+        std::chrono::steady_clock::time_point deadline; // 没有deadline时为max()
+        int group; // 所属的调度组
         TaskInfo(TaskID _id, IRunnable* _runnable, int _num_total_task, int _num_donw_work):
-            id(_id), runnable(_runnable), num_total_task(_num_total_task), num_done_work(_num_donw_work) {}
+            id(_id), runnable(_runnable), num_total_task(_num_total_task), num_done_work(_num_donw_work),
+            next_index(0), priority(0), path(0), cancelled(false), queued(false),
+            deadline(std::chrono::steady_clock::time_point::max()), group(0) {}
         // std::atomic<int> num_done_work; // 当前task已经完成的任务
         // TaskInfo(TaskID _id, IRunnable* _runnable, int _num_total_task):
         //     id(_id), runnable(_runnable), num_total_task(_num_total_task){}
     };
 
 
+    // 就绪队列中的launch，按 (priority, path) 从大到小、ready_seq 从小到大出队
     struct WorkInfo {
         TaskID id; // work所属的task
-        int cur_index;
+        int priority;
+        // 入队时的关键路径估计；path之后变大时会用新值再入队一次，旧的项出队时丢弃
+        long long path;
+        long long ready_seq; // 入队顺序
+        bool operator<(const WorkInfo& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            if (path != other.path) return path < other.path;
+            return ready_seq > other.ready_seq;
+        }
     };
 
-    bool stop_;
+    /*
+     * A scheduling group has its own ready queue.  Workers are shared
+     * between groups by stride scheduling: each group's pass is the
+     * worker time it has used divided by its weight, and the next range
+     * is claimed from the ready group with the smallest pass.  A claim is
+     * charged up front with the group's recent time per task, so workers
+     * that claim at the same moment spread across groups, and corrected
+     * with the measured time once the range has run.
+     */
+    struct Group {
+        std::string name;
+        int weight;
+        double pass; // 已经用掉的worker时间(ns) / weight
+        double ns_per_task; // 最近的平均任务耗时，用来预先计费
+        std::priority_queue<WorkInfo> ready; // 这个组的就绪launch
+        int num_undone; // 还没有完成的launch数
+        Group(const std::string& _name, int _weight):
+            name(_name), weight(_weight), pass(0), ns_per_task(1000), num_undone(0) {}
+    };
+
+    /*
+     * Launch records live in recycled slots.  A TaskID packs the slot index
+     * (low kSlotBits bits) with the slot's generation, which is bumped every
+     * time the slot is freed.  A slot is freed as soon as its launch
+     * completes: nothing can depend on a finished launch, and a later
+     * runAsyncWithDeps() that names the old TaskID sees a generation
+     * mismatch and treats the dependency as satisfied.  Memory is therefore
+     * proportional to the number of launches in flight.  A generation is
+     * never reused: a slot whose generation reaches kMaxGeneration is
+     * retired instead of freed, so a stale TaskID can never name a later
+     * launch.
+     */
+    static constexpr int kSlotBits = 20;
+    static constexpr int kMaxSlots = 1 << kSlotBits;
+    static constexpr long long kMaxGeneration = (1LL << (63 - kSlotBits)) - 1;
+    static int slotOf(TaskID id) { return (int)(id & (kMaxSlots - 1)); }
+    int allocSlot(std::unique_lock<std::mutex>& lk);
+    void freeSlot(int slot);
+    bool isLive(TaskID id) const;
+    void enqueueReady(int slot);
+    void idleWait(int id, std::unique_lock<std::mutex>& lk);
+    void wakeWorkers(int count);
+    void runClaimedWork(std::unique_lock<std::mutex>& lk);
+    TaskID waitFor(const TaskID* ids, int n);
+    void propagatePath(int slot, long long path);
+    void refreshPath(int slot);
+    void completeLaunch(int slot);
+    void markCancelled(int slot);
+    void skipUnclaimed(int slot);
+    int pickGroup();
+    void popReady(int group);
+    TaskID submit(IRunnable* runnable, int num_total_tasks, const std::vector<TaskID>& deps,
+                  int priority, int group);
+
+    std::atomic<bool> stop_;
+    int num_threads_;
+    TaskSystemOptions options_;
 
-    TaskID global_task_id_;
     std::mutex lk_;
-    std::condition_variable cv_worker_; // worker线程等待的队列
+    std::condition_variable cv_worker_; // 在waitFor()中边执行边等待的worker等待的队列
     std::condition_variable cv_main_; // sync线程等待的队列
 
     // 所有加入，但是还没有完成的task的总数，包括不满足条件的
     int num_all_undone_task;
+    int num_waiters_; // 在waitFor()中等待的非worker线程数
+    int num_nested_waiters_; // 在waitFor()中边执行任务边等待的worker数
 
     std::vector<std::thread> threads_; // 所有的worker线程
-    std::vector<std::vector<int>> graph_;
+    // 以下按slot下标索引
+    std::vector<std::vector<int>> graph_; // 依赖这个launch的launch的slot
+    // 这个launch依赖的launch，只在READY_CRITICAL_PATH下维护；slot会被复用，所以存TaskID
+    std::vector<std::vector<TaskID>> preds_;
     // std::unordered_map<TaskID, std::vector<int>> graph_; // 维护当前图
     std::vector<int> in_degree_;
     // std::unordered_map<TaskID, int> in_degree_; // 每个task的入度
-    std::queue<WorkInfo> tasks_; //  所有需要被执行的任务
+    std::vector<Group> groups_; // groups_[0]是默认组
+    // 所有组的就绪队列中的项数，只在持有lk_时修改，自旋的worker不加锁读
+    std::atomic<int> num_ready_;
+    std::vector<Parker> parkers_; // 每个worker一个
+    std::vector<int> parked_; // 正在睡眠的worker，由lk_保护
+    double vtime_; // 最近一次领取任务的组的pass，重新变为活跃的组从这里开始计
+    long long next_ready_seq_;
     std::vector<TaskInfo> task_info_;
     // std::unordered_map<TaskID, TaskInfo> task_info_; // 每个任务的信息
+    std::vector<long long> generation_; // 每个slot下一次分配时使用的generation
+    std::deque<int> free_slots_; // FIFO复用，让同一个slot的generation尽量晚回绕
+    std::vector<int> completing_; // completeLaunch()中待完成的slot，复用避免分配
+    std::vector<std::pair<int, long long>> raising_; // propagatePath()中待更新的(slot, path)
+    // 每次提交最多沿依赖向上更新这么多个launch的path
+    static constexpr int kPathBudget = 256;
+    // 上一次sync()之后被取消的launch，sync()时报告并清空
+    std::vector<TaskID> cancelled_;
+    std::unordered_set<TaskID> cancelled_set_;
     static constexpr int N = 1024;
 };
 
+/*
+ * TaskSystemParallelWorkStealing: a thread pool where every worker owns a
+ * Chase-Lev deque of task ranges.  A ready bulk launch is split across the
+ * workers once; after that, workers recursively split their own ranges and
+ * idle workers steal from random victims, so no global lock is taken per
+ * task.  See definition of ITaskSystem in itasksys.h for documentation of
+ * the ITaskSystem interface.
+ */
+class TaskSystemParallelWorkStealing: public ITaskSystem {
+    public:
+        TaskSystemParallelWorkStealing(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
+        ~TaskSystemParallelWorkStealing();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+        void wait(TaskID task_id);
+        TaskID waitAny(const std::vector<TaskID>& task_ids);
+        bool cancel(TaskID task_id);
+        bool setDeadline(TaskID task_id, std::chrono::steady_clock::time_point deadline);
+        void sync(std::vector<TaskID>* cancelled);
+private:
+
+    struct Launch;
+
+    // 后继链表的节点
+    struct SuccNode {
+        Launch* launch;
+        SuccNode* next;
+    };
+
+    /*
+     * Launch records live in recycled slots, as in the sleeping pool: a
+     * TaskID packs the slot index (low kSlotBits bits) with a generation
+     * that grows every time the slot is reused, and a slot whose
+     * generation reaches kMaxGeneration is retired.  A record is freed
+     * once its launch has completed and no thread still holds it: the
+     * completion holds one reference, and so does every thread that
+     * looked the record up by TaskID (pinLaunch()).  The reference count
+     * can only be raised while it is nonzero, so the thread that drops
+     * it to zero owns the record until it is reused.  Records are never
+     * deallocated before the task system is destroyed, so a stale
+     * pointer always points at some Launch.
+     */
+    struct Launch {
+        // 占用这个slot的launch，slot空闲时是上一个launch的ID
+        std::atomic<TaskID> id;
+        std::atomic<int> refs;
+        std::atomic<int> next_free; // 空闲链表中的下一个slot
+        IRunnable* runnable;
+        int num_total_tasks;
+        int grain; // range小于等于grain时不再切分
+        std::atomic<int> num_remaining; // 还没有执行完的任务数
+        // 还没有完成的依赖数，加上提交时持有的1，减到0时launch就绪
+        std::atomic<int> num_deps;
+        // 无锁的后继链表，launch完成后被换成closed_，之后不能再加入后继
+        std::atomic<SuccNode*> successors;
+        std::atomic<bool> cancelled; // 被取消后剩下的range都直接跳过
+        std::atomic<long long> deadline_ns; // steady_clock时间，没有deadline时为kNoDeadline
+        Launch* next_done; // completeLaunch()中待完成的launch链表
+        Launch(): id(-1), refs(0), next_free(-1), runnable(nullptr), num_total_tasks(0),
+            grain(1), num_remaining(0), num_deps(0), successors(nullptr),
+            cancelled(false), deadline_ns(kNoDeadline), next_done(nullptr) {}
+    };
+
+    // 一段连续的任务 [begin, end)
+    struct WorkRange {
+        Launch* launch;
+        int begin;
+        int end;
+        WorkRange* next; // inbox链表
+    };
+
+    struct Worker {
+        WorkStealingDeque<WorkRange*> deque;
+        // 其他线程不能push到deque中，所以新就绪的launch先放到inbox里
+        std::atomic<WorkRange*> inbox;
+        unsigned int rng;
+        Parker parker;
+        std::vector<int> neighbors; // 同一个socket上的其他worker，不绑核时为空
+        // 用完的WorkRange，只有这个worker自己访问，切分时直接复用
+        std::vector<WorkRange*> free_ranges;
+        char pad[64];
+        Worker(unsigned int seed): inbox(nullptr), rng(seed) {}
+    };
+
+    static constexpr long long kNoDeadline = (long long)((~0ull) >> 1);
+    static constexpr int kMaxFreeRanges = 256; // 每个worker最多缓存的WorkRange
+    static constexpr int kSlotBits = 24;
+    static constexpr int kMaxSlots = 1 << kSlotBits;
+    static constexpr long long kMaxGeneration = (1LL << (63 - kSlotBits)) - 1;
+    static int slotOf(TaskID id) { return (int)(id & (kMaxSlots - 1)); }
+
+    void workerLoop(int id);
+    WorkRange* findWork(int id);
+    WorkRange* stealFrom(int id, int victim);
+    WorkRange* scanAllWorkers(int id);
+    unsigned int nextRandom(Worker* self);
+    WorkRange* waitForWork(int id);
+    void execute(int id, WorkRange* range);
+    void schedule(Launch* launch);
+    void completeLaunch(Launch* launch);
+    bool isDone(TaskID id);
+    TaskID waitFor(const TaskID* ids, int n);
+    WorkRange* allocRange(int id, Launch* launch, int begin, int end);
+    void freeRange(int id, WorkRange* range);
+    void pushInbox(int id, WorkRange* range);
+    WorkRange* drainInbox(int id, int from);
+    void notifyWorkers(int count);
+    std::atomic<Launch*>& launchSlot(int slot);
+    Launch* allocLaunch(TaskID* id);
+    Launch* pinLaunch(TaskID id);
+    void releaseLaunch(Launch* launch);
+    bool addSuccessor(Launch* dep, Launch* launch);
+    bool isCancelled(Launch* launch);
+    void markCancelled(Launch* launch);
+
+    std::vector<Worker*> workers_;
+    std::vector<std::thread> threads_;
+    TaskSystemOptions options_;
+    std::atomic<bool> stop_;
+    std::atomic<unsigned int> next_inbox_; // round-robin分配launch的起点
+
+    // 空闲的worker按options_.idle_mode自旋或者睡眠，epoch_每次有新work时递增（eventcount）
+    std::atomic<unsigned int> epoch_;
+    std::mutex idle_lk_;
+    std::vector<int> parked_; // 正在睡眠的worker，由idle_lk_保护
+    std::atomic<int> num_parked_;
+
+    // slot到Launch的两级表，chunk按需用CAS分配，提交时不需要加锁
+    static constexpr int kChunkBits = 16;
+    static constexpr int kNumChunks = 1 << (kSlotBits - kChunkBits);
+    std::atomic<std::atomic<Launch*>*>* chunks_;
+    std::atomic<int> num_slots_; // 分配过的slot数
+    // 空闲slot的无锁栈：高32位是防止ABA的版本号，低32位是栈顶slot + 1，0表示空
+    std::atomic<unsigned long long> free_head_;
+    SuccNode closed_; // 已完成launch的后继链表的哨兵
+
+    std::atomic<int> num_in_flight_; // 已提交但还没有完成的launch数
+    std::mutex main_lk_;
+    std::condition_variable cv_main_;
+    std::atomic<int> num_waiters_; // 在wait()/waitAny()中睡眠的线程数
+
+    std::mutex cancel_lk_;
+    // 上一次sync()之后被取消的launch，由cancel_lk_保护；记录被回收之后，
+    // 依赖它们的launch靠cancelled_set_知道要跳过
+    std::vector<TaskID> cancelled_;
+    std::unordered_set<TaskID> cancelled_set_;
+    std::atomic<int> num_cancelled_; // cancelled_.size()，为0时提交不需要加锁
+};
+
+/*
+ * TaskSystemParallelPersistent: a drop-in replacement for
+ * TaskSystemParallelSpawn that keeps its threads alive between launches.
+ * run() claims one of kRingSize launch descriptors preallocated in a ring,
+ * publishes it to the workers, helps execute its tasks and waits for the
+ * stragglers, so a launch allocates nothing: no threads, no std::function,
+ * no container growth.  A run() called from inside a task, on a worker or
+ * on the thread of the outer run(), that finds every descriptor taken runs
+ * its launch inline instead of waiting, since the descriptors may all
+ * belong to launches that are waiting on it.  Like
+ * TaskSystemParallelSpawn, runAsyncWithDeps() runs the launch
+ * synchronously.  See definition of ITaskSystem in itasksys.h for
+ * documentation of the ITaskSystem interface.
+ */
+class TaskSystemParallelPersistent: public ITaskSystem {
+    public:
+        TaskSystemParallelPersistent(int num_threads,
+            const TaskSystemOptions& options = TaskSystemOptions());
+        ~TaskSystemParallelPersistent();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+private:
+
+    static constexpr int kRingSize = 32;
+
+    struct LaunchDesc {
+        std::atomic<bool> busy; // 被某个run()占用
+        std::atomic<bool> published; // worker可以领取任务
+        std::atomic<int> num_active; // 正在领取这个launch的worker数
+        IRunnable* runnable;
+        int num_total_tasks;
+        std::atomic<int> next_task;
+        std::atomic<int> num_done;
+        char pad[64];
+        LaunchDesc(): busy(false), published(false), num_active(0),
+            runnable(nullptr), num_total_tasks(0), next_task(0), num_done(0) {}
+    };
+
+    void workerLoop(int id);
+    bool runSome(LaunchDesc& desc);
+    bool runAny();
+    void notifyWorkers();
+
+    int num_threads_;
+    TaskSystemOptions options_;
+    LaunchDesc ring_[kRingSize];
+    std::atomic<unsigned int> next_desc_; // 下一次从哪个descriptor开始找空闲的
+    std::vector<std::thread> threads_;
+    std::vector<Parker> parkers_;
+    std::atomic<bool> stop_;
+
+    // 和TaskSystemParallelWorkStealing一样的eventcount，parked_预先reserve，不会扩容
+    std::atomic<unsigned int> epoch_;
+    std::mutex idle_lk_;
+    std::vector<int> parked_;
+    std::atomic<int> num_parked_;
+};
+
 #endif
@@ -0,0 +1,224 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*
+ * Optional task-system tracing.
+ *
+ * Build with `make TRACE=1` (which defines TASKSYS_TRACE) to record, per
+ * thread, launch submit/ready/start/finish events, per-range task run
+ * spans, idle spans and time spent waiting for scheduler locks.  Each
+ * thread appends to its own fixed-size ring buffer, so recording never
+ * takes a lock; when a buffer wraps, the oldest events are dropped.
+ * TRACE_EXPORT(path) writes everything recorded so far as Chrome
+ * trace-event JSON, which can be opened in chrome://tracing or Perfetto.
+ *
+ * Without TASKSYS_TRACE every TRACE_* macro expands to nothing, so the
+ * instrumentation costs nothing.
+ */
+
+enum TraceEventType {
+    TRACE_LAUNCH_SUBMIT,  // instant: runAsyncWithDeps() accepted the launch
+    TRACE_LAUNCH_READY,   // instant: all dependencies of the launch are done
+    TRACE_LAUNCH_START,   // instant: task 0 of the launch starts running
+    TRACE_LAUNCH_FINISH,  // instant: the last task of the launch finished
+    TRACE_TASK_RUN,       // span: runTasks() over tasks [arg0, arg1)
+    TRACE_LOCK_WAIT,      // span: waiting to acquire a scheduler lock
+    TRACE_IDLE,           // span: worker sleeping because it had no work
+};
+
+#ifdef TASKSYS_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    uint64_t ts_ns;
+    uint64_t dur_ns;
+    int type;
+    int tid;
+    int section;
+    long long launch; // TaskID
+    int arg0;
+    int arg1;
+};
+
+/*
+ * Ring buffer owned by one thread at a time.  Buffers are never freed:
+ * when a thread exits, its buffer is handed to the next thread that
+ * starts tracing, so pools that are created and destroyed repeatedly do
+ * not grow memory.
+ */
+struct TraceBuffer {
+    static constexpr int kCapacity = 1 << 15;
+    std::vector<TraceEvent> events;
+    uint64_t head; // 写入的事件总数
+    bool in_use;
+    TraceBuffer(): events(kCapacity), head(0), in_use(true) {}
+};
+
+class Tracer {
+    public:
+        static Tracer& instance() {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        static uint64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /*
+         * Starts a new section (one Chrome "process"); subsequent events
+         * are grouped under `name`, e.g. one section per task-system run.
+         */
+        void beginSection(const std::string& name) {
+            std::lock_guard<std::mutex> lk(lk_);
+            sections_.push_back(name);
+            current_section_ = sections_.size() - 1;
+        }
+
+        void record(int type, uint64_t ts_ns, uint64_t dur_ns,
+                    long long launch, int arg0, int arg1) {
+            ThreadState& state = threadState();
+            TraceBuffer* buffer = state.buffer;
+            TraceEvent& e = buffer->events[buffer->head % TraceBuffer::kCapacity];
+            e.ts_ns = ts_ns;
+            e.dur_ns = dur_ns;
+            e.type = type;
+            e.tid = state.tid;
+            e.section = current_section_;
+            e.launch = launch;
+            e.arg0 = arg0;
+            e.arg1 = arg1;
+            buffer->head++;
+        }
+
+        /*
+         * Writes all recorded events as Chrome trace-event JSON.  Call it
+         * when no task system is running.  Returns false if the file
+         * cannot be written.
+         */
+        bool exportChrome(const char* path) {
+            std::lock_guard<std::mutex> lk(lk_);
+            FILE* f = fopen(path, "w");
+            if (f == NULL) {
+                return false;
+            }
+
+            static const char* names[] = {
+                "submit", "ready", "start", "finish", "run", "lock wait", "idle",
+            };
+            fprintf(f, "{\"traceEvents\":[\n");
+            bool first = true;
+            for (size_t i = 0; i < sections_.size(); i++) {
+                fprintf(f, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,"
+                        "\"args\":{\"name\":\"%s\"}}",
+                        first ? "" : ",\n", i, sections_[i].c_str());
+                first = false;
+            }
+            for (TraceBuffer* buffer : buffers_) {
+                uint64_t begin = buffer->head > (uint64_t)TraceBuffer::kCapacity ?
+                    buffer->head - TraceBuffer::kCapacity : 0;
+                for (uint64_t i = begin; i < buffer->head; i++) {
+                    const TraceEvent& e = buffer->events[i % TraceBuffer::kCapacity];
+                    double ts = (e.ts_ns - epoch_ns_) / 1000.0;
+                    fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"tasksys\",\"pid\":%d,\"tid\":%d,"
+                            "\"ts\":%.3f,", first ? "" : ",\n", names[e.type],
+                            e.section, e.tid, ts);
+                    first = false;
+                    if (e.type == TRACE_TASK_RUN) {
+                        fprintf(f, "\"ph\":\"X\",\"dur\":%.3f,\"args\":{\"launch\":%lld,"
+                                "\"begin\":%d,\"end\":%d}}",
+                                e.dur_ns / 1000.0, e.launch, e.arg0, e.arg1);
+                    } else if (e.type == TRACE_LOCK_WAIT || e.type == TRACE_IDLE) {
+                        fprintf(f, "\"ph\":\"X\",\"dur\":%.3f}", e.dur_ns / 1000.0);
+                    } else {
+                        fprintf(f, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"launch\":%lld}}",
+                                e.launch);
+                    }
+                }
+            }
+            fprintf(f, "\n]}\n");
+            fclose(f);
+            return true;
+        }
+
+    private:
+        struct ThreadState {
+            TraceBuffer* buffer;
+            int tid;
+            ThreadState(): buffer(nullptr), tid(0) {}
+            ~ThreadState() {
+                if (buffer != nullptr) {
+                    Tracer::instance().release(buffer);
+                }
+            }
+        };
+
+        Tracer(): epoch_ns_(now()), current_section_(0), next_tid_(0) {
+            sections_.push_back("runtasks");
+        }
+
+        ThreadState& threadState() {
+            static thread_local ThreadState state;
+            if (state.buffer == nullptr) {
+                acquire(&state);
+            }
+            return state;
+        }
+
+        void acquire(ThreadState* state) {
+            std::lock_guard<std::mutex> lk(lk_);
+            state->tid = next_tid_++;
+            for (TraceBuffer* buffer : buffers_) {
+                if (!buffer->in_use) {
+                    buffer->in_use = true;
+                    state->buffer = buffer;
+                    return;
+                }
+            }
+            state->buffer = new TraceBuffer();
+            buffers_.push_back(state->buffer);
+        }
+
+        void release(TraceBuffer* buffer) {
+            std::lock_guard<std::mutex> lk(lk_);
+            buffer->in_use = false;
+        }
+
+        std::mutex lk_;
+        uint64_t epoch_ns_;
+        std::vector<std::string> sections_;
+        std::atomic<int> current_section_;
+        int next_tid_;
+        std::vector<TraceBuffer*> buffers_;
+};
+
+#define TRACE_INSTANT(type, launch) \
+    Tracer::instance().record((type), Tracer::now(), 0, (launch), 0, 0)
+#define TRACE_SPAN_BEGIN(var) \
+    uint64_t var = Tracer::now()
+#define TRACE_SPAN_END(var, type, launch, arg0, arg1) \
+    Tracer::instance().record((type), var, Tracer::now() - var, (launch), (arg0), (arg1))
+#define TRACE_SECTION(name) \
+    Tracer::instance().beginSection(name)
+#define TRACE_EXPORT(path) \
+    Tracer::instance().exportChrome(path)
+
+#else
+
+#define TRACE_INSTANT(type, launch) ((void)0)
+#define TRACE_SPAN_BEGIN(var) ((void)0)
+#define TRACE_SPAN_END(var, type, launch, arg0, arg1) ((void)0)
+#define TRACE_SECTION(name) ((void)0)
+#define TRACE_EXPORT(path) (false)
+
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef _WSDEQUE_H
+#define _WSDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+ * WorkStealingDeque: a Chase-Lev work-stealing deque of pointers
+ * ("Dynamic Circular Work-Stealing Deque", Chase & Lev, SPAA'05), using
+ * the C11 memory orderings from Le et al., PPoPP'13.
+ *
+ * Only the owning thread may call push() and take(), which operate on the
+ * bottom end.  Any thread may call steal(), which removes from the top
+ * end.  take() and steal() return nullptr when the deque is empty; steal()
+ * also returns nullptr when it loses a race with another thief or the
+ * owner, in which case the caller should simply try elsewhere.
+ */
+template <typename T>
+class WorkStealingDeque {
+    public:
+        explicit WorkStealingDeque(int log_capacity = 8)
+            : top_(0), bottom_(0), array_(new Array(int64_t(1) << log_capacity)) {}
+
+        ~WorkStealingDeque() {
+            delete array_.load(std::memory_order_relaxed);
+            for (Array* a : garbage_) {
+                delete a;
+            }
+        }
+
+        void push(T x) {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_acquire);
+            Array* a = array_.load(std::memory_order_relaxed);
+            if (b - t > a->capacity - 1) {
+                a = grow(a, t, b);
+            }
+            a->put(b, x);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+
+        T take() {
+            int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+            Array* a = array_.load(std::memory_order_relaxed);
+            bottom_.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top_.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                // 队列为空
+                bottom_.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            T x = a->get(b);
+            if (t == b) {
+                // 只剩最后一个元素，需要和thief竞争
+                if (!top_.compare_exchange_strong(t, t + 1,
+                                                  std::memory_order_seq_cst,
+                                                  std::memory_order_relaxed)) {
+                    x = nullptr;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+            return x;
+        }
+
+        T steal() {
+            int64_t t = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom_.load(std::memory_order_acquire);
+            if (t >= b) {
+                return nullptr;
+            }
+
+            Array* a = array_.load(std::memory_order_acquire);
+            T x = a->get(t);
+            if (!top_.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return x;
+        }
+
+        bool empty() const {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_relaxed);
+            return b <= t;
+        }
+
+    private:
+        struct Array {
+            int64_t capacity;
+            int64_t mask;
+            std::atomic<T>* buf;
+
+            explicit Array(int64_t _capacity)
+                : capacity(_capacity), mask(_capacity - 1),
+                  buf(new std::atomic<T>[_capacity]) {}
+            ~Array() { delete [] buf; }
+
+            T get(int64_t i) const {
+                return buf[i & mask].load(std::memory_order_relaxed);
+            }
+            void put(int64_t i, T x) {
+                buf[i & mask].store(x, std::memory_order_relaxed);
+            }
+        };
+
+        Array* grow(Array* a, int64_t t, int64_t b) {
+            Array* bigger = new Array(a->capacity * 2);
+            for (int64_t i = t; i < b; ++i) {
+                bigger->put(i, a->get(i));
+            }
+            // thief可能还在读旧的数组，所以析构时才释放
+            garbage_.push_back(a);
+            array_.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+        // top_和bottom_放在不同的cache line上，避免owner和thief之间的false sharing
+        std::atomic<int64_t> top_;
+        char pad0_[64];
+        std::atomic<int64_t> bottom_;
+        char pad1_[64];
+        std::atomic<Array*> array_;
+        std::vector<Array*> garbage_; // 只由owner访问
+};
+
+#endif
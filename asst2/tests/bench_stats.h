@@ -0,0 +1,257 @@
+#ifndef _BENCH_STATS_H
+#define _BENCH_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+/*
+ * Statistics and result files for `runtasks --stats`.
+ *
+ * Each (test, task system) pair is run a few times to warm up, then timed
+ * until the 95% confidence interval of the mean run time is narrower than
+ * a target fraction of the mean, or until a run-count or time budget is
+ * spent.  Results are written as JSON with one record per line, which is
+ * also the format read back as a baseline for regression gating.
+ */
+
+/*
+ * Resource usage of the process (all threads) since some earlier point.
+ */
+struct UsageSample {
+    double cpu_s; // user + system
+    long vol_switches; // 主动让出CPU（阻塞、睡眠）
+    long invol_switches; // 被调度器抢占
+
+    static UsageSample now() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        UsageSample s;
+        s.cpu_s = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+                  usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+        s.vol_switches = usage.ru_nvcsw;
+        s.invol_switches = usage.ru_nivcsw;
+        return s;
+    }
+
+    UsageSample operator-(const UsageSample& other) const {
+        UsageSample s;
+        s.cpu_s = cpu_s - other.cpu_s;
+        s.vol_switches = vol_switches - other.vol_switches;
+        s.invol_switches = invol_switches - other.invol_switches;
+        return s;
+    }
+};
+
+/*
+ * Summary of the timed runs of one (test, task system) pair.  Times are in
+ * milliseconds; usage figures are per run.
+ */
+struct BenchRecord {
+    std::string test;
+    std::string task_system;
+    int runs;
+    double mean_ms;
+    double ci95_ms; // 均值95%置信区间的半宽
+    double median_ms;
+    double p95_ms;
+    double p99_ms;
+    double min_ms;
+    double cpu_util; // 平均有几个核在忙：cpu时间 / 墙钟时间
+    double vol_switches;
+    double invol_switches;
+};
+
+/*
+ * Two-sided 95% critical value of Student's t distribution with `df`
+ * degrees of freedom.
+ */
+static inline double tCritical95(int df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < 1) {
+        return INFINITY;
+    }
+    if (df <= 30) {
+        return table[df - 1];
+    }
+    return df <= 60 ? 2.000 : df <= 120 ? 1.980 : 1.960;
+}
+
+static inline double sampleMean(const std::vector<double>& v) {
+    double sum = 0;
+    for (double x : v) {
+        sum += x;
+    }
+    return v.empty() ? 0 : sum / v.size();
+}
+
+// 均值95%置信区间的半宽，样本不足两个时为无穷大
+static inline double ci95HalfWidth(const std::vector<double>& v) {
+    int n = v.size();
+    if (n < 2) {
+        return INFINITY;
+    }
+    double mean = sampleMean(v);
+    double ss = 0;
+    for (double x : v) {
+        ss += (x - mean) * (x - mean);
+    }
+    return tCritical95(n - 1) * std::sqrt(ss / (n - 1)) / std::sqrt((double)n);
+}
+
+/*
+ * Percentile `p` (0..100) of `sorted`, interpolating linearly between the
+ * two nearest ranks.
+ */
+static inline double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    double rank = p / 100.0 * (sorted.size() - 1);
+    size_t lo = (size_t)rank;
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+/*
+ * Fills the timing fields of `record` from per-run times in seconds.
+ */
+static inline void summarizeTimes(const std::vector<double>& times_s, BenchRecord* record) {
+    std::vector<double> ms;
+    for (double t : times_s) {
+        ms.push_back(t * 1000);
+    }
+    std::vector<double> sorted = ms;
+    std::sort(sorted.begin(), sorted.end());
+    record->runs = ms.size();
+    record->mean_ms = sampleMean(ms);
+    record->ci95_ms = ci95HalfWidth(ms);
+    record->median_ms = percentile(sorted, 50);
+    record->p95_ms = percentile(sorted, 95);
+    record->p99_ms = percentile(sorted, 99);
+    record->min_ms = sorted.empty() ? 0 : sorted[0];
+}
+
+static inline bool writeBenchJson(const char* path, int num_threads,
+                                  const std::vector<BenchRecord>& records) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    fprintf(f, "{\n  \"version\": 1,\n  \"num_threads\": %d,\n  \"results\": [\n", num_threads);
+    for (size_t i = 0; i < records.size(); i++) {
+        const BenchRecord& r = records[i];
+        // 少于两次运行时置信区间无穷大，JSON里没有无穷大，写成null
+        char ci95[32] = "null";
+        if (std::isfinite(r.ci95_ms)) {
+            snprintf(ci95, sizeof(ci95), "%.6f", r.ci95_ms);
+        }
+        // 每条记录占一行，readBenchJson()按行解析
+        fprintf(f, "    {\"test\": \"%s\", \"task_system\": \"%s\", \"runs\": %d, "
+                   "\"mean_ms\": %.6f, \"ci95_ms\": %s, \"median_ms\": %.6f, "
+                   "\"p95_ms\": %.6f, \"p99_ms\": %.6f, \"min_ms\": %.6f, "
+                   "\"cpu_util\": %.3f, \"vol_switches\": %.1f, \"invol_switches\": %.1f}%s\n",
+                r.test.c_str(), r.task_system.c_str(), r.runs,
+                r.mean_ms, ci95, r.median_ms,
+                r.p95_ms, r.p99_ms, r.min_ms,
+                r.cpu_util, r.vol_switches, r.invol_switches,
+                i + 1 == records.size() ? "" : ",");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+// 取出一行里 "key": 后面的值（字符串去掉引号）
+static inline bool jsonField(const std::string& line, const char* key, std::string* value) {
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = line.find_first_not_of(' ', pos + pattern.size());
+    if (pos == std::string::npos) {
+        return false;
+    }
+    size_t end;
+    if (line[pos] == '"') {
+        pos++;
+        end = line.find('"', pos);
+    } else {
+        end = line.find_first_of(",}", pos);
+    }
+    if (end == std::string::npos) {
+        return false;
+    }
+    *value = line.substr(pos, end - pos);
+    return true;
+}
+
+/*
+ * Reads records written by writeBenchJson(), and the thread count they
+ * were measured with into `num_threads` (-1 if the file has none).
+ * Returns false if the file cannot be opened; lines that are not records
+ * are skipped.
+ */
+static inline bool readBenchJson(const char* path, std::vector<BenchRecord>* records,
+                                 int* num_threads) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    *num_threads = -1;
+    char buf[1024];
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        std::string line(buf);
+        BenchRecord r = BenchRecord();
+        std::string v;
+        if (!jsonField(line, "test", &r.test) || !jsonField(line, "task_system", &r.task_system)) {
+            // num_threads在记录之外单独占一行
+            if (jsonField(line, "num_threads", &v)) {
+                *num_threads = atoi(v.c_str());
+            }
+            continue;
+        }
+        if (jsonField(line, "runs", &v)) r.runs = atoi(v.c_str());
+        if (jsonField(line, "mean_ms", &v)) r.mean_ms = atof(v.c_str());
+        if (jsonField(line, "ci95_ms", &v)) r.ci95_ms = v == "null" ? INFINITY : atof(v.c_str());
+        if (jsonField(line, "median_ms", &v)) r.median_ms = atof(v.c_str());
+        if (jsonField(line, "p95_ms", &v)) r.p95_ms = atof(v.c_str());
+        if (jsonField(line, "p99_ms", &v)) r.p99_ms = atof(v.c_str());
+        if (jsonField(line, "min_ms", &v)) r.min_ms = atof(v.c_str());
+        if (jsonField(line, "cpu_util", &v)) r.cpu_util = atof(v.c_str());
+        if (jsonField(line, "vol_switches", &v)) r.vol_switches = atof(v.c_str());
+        if (jsonField(line, "invol_switches", &v)) r.invol_switches = atof(v.c_str());
+        records->push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+/*
+ * A run is a regression against its baseline when its median is slower by
+ * more than `tolerance` (a fraction) AND the 95% confidence intervals of
+ * the two means do not overlap, so that a noisy pair is not flagged on
+ * the median alone.  A side with fewer than two runs has no confidence
+ * interval, so such a pair is never gated.
+ */
+static inline bool isGated(const BenchRecord& current, const BenchRecord& baseline) {
+    return current.runs >= 2 && baseline.runs >= 2;
+}
+
+static inline bool isRegression(const BenchRecord& current, const BenchRecord& baseline,
+                                double tolerance) {
+    if (!isGated(current, baseline) || current.median_ms <= baseline.median_ms * (1 + tolerance)) {
+        return false;
+    }
+    return current.mean_ms - current.ci95_ms > baseline.mean_ms + baseline.ci95_ms;
+}
+
+#endif
@@ -2,21 +2,63 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <string>
+#include <string.h>
 #include <assert.h>
+#include <thread>
 
 #include "tasksys.h"
 #include "tests.h"
+#include "bench_stats.h"
 
 #define DEFAULT_NUM_THREADS 8
 #define DEFAULT_NUM_TIMING_ITERATIONS 3
+#define DEFAULT_STATS_WARMUP 2
+#define DEFAULT_STATS_MAX_RUNS 200
+#define DEFAULT_STATS_CI_PCT 2.0
+#define DEFAULT_STATS_TIME_BUDGET_S 10.0
+#define DEFAULT_STATS_TOLERANCE_PCT 5.0
 
 
 void usage(const char* progname, std::string *testnames, int num_tests) {
-    printf("Usage: %s [options] testname\n", progname);
+    printf("Usage: %s [options] testname [testname...]\n", progname);
     printf("Program Options:\n");
     printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
     printf("  -i  --num_timing_iterations <INT> Number of timing iterations: <INT> (default=%d)\n", DEFAULT_NUM_TIMING_ITERATIONS);
+    printf("  -g  --grain <single|guided>   How workers claim task ids of a launch (default=guided)\n");
+    printf("  -m  --min_grain <INT>         Smallest range claimed in guided mode (default=1)\n");
+    printf("  -t  --task_system <INT>       Only run the task system with this index (default=all)\n");
+    printf("      --idle <spin|park|hybrid> What idle workers do while waiting for work (default=hybrid)\n");
+    printf("      --spin_us <INT>           Hybrid idle: microseconds to spin before yielding (default=20)\n");
+    printf("      --yield_us <INT>          Hybrid idle: microseconds to yield before parking (default=50)\n");
+    printf("  -p  --placement <compact|scatter|none> How worker threads are pinned to cores (default=none)\n");
+    printf("      --ready <fifo|critical_path> Order in which ready launches start (default=fifo)\n");
+#ifdef TASKSYS_HAS_WORK_STEALING
+    printf("  -b  --idle_bench              Report latency and CPU-seconds for each idle policy\n");
+#endif
+#ifdef TASKSYS_HAS_PRIORITIES
+    printf("      --ready_bench             Compare makespan under each ready order\n");
+#endif
+#ifdef TASKSYS_HAS_GROUPS
+    printf("      --tenant_bench            Two ping-pong tenants sharing one pool, with and without groups\n");
+#endif
+#ifdef TASKSYS_TRACE
+    printf("  -o  --trace <FILE>            Write a Chrome trace-event JSON timeline to <FILE>\n");
+#endif
+    printf("  -l  --launch_bench            Report launches/sec of empty tasks for every task system\n");
+    printf("  -s  --stats                   Run until the mean converges; report median/p95/p99 and CPU usage\n");
+    printf("      --warmup <INT>            Stats: untimed runs before measuring (default=%d)\n", DEFAULT_STATS_WARMUP);
+    printf("      --max_runs <INT>          Stats: stop after this many timed runs (default=%d)\n", DEFAULT_STATS_MAX_RUNS);
+    printf("      --ci <PCT>                Stats: stop once the 95%% CI half-width is below PCT of the mean (default=%.0f)\n", DEFAULT_STATS_CI_PCT);
+    printf("      --time_budget <SEC>       Stats: stop timing a test after SEC seconds, not counting warmup (default=%.0f)\n", DEFAULT_STATS_TIME_BUDGET_S);
+    printf("      --json <FILE>             Stats: write the results as JSON to <FILE>\n");
+    printf("      --baseline <FILE>         Stats: compare against a JSON file from --json with the same -n; exit 2 on a regression\n");
+    printf("      --tolerance <PCT>         Stats: median slowdown allowed before a regression (default=%.0f)\n", DEFAULT_STATS_TOLERANCE_PCT);
+    printf("      --sweep                   Run each test at 1, 2, 4, ... threads; print speedup and efficiency\n");
+    printf("      --sweep_max <INT>         Sweep: largest thread count (default=hardware threads)\n");
+    printf("      --csv <FILE>              Sweep: also write every point as CSV to <FILE>\n");
+    printf("      --soak                    Include the *_soak tests in \"all\" and run them at full size\n");
     printf("  -?  --help                    This message\n");
+    printf("Several testnames may be given; \"all\" runs every test except the *_soak tests.\n");
     printf("Valid testnames are:");
     for(int i = 0; i < num_tests; i++) {
         printf(" %s%c", testnames[i].c_str(), (char)((i+1 == num_tests) ? '\n' : ','));
@@ -28,32 +70,532 @@ enum TaskSystemType {
     PARALLEL_SPAWN,
     PARALLEL_THREAD_POOL_SPINNING,
     PARALLEL_THREAD_POOL_SLEEPING,
+#ifdef TASKSYS_HAS_WORK_STEALING
+    PARALLEL_WORK_STEALING,
+    PARALLEL_PERSISTENT,
+#endif
     N_TASKSYS_IMPLS, // This must be in the last position.
 };
 
-ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
+ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type,
+                                     const TaskSystemOptions& options) {
     assert(type < N_TASKSYS_IMPLS);
 
     if (type == SERIAL) {
         return new TaskSystemSerial(num_threads);
     } else if (type == PARALLEL_SPAWN) {
-        return new TaskSystemParallelSpawn(num_threads);
+        return new TaskSystemParallelSpawn(num_threads, options);
     } else if (type == PARALLEL_THREAD_POOL_SPINNING) {
-        return new TaskSystemParallelThreadPoolSpinning(num_threads);
+        return new TaskSystemParallelThreadPoolSpinning(num_threads, options);
     } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
-        return new TaskSystemParallelThreadPoolSleeping(num_threads);
+        return new TaskSystemParallelThreadPoolSleeping(num_threads, options);
+#ifdef TASKSYS_HAS_WORK_STEALING
+    } else if (type == PARALLEL_WORK_STEALING) {
+        return new TaskSystemParallelWorkStealing(num_threads, options);
+    } else if (type == PARALLEL_PERSISTENT) {
+        return new TaskSystemParallelPersistent(num_threads, options);
+#endif
     } else {
         return NULL;
     }
 }
 
+/*
+ * User plus system CPU time consumed by all threads of this process.
+ */
+double cpuSeconds() {
+    return UsageSample::now().cpu_s;
+}
+
+/*
+ * Measures per-launch overhead: run()s launches of empty tasks on every
+ * task system for about half a second each and reports launches per
+ * second, for launches of one task and of eight tasks per thread.
+ */
+void runLaunchBenchmark(int num_threads, int only_task_system, TaskSystemOptions options) {
+    const double duration = 0.5;
+    const int sizes[] = {1, 8 * num_threads};
+    EmptyTask empty;
+
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        if (only_task_system >= 0 && i != only_task_system) {
+            continue;
+        }
+        ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i, options);
+        for (int num_tasks : sizes) {
+            for (int j = 0; j < 10; j++) {
+                t->run(&empty, num_tasks);
+            }
+            long launches = 0;
+            double start = CycleTimer::currentSeconds();
+            double elapsed = 0;
+            while (elapsed < duration) {
+                for (int j = 0; j < 16; j++) {
+                    t->run(&empty, num_tasks);
+                }
+                launches += 16;
+                elapsed = CycleTimer::currentSeconds() - start;
+            }
+            printf("[%s]:\t\t[%d tasks]\t[%.0f] launches/s\n",
+                   t->name(), num_tasks, launches / elapsed);
+        }
+        delete t;
+    }
+}
+
+#ifdef TASKSYS_HAS_WORK_STEALING
+/*
+ * Runs `test` on the thread pools under each idle policy and reports the
+ * best wall-clock time together with the CPU-seconds burned in that run.
+ * The spinning pool is included as the always-spin baseline.
+ */
+void runIdleBenchmark(TestResults (*test)(ITaskSystem*), int num_threads,
+                      int num_timing_iterations, TaskSystemOptions options) {
+    const char* idle_names[] = {"spin", "park", "hybrid"};
+    const int n_configs = 7;
+
+    for (int c = 0; c < n_configs; c++) {
+        double minT = 1e30;
+        double minT_cpu = 0;
+        char label[128];
+        for (int j = 0; j < num_timing_iterations; j++) {
+            ITaskSystem *t;
+            if (c == 0) {
+                t = new TaskSystemParallelThreadPoolSpinning(num_threads, options);
+                snprintf(label, sizeof(label), "%s", t->name());
+            } else if (c <= 3) {
+                options.idle_mode = (IdleMode)(c - 1);
+                t = new TaskSystemParallelThreadPoolSleeping(num_threads, options);
+                snprintf(label, sizeof(label), "%s (idle=%s)", t->name(), idle_names[c - 1]);
+            } else {
+                options.idle_mode = (IdleMode)(c - 4);
+                t = new TaskSystemParallelWorkStealing(num_threads, options);
+                snprintf(label, sizeof(label), "%s (idle=%s)", t->name(), idle_names[c - 4]);
+            }
+
+            double cpu_start = cpuSeconds();
+            TestResults result = test(t);
+            double cpu = cpuSeconds() - cpu_start;
+
+            if (!result.passed) {
+                printf("ERROR: Results did not pass correctness check! (iter=%d, ref_impl=%s)\n",
+                    j, label);
+                exit(1);
+            }
+            if (result.time < minT) {
+                minT = result.time;
+                minT_cpu = cpu;
+            }
+            delete t;
+        }
+        printf("[%s]:\t\t[%.3f] ms\t[%.3f] cpu-s\n", label, minT * 1000, minT_cpu);
+    }
+}
+#endif
+
+#ifdef TASKSYS_HAS_PRIORITIES
+/*
+ * Runs `test` on the sleeping thread pool with ready launches started in
+ * FIFO order and then critical-path-first, and reports the best makespan
+ * of each.
+ */
+void runReadyOrderBenchmark(TestResults (*test)(ITaskSystem*), int num_threads,
+                            int num_timing_iterations, TaskSystemOptions options) {
+    const char* order_names[] = {"fifo", "critical_path"};
+    double minT[2];
+
+    for (int c = 0; c < 2; c++) {
+        options.ready_order = (ReadyOrder)c;
+        minT[c] = 1e30;
+        char label[128];
+        for (int j = 0; j < num_timing_iterations; j++) {
+            ITaskSystem *t = new TaskSystemParallelThreadPoolSleeping(num_threads, options);
+            snprintf(label, sizeof(label), "%s (ready=%s)", t->name(), order_names[c]);
+            TestResults result = test(t);
+            if (!result.passed) {
+                printf("ERROR: Results did not pass correctness check! (iter=%d, ref_impl=%s)\n",
+                    j, label);
+                exit(1);
+            }
+            minT[c] = std::min(minT[c], result.time);
+            delete t;
+        }
+        printf("[%s]:\t\t[%.3f] ms\n", label, minT[c] * 1000);
+    }
+    printf("Makespan change (critical_path vs fifo): %+.1f%%\n",
+           (minT[1] / minT[0] - 1.0) * 100);
+}
+#endif
+
+#ifdef TASKSYS_HAS_GROUPS
+/*
+ * Two tenants share one sleeping thread pool.  The batch tenant submits a
+ * burst of large PingPongTask launches and waits for all of them; while
+ * they run, the interactive tenant, on its own thread, submits small
+ * PingPongTask launches one at a time and waits for each.  The benchmark
+ * runs once with every launch in the default group (one ready queue, so
+ * the interactive launches queue behind the burst) and once with a group
+ * of equal weight per tenant, and reports each tenant's throughput and
+ * the interactive tenant's launch latency percentiles.
+ */
+void runTenantBenchmark(int num_threads, TaskSystemOptions options) {
+    const int num_batch_launches = 8;
+    const int batch_elements = 1 << 19;
+    const int batch_tasks = 4096;
+    const int num_interactive_launches = 40;
+    const int interactive_elements = 1 << 12;
+    const int interactive_tasks = 64;
+    const int iters = 64;
+
+    std::vector<int> batch_in(batch_elements, 1), batch_out(batch_elements);
+    std::vector<int> interactive_in(interactive_elements, 1), interactive_out(interactive_elements);
+    PingPongTask batch(batch_elements, batch_in.data(), batch_out.data(), true, iters);
+    PingPongTask interactive(interactive_elements, interactive_in.data(),
+                             interactive_out.data(), true, iters);
+
+    for (int use_groups = 0; use_groups < 2; use_groups++) {
+        ITaskSystem *t = new TaskSystemParallelThreadPoolSleeping(num_threads, options);
+        int batch_group = use_groups ? t->createGroup("batch", 1) : 0;
+        int interactive_group = use_groups ? t->createGroup("interactive", 1) : 0;
+        std::vector<TaskID> no_deps;
+
+        double start = CycleTimer::currentSeconds();
+        std::vector<TaskID> batch_ids;
+        for (int i = 0; i < num_batch_launches; i++) {
+            batch_ids.push_back(t->runAsyncInGroup(batch_group, &batch, batch_tasks, no_deps));
+        }
+
+        std::vector<double> latencies;
+        double interactive_elapsed = 0;
+        std::thread client([&]() {
+            double client_start = CycleTimer::currentSeconds();
+            for (int i = 0; i < num_interactive_launches; i++) {
+                double submit = CycleTimer::currentSeconds();
+                t->wait(t->runAsyncInGroup(interactive_group, &interactive,
+                                           interactive_tasks, no_deps));
+                latencies.push_back(CycleTimer::currentSeconds() - submit);
+            }
+            interactive_elapsed = CycleTimer::currentSeconds() - client_start;
+        });
+
+        // 不分组时默认组里也有interactive的launch，只能逐个等自己的
+        if (use_groups) {
+            t->syncGroup(batch_group);
+        } else {
+            for (TaskID id : batch_ids) {
+                t->wait(id);
+            }
+        }
+        double batch_elapsed = CycleTimer::currentSeconds() - start;
+        client.join();
+        t->sync();
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return latencies[std::min((int)latencies.size() - 1, (int)(p * latencies.size()))];
+        };
+        printf("[%s (%s)]:\n", t->name(), use_groups ? "fair-share groups" : "single queue");
+        printf("    batch:\t\t[%.1f] Melem/s\t[%.3f] ms\n",
+               (double)num_batch_launches * batch_elements / batch_elapsed / 1e6,
+               batch_elapsed * 1000);
+        printf("    interactive:\t[%.1f] Melem/s\tp50 [%.3f] ms\tp99 [%.3f] ms\tmax [%.3f] ms\n",
+               (double)num_interactive_launches * interactive_elements / interactive_elapsed / 1e6,
+               percentile(0.5) * 1000, percentile(0.99) * 1000, latencies.back() * 1000);
+        delete t;
+    }
+}
+#endif
+
+struct StatsOptions {
+    int warmup;
+    int max_runs;
+    double ci_target; // 置信区间半宽 / 均值 的目标，小数
+    double time_budget_s; // 每个(测试, task system)计时运行最多花多少秒，不含预热
+};
+
+/*
+ * Runs `test` on every selected task system: `warmup` untimed runs, then
+ * timed runs until the mean has converged (see bench_stats.h), each on a
+ * freshly created task system.  CPU utilization and context switches are
+ * measured around the whole run, including creating and destroying the
+ * task system, and are reported per run.
+ */
+void runStatistical(TestResults (*test)(ITaskSystem*), const std::string& test_name,
+                    int num_threads, int only_task_system, const StatsOptions& stats,
+                    TaskSystemOptions options, std::vector<BenchRecord>* records) {
+    const int min_runs = 5;
+
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        if (only_task_system >= 0 && i != only_task_system) {
+            continue;
+        }
+        std::vector<double> times;
+        UsageSample usage = UsageSample();
+        double wall = 0;
+        std::string name;
+        double start = 0;
+
+        for (int j = 0; ; j++) {
+            bool warming_up = j < stats.warmup;
+            if (j == stats.warmup) {
+                start = CycleTimer::currentSeconds();
+            }
+            UsageSample usage_start = UsageSample::now();
+            double wall_start = CycleTimer::currentSeconds();
+
+            ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i, options);
+            TestResults result = test(t);
+            if (!result.passed) {
+                printf("ERROR: Results did not pass correctness check! (iter=%d, ref_impl=%s)\n",
+                    j, t->name());
+                exit(1);
+            }
+            name = t->name();
+            delete t;
+
+            if (warming_up) {
+                continue;
+            }
+            wall += CycleTimer::currentSeconds() - wall_start;
+            UsageSample delta = UsageSample::now() - usage_start;
+            usage.cpu_s += delta.cpu_s;
+            usage.vol_switches += delta.vol_switches;
+            usage.invol_switches += delta.invol_switches;
+            times.push_back(result.time);
+
+            int n = times.size();
+            if (n >= stats.max_runs) {
+                break;
+            }
+            if (n >= 2 && CycleTimer::currentSeconds() - start > stats.time_budget_s) {
+                break;
+            }
+            if (n >= min_runs && ci95HalfWidth(times) <= stats.ci_target * sampleMean(times)) {
+                break;
+            }
+        }
+
+        BenchRecord r;
+        r.test = test_name;
+        r.task_system = name;
+        summarizeTimes(times, &r);
+        r.cpu_util = wall > 0 ? usage.cpu_s / wall : 0;
+        r.vol_switches = (double)usage.vol_switches / r.runs;
+        r.invol_switches = (double)usage.invol_switches / r.runs;
+        records->push_back(r);
+
+        // 第一列保持 [name]: [ms] 的格式，run_test_harness.py 照样能解析（取中位数）
+        printf("[%s]:\t\t[%.3f] ms\tmean %.3f +/- %.3f (%.1f%%)\tp95 %.3f\tp99 %.3f\t%d runs\n",
+               r.task_system.c_str(), r.median_ms, r.mean_ms, r.ci95_ms,
+               100 * r.ci95_ms / r.mean_ms, r.p95_ms, r.p99_ms, r.runs);
+        printf("    cpu util %.2f cores\tctx switches/run: %.1f voluntary, %.1f involuntary\n",
+               r.cpu_util, r.vol_switches, r.invol_switches);
+    }
+}
+
+/*
+ * Compares `records`, measured with `num_threads` threads, against the
+ * baseline file and prints one line per record.  Returns the number of
+ * regressions (see isRegression()), or -1 after printing an error if the
+ * baseline cannot be read or was measured with a different thread count.
+ */
+int compareWithBaseline(const std::vector<BenchRecord>& records, const char* baseline_path,
+                        int num_threads, double tolerance) {
+    std::vector<BenchRecord> baseline;
+    int baseline_threads;
+    if (!readBenchJson(baseline_path, &baseline, &baseline_threads)) {
+        fprintf(stderr, "Error: could not read baseline %s!\n", baseline_path);
+        return -1;
+    }
+    if (baseline_threads != num_threads) {
+        fprintf(stderr, "Error: baseline %s was measured with %d threads, this run used %d!\n",
+                baseline_path, baseline_threads, num_threads);
+        return -1;
+    }
+    printf("Baseline comparison (%s, tolerance %.1f%%):\n", baseline_path, tolerance * 100);
+    int regressions = 0;
+    for (const BenchRecord& r : records) {
+        const BenchRecord* base = NULL;
+        for (const BenchRecord& b : baseline) {
+            if (b.test == r.test && b.task_system == r.task_system) {
+                base = &b;
+                break;
+            }
+        }
+        if (base == NULL) {
+            printf("    %s / %s:\tno baseline\n", r.test.c_str(), r.task_system.c_str());
+            continue;
+        }
+        bool regressed = isRegression(r, *base, tolerance);
+        regressions += regressed;
+        const char* verdict = regressed ? "\tREGRESSION" : "";
+        if (!isGated(r, *base)) {
+            verdict = "\tnot gated (fewer than 2 runs)";
+        }
+        printf("    %s / %s:\t%.3f ms vs %.3f ms (%+.1f%%)%s\n",
+               r.test.c_str(), r.task_system.c_str(), r.median_ms, base->median_ms,
+               100 * (r.median_ms / base->median_ms - 1), verdict);
+    }
+    return regressions;
+}
+
+/*
+ * Thread counts for --sweep: 1, 2, 4, ... up to max_threads, and
+ * max_threads itself when it is not a power of two.
+ */
+std::vector<int> sweepThreadCounts(int max_threads) {
+    std::vector<int> counts;
+    for (int n = 1; n < max_threads; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(std::max(1, max_threads));
+    return counts;
+}
+
+/*
+ * Runs `test` on every selected task system at each thread count and
+ * prints the speedup over the serial task system, with the parallel
+ * efficiency (speedup / threads) in parentheses.  Times are the best of
+ * num_timing_iterations runs.  A task system is flagged at the first
+ * thread count where adding threads halves its efficiency without making
+ * it any faster, and when it never beats serial.  Each point is also
+ * appended to `csv` if given.
+ */
+void runThreadSweep(TestResults (*test)(ITaskSystem*), const std::string& test_name,
+                    const std::vector<int>& thread_counts, int only_task_system,
+                    int num_timing_iterations, TaskSystemOptions options, FILE* csv) {
+    int n_counts = thread_counts.size();
+    std::vector<std::string> names(N_TASKSYS_IMPLS);
+    // times[i][c]：第i个task system在thread_counts[c]个线程下的最短时间
+    std::vector<std::vector<double>> times(N_TASKSYS_IMPLS, std::vector<double>(n_counts, 0));
+
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        // 串行的结果是加速比的基准，所以总是要跑
+        if (only_task_system >= 0 && i != only_task_system && i != SERIAL) {
+            continue;
+        }
+        for (int c = 0; c < n_counts; c++) {
+            // 串行不受线程数影响，只跑一次
+            if (i == SERIAL && c > 0) {
+                times[i][c] = times[i][0];
+                continue;
+            }
+            double minT = 1e30;
+            for (int j = 0; j < num_timing_iterations; j++) {
+                ITaskSystem *t = selectTaskSystemRefImpl(thread_counts[c], (TaskSystemType) i, options);
+                TestResults result = test(t);
+                if (!result.passed) {
+                    printf("ERROR: Results did not pass correctness check! (iter=%d, ref_impl=%s, threads=%d)\n",
+                        j, t->name(), thread_counts[c]);
+                    exit(1);
+                }
+                names[i] = t->name();
+                minT = std::min(minT, result.time);
+                delete t;
+            }
+            times[i][c] = minT;
+        }
+    }
+
+    double serial = times[SERIAL][0];
+    printf("%-36s", "speedup (efficiency) / threads:");
+    for (int n : thread_counts) {
+        printf("%16d", n);
+    }
+    printf("\n");
+
+    std::string best_name;
+    int best_threads = 0;
+    double best_speedup = 0;
+    std::vector<std::string> flags;
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        if (names[i].empty() || (only_task_system >= 0 && i != only_task_system)) {
+            continue;
+        }
+        printf("%-36s", ("[" + names[i] + "]").c_str());
+        double max_speedup = 0;
+        bool collapsed = false;
+        // 串行只有一列
+        for (int c = 0; c < (i == SERIAL ? 1 : n_counts); c++) {
+            double speedup = serial / times[i][c];
+            double efficiency = speedup / thread_counts[c];
+            char cell[32];
+            snprintf(cell, sizeof(cell), "%.2fx (%3.0f%%)", speedup, efficiency * 100);
+            printf("%16s", cell);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%s,%d,%.6f,%.4f,%.4f\n", test_name.c_str(), names[i].c_str(),
+                        thread_counts[c], times[i][c] * 1000, speedup, efficiency);
+            }
+            if (speedup > best_speedup) {
+                best_speedup = speedup;
+                best_name = names[i];
+                best_threads = thread_counts[c];
+            }
+            max_speedup = std::max(max_speedup, speedup);
+
+            if (c > 0 && !collapsed) {
+                double prev_speedup = serial / times[i][c - 1];
+                double prev_efficiency = prev_speedup / thread_counts[c - 1];
+                if (efficiency < 0.5 * prev_efficiency && speedup <= prev_speedup) {
+                    char msg[256];
+                    snprintf(msg, sizeof(msg), "[%s]: efficiency collapses from %.0f%% at %d "
+                             "to %.0f%% at %d threads (%.2fx -> %.2fx)", names[i].c_str(),
+                             prev_efficiency * 100, thread_counts[c - 1], efficiency * 100,
+                             thread_counts[c], prev_speedup, speedup);
+                    flags.push_back(msg);
+                    collapsed = true;
+                }
+            }
+        }
+        printf("\n");
+        if (i != SERIAL && max_speedup < 1) {
+            flags.push_back("[" + names[i] + "]: never faster than serial");
+        }
+    }
+    for (const std::string& msg : flags) {
+        printf("  ! %s\n", msg.c_str());
+    }
+    printf("Best: [%s] at %d threads (%.2fx)\n", best_name.c_str(), best_threads, best_speedup);
+}
+
+// Long-running tests that "all" only includes with --soak.
+bool isSoakTest(const std::string& name) {
+    const std::string suffix = "_soak";
+    return name.size() >= suffix.size() &&
+           name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 int main(int argc, char** argv)
 {
-    const int n_tests = 29;
     int num_threads = DEFAULT_NUM_THREADS;
     int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
+    TaskSystemOptions options;
+    int only_task_system = -1;
+    bool launch_bench = false;
+    bool soak = false;
+    bool stats_mode = false;
+    StatsOptions stats = {DEFAULT_STATS_WARMUP, DEFAULT_STATS_MAX_RUNS,
+                          DEFAULT_STATS_CI_PCT / 100, DEFAULT_STATS_TIME_BUDGET_S};
+    const char* json_path = NULL;
+    const char* baseline_path = NULL;
+    double tolerance = DEFAULT_STATS_TOLERANCE_PCT / 100;
+    bool sweep_mode = false;
+    int sweep_max = std::max(1u, std::thread::hardware_concurrency());
+    const char* csv_path = NULL;
+#ifdef TASKSYS_HAS_GROUPS
+    bool tenant_bench = false;
+#endif
+#ifdef TASKSYS_HAS_WORK_STEALING
+    bool idle_bench = false;
+#endif
+#ifdef TASKSYS_HAS_PRIORITIES
+    bool ready_bench = false;
+#endif
+#ifdef TASKSYS_TRACE
+    const char* trace_path = NULL;
+#endif
 
-    TestResults (*test[n_tests])(ITaskSystem*) = {
+    TestResults (*test[])(ITaskSystem*) = {
         pingPongEqualTest,
         pingPongUnequalTest,
         superLightTest,
@@ -74,6 +616,7 @@ int main(int argc, char** argv)
         mathOperationsInTightForLoopFewerTasksAsyncTest,
         mathOperationsInTightForLoopFanInAsyncTest,
         mathOperationsInTightForLoopReductionTreeAsyncTest,
+        mathOperationsInTightForLoopParallelReduceTest,
         mandelbrotChunkedAsyncTest,
         spinBetweenRunCallsAsyncTest,
         simpleRunDepsTest,
@@ -81,9 +624,29 @@ int main(int argc, char** argv)
         strictGraphDepsSmall,
         strictGraphDepsMedium,
         strictGraphDepsLarge,
+        launchRecyclingSoakTest,
+        staleDependencySoakTest,
+        mixedLatencyWaitAnyTest,
+        mixedLatencySyncTest,
+        manyPipelinesAsyncTest,
+        cancelDependentsTest,
+        deadlineTest,
+        groupSyncTest,
+        criticalPathChainTest,
+#ifdef TASKSYS_HAS_COROUTINES
+        superLightCoroTest,
+        pingPongEqualCoroTest,
+        mathOperationsInTightForLoopCoroTest,
+        manyPipelinesCoroTest,
+#endif
+#ifdef TASKSYS_HAS_NESTED_LAUNCHES
+        nestedFibonacciTest,
+        nestedChainTest,
+#endif
     };
+    const int n_tests = sizeof(test) / sizeof(test[0]);
 
-    std::string test_names[n_tests] = {
+    std::string test_names[] = {
         "ping_pong_equal",
         "ping_pong_unequal",
         "super_light",
@@ -104,6 +667,7 @@ int main(int argc, char** argv)
         "math_operations_in_tight_for_loop_fewer_tasks_async",
         "math_operations_in_tight_for_loop_fan_in_async",
         "math_operations_in_tight_for_loop_reduction_tree_async",
+        "math_operations_in_tight_for_loop_parallel_reduce",
         "mandelbrot_chunked_async",
         "spin_between_run_calls_async",
         "simple_run_deps_test",
@@ -111,6 +675,25 @@ int main(int argc, char** argv)
         "strict_graph_deps_small_async",
         "strict_graph_deps_med_async",
         "strict_graph_deps_large_async",
+        "launch_recycling_soak",
+        "stale_dependency_soak",
+        "mixed_latency_wait_any",
+        "mixed_latency_sync",
+        "many_pipelines_async",
+        "cancel_dependents",
+        "deadline",
+        "group_sync",
+        "critical_path_chain",
+#ifdef TASKSYS_HAS_COROUTINES
+        "super_light_coro",
+        "ping_pong_equal_coro",
+        "math_operations_in_tight_for_loop_coro",
+        "many_pipelines_coro",
+#endif
+#ifdef TASKSYS_HAS_NESTED_LAUNCHES
+        "nested_fibonacci",
+        "nested_chain",
+#endif
     };
  
     // Parse commandline options
@@ -118,10 +701,36 @@ int main(int argc, char** argv)
     static struct option long_options[] = {
         {"num_threads",           1, 0,  'n'},
         {"num_timing_iterations", 1, 0,  'i'},
+        {"grain",                 1, 0,  'g'},
+        {"min_grain",             1, 0,  'm'},
+        {"task_system",           1, 0,  't'},
+        {"idle",                  1, 0,  'w'},
+        {"spin_us",               1, 0,  'S'},
+        {"yield_us",              1, 0,  'Y'},
+        {"placement",             1, 0,  'p'},
+        {"ready",                 1, 0,  'r'},
+        {"ready_bench",           0, 0,  'R'},
+        {"idle_bench",            0, 0,  'b'},
+        {"launch_bench",          0, 0,  'l'},
+        {"tenant_bench",          0, 0,  'T'},
+        {"stats",                 0, 0,  's'},
+        {"warmup",                1, 0,  'U'},
+        {"max_runs",              1, 0,  'M'},
+        {"ci",                    1, 0,  'C'},
+        {"time_budget",           1, 0,  'D'},
+        {"json",                  1, 0,  'J'},
+        {"baseline",              1, 0,  'B'},
+        {"tolerance",             1, 0,  'X'},
+        {"sweep",                 0, 0,  'e'},
+        {"sweep_max",             1, 0,  'E'},
+        {"csv",                   1, 0,  'V'},
+        {"trace",                 1, 0,  'o'},
+        {"soak",                  0, 0,  'K'},
         {"help",                  0, 0,  '?'},
+        {0,                       0, 0,   0 },
     };
 
-    while ((opt = getopt_long(argc, argv, "n:i:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "n:i:g:m:t:p:blso:?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 'n':
@@ -130,6 +739,125 @@ int main(int argc, char** argv)
         case 'i':
             num_timing_iterations = atoi(optarg);
             break;
+        case 'g':
+            if (strcmp(optarg, "single") == 0) {
+                options.grain_mode = GRAIN_SINGLE;
+            } else if (strcmp(optarg, "guided") == 0) {
+                options.grain_mode = GRAIN_GUIDED;
+            } else {
+                fprintf(stderr, "Error: invalid grain mode %s!\n", optarg);
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+        case 'm':
+            options.min_grain = atoi(optarg);
+            break;
+        case 't':
+            only_task_system = atoi(optarg);
+            break;
+        case 'w':
+            if (strcmp(optarg, "spin") == 0) {
+                options.idle_mode = IDLE_SPIN;
+            } else if (strcmp(optarg, "park") == 0) {
+                options.idle_mode = IDLE_PARK;
+            } else if (strcmp(optarg, "hybrid") == 0) {
+                options.idle_mode = IDLE_HYBRID;
+            } else {
+                fprintf(stderr, "Error: invalid idle policy %s!\n", optarg);
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+        case 'S':
+            options.spin_us = atoi(optarg);
+            break;
+        case 'Y':
+            options.yield_us = atoi(optarg);
+            break;
+        case 'r':
+            if (strcmp(optarg, "fifo") == 0) {
+                options.ready_order = READY_FIFO;
+            } else if (strcmp(optarg, "critical_path") == 0) {
+                options.ready_order = READY_CRITICAL_PATH;
+            } else {
+                fprintf(stderr, "Error: invalid ready order %s!\n", optarg);
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+#ifdef TASKSYS_HAS_PRIORITIES
+        case 'R':
+            ready_bench = true;
+            break;
+#endif
+        case 'p':
+            if (strcmp(optarg, "compact") == 0) {
+                options.placement = PLACEMENT_COMPACT;
+            } else if (strcmp(optarg, "scatter") == 0) {
+                options.placement = PLACEMENT_SCATTER;
+            } else if (strcmp(optarg, "none") == 0) {
+                options.placement = PLACEMENT_NONE;
+            } else {
+                fprintf(stderr, "Error: invalid placement %s!\n", optarg);
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+        case 'l':
+            launch_bench = true;
+            break;
+        case 'K':
+            soak = true;
+            break;
+        case 's':
+            stats_mode = true;
+            break;
+        case 'U':
+            stats.warmup = atoi(optarg);
+            break;
+        case 'M':
+            stats.max_runs = std::max(1, atoi(optarg));
+            break;
+        case 'C':
+            stats.ci_target = atof(optarg) / 100;
+            break;
+        case 'D':
+            stats.time_budget_s = atof(optarg);
+            break;
+        case 'J':
+            json_path = optarg;
+            break;
+        case 'B':
+            baseline_path = optarg;
+            break;
+        case 'X':
+            tolerance = atof(optarg) / 100;
+            break;
+        case 'e':
+            sweep_mode = true;
+            break;
+        case 'E':
+            sweep_max = std::max(1, atoi(optarg));
+            break;
+        case 'V':
+            csv_path = optarg;
+            break;
+#ifdef TASKSYS_HAS_GROUPS
+        case 'T':
+            tenant_bench = true;
+            break;
+#endif
+#ifdef TASKSYS_HAS_WORK_STEALING
+        case 'b':
+            idle_bench = true;
+            break;
+#endif
+#ifdef TASKSYS_TRACE
+        case 'o':
+            trace_path = optarg;
+            break;
+#endif
         case '?':
         default:
             usage(argv[0], test_names, n_tests);
@@ -137,33 +865,112 @@ int main(int argc, char** argv)
         }
     }
 
+    if (launch_bench) {
+        runLaunchBenchmark(num_threads, only_task_system, options);
+        return 0;
+    }
+#ifdef TASKSYS_HAS_GROUPS
+    if (tenant_bench) {
+        runTenantBenchmark(num_threads, options);
+        return 0;
+    }
+#endif
+
+    if (soak) {
+        soak_launch_divisor = 1;
+    }
+
     if (optind + 1 > argc) {
         fprintf(stderr, "Error: missing test_name!\n");
         usage(argv[0], test_names, n_tests);
         return 1;
     }
 
-    std::string test_name = argv[optind];
-
-    bool found = false;
-    for (int test_id = 0; test_id < n_tests; test_id++) {
-        if (test_names[test_id].compare(test_name) != 0) {
+    std::vector<int> test_ids;
+    for (int a = optind; a < argc; a++) {
+        if (strcmp(argv[a], "all") == 0) {
+            for (int test_id = 0; test_id < n_tests; test_id++) {
+                if (!soak && isSoakTest(test_names[test_id])) {
+                    continue;
+                }
+                test_ids.push_back(test_id);
+            }
             continue;
         }
+        int test_id = 0;
+        while (test_id < n_tests && test_names[test_id].compare(argv[a]) != 0) {
+            test_id++;
+        }
+        if (test_id == n_tests) {
+            fprintf(stderr, "Error: invalid test_name %s!\n", argv[a]);
+            usage(argv[0], test_names, n_tests);
+            return 1;
+        }
+        test_ids.push_back(test_id);
+    }
 
-        found = true;
+    FILE* csv = NULL;
+    if (sweep_mode && csv_path != NULL) {
+        csv = fopen(csv_path, "w");
+        if (csv == NULL) {
+            fprintf(stderr, "Error: could not open %s!\n", csv_path);
+            return 1;
+        }
+        fprintf(csv, "test,task_system,num_threads,time_ms,speedup,efficiency\n");
+    }
+
+    std::vector<BenchRecord> records;
+    for (int test_id : test_ids) {
         printf("============================================================="
                "======================\n");
         printf("Test name: %s\n", test_names[test_id].c_str());
         printf("============================================================="
                "======================\n");
 
+        if (sweep_mode) {
+            runThreadSweep(test[test_id], test_names[test_id], sweepThreadCounts(sweep_max),
+                           only_task_system, num_timing_iterations, options, csv);
+            printf("============================================================="
+                   "======================\n");
+            continue;
+        }
+        if (stats_mode) {
+            runStatistical(test[test_id], test_names[test_id], num_threads, only_task_system,
+                           stats, options, &records);
+            printf("============================================================="
+                   "======================\n");
+            continue;
+        }
+#ifdef TASKSYS_HAS_WORK_STEALING
+        if (idle_bench) {
+            runIdleBenchmark(test[test_id], num_threads, num_timing_iterations, options);
+            printf("============================================================="
+                   "======================\n");
+            continue;
+        }
+#endif
+#ifdef TASKSYS_HAS_PRIORITIES
+        if (ready_bench) {
+            runReadyOrderBenchmark(test[test_id], num_threads, num_timing_iterations, options);
+            printf("============================================================="
+                   "======================\n");
+            continue;
+        }
+#endif
+
         for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+            if (only_task_system >= 0 && i != only_task_system) {
+                continue;
+            }
             double minT = 1e30;
             for (int j = 0; j < num_timing_iterations; j++) {
 
                 // Create a new task system
-                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i, options);
+#ifdef TASKSYS_TRACE
+                TRACE_SECTION(test_names[test_id] + " / " + t->name() +
+                              " / iter " + std::to_string(j));
+#endif
 
                 // Run test
                 TestResults result = test[test_id](t);
@@ -189,10 +996,38 @@ int main(int argc, char** argv)
         printf("============================================================="
                "======================\n");
     }
-    if (!found) {
-        fprintf(stderr, "Error: invalid test_name!\n");
-        usage(argv[0], test_names, n_tests);
-        return 1;
+
+    if (csv != NULL) {
+        fclose(csv);
+        printf("Wrote sweep results to %s\n", csv_path);
+    }
+
+#ifdef TASKSYS_TRACE
+    if (trace_path != NULL) {
+        if (!TRACE_EXPORT(trace_path)) {
+            fprintf(stderr, "Error: could not write trace to %s!\n", trace_path);
+            return 1;
+        }
+        printf("Wrote trace to %s\n", trace_path);
+    }
+#endif
+
+    if (stats_mode && json_path != NULL) {
+        if (!writeBenchJson(json_path, num_threads, records)) {
+            fprintf(stderr, "Error: could not write results to %s!\n", json_path);
+            return 1;
+        }
+        printf("Wrote results to %s\n", json_path);
+    }
+    if (stats_mode && baseline_path != NULL) {
+        int regressions = compareWithBaseline(records, baseline_path, num_threads, tolerance);
+        if (regressions < 0) {
+            return 1;
+        }
+        if (regressions > 0) {
+            printf("%d regression(s) against %s\n", regressions, baseline_path);
+            return 2;
+        }
     }
 
     return 0;
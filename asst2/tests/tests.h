@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <math.h>
@@ -6,9 +7,14 @@
 #include <thread>
 #include <atomic>
 #include <set>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 #include "CycleTimer.h"
 #include "itasksys.h"
+#include "coro.h"
+#include "parallel_algorithms.h"
 
 /*
 Sync tests
@@ -34,9 +40,42 @@ TestResults recursiveFibonacciAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t);
+TestResults mathOperationsInTightForLoopParallelReduceTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsAsyncTest(ITaskSystem *t);
 TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t);
 TestResults simpleRunDepsTest(ITaskSystem *t);
+
+Coroutine tests (C++20 builds only, see coro.h)
+===============================================
+TestResults superLightCoroTest(ITaskSystem *t);
+TestResults pingPongEqualCoroTest(ITaskSystem *t);
+TestResults mathOperationsInTightForLoopCoroTest(ITaskSystem* t);
+TestResults manyPipelinesCoroTest(ITaskSystem* t);
+TestResults manyPipelinesAsyncTest(ITaskSystem* t);
+
+Per-launch wait tests
+=====================
+TestResults mixedLatencyWaitAnyTest(ITaskSystem* t);
+TestResults mixedLatencySyncTest(ITaskSystem* t);
+
+Cancellation tests
+==================
+TestResults cancelDependentsTest(ITaskSystem* t);
+TestResults deadlineTest(ITaskSystem* t);
+
+Scheduling group tests
+======================
+TestResults groupSyncTest(ITaskSystem* t);
+
+Nested launch tests
+===================
+TestResults nestedFibonacciTest(ITaskSystem* t);
+TestResults nestedChainTest(ITaskSystem* t);
+
+Soak tests
+==========
+TestResults launchRecyclingSoakTest(ITaskSystem *t);
+TestResults staleDependencySoakTest(ITaskSystem *t);
 */
 
 /*
@@ -130,6 +169,66 @@ class RecursiveFibonacciTask: public IRunnable {
         }
 };
 
+/*
+ * Task i computes the (idx - step * i)-th fibonacci number into
+ * output[i].  Above `cutoff`, fib(n) is computed by a nested run() of two
+ * tasks for fib(n-1) and fib(n-2) on the same task system, so runTask()
+ * blocks on child launches like a divide-and-conquer algorithm would.
+ */
+class NestedFibonacciTask: public IRunnable {
+    public:
+        ITaskSystem* t_;
+        int idx_;
+        int step_;
+        int cutoff_;
+        int *output_;
+        NestedFibonacciTask(ITaskSystem* t, int idx, int step, int cutoff, int *output)
+            : t_(t), idx_(idx), step_(step), cutoff_(cutoff), output_(output) {}
+        ~NestedFibonacciTask() {}
+
+        int slowFn(int n) {
+            if (n < 2) return 1;
+            return slowFn(n-1) + slowFn(n-2);
+        }
+
+        int nestedFn(int n) {
+            if (n < cutoff_) return slowFn(n);
+            int child_output[2];
+            NestedFibonacciTask child(t_, n - 1, 1, cutoff_, child_output);
+            t_->run(&child, 2);
+            return child_output[0] + child_output[1];
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            output_[task_id] = nestedFn(idx_ - step_ * task_id);
+        }
+};
+
+/*
+ * Each task runs a chain of `depth_` nested single-task launches, each
+ * waiting on the next, and the innermost one counts itself in `leaves_`.
+ * One chain alone keeps `depth_` launches waiting at the same time, more
+ * than a task system that keeps a fixed number of launch records may have.
+ */
+class NestedChainTask: public IRunnable {
+    public:
+        ITaskSystem* t_;
+        int depth_;
+        std::atomic<int>* leaves_;
+        NestedChainTask(ITaskSystem* t, int depth, std::atomic<int>* leaves)
+            : t_(t), depth_(depth), leaves_(leaves) {}
+        ~NestedChainTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (depth_ == 0) {
+                (*leaves_)++;
+                return;
+            }
+            NestedChainTask child(t_, depth_ - 1, leaves_);
+            t_->run(&child, 1);
+        }
+};
+
 /*
  * Each task copies its task id into the output.
  */
@@ -142,6 +241,40 @@ class LightTask: public IRunnable {
         void runTask(int task_id, int num_total_tasks) {
             output_[task_id] = task_id;
         }
+
+        void runTasks(int begin, int end, int num_total_tasks) {
+            for (int i = begin; i < end; i++) {
+                output_[i] = i;
+            }
+        }
+};
+
+/*
+ * Each task does nothing, so a launch of EmptyTask measures only the
+ * overhead of the task system.
+ */
+class EmptyTask: public IRunnable {
+    public:
+        EmptyTask() {}
+        ~EmptyTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {}
+
+        void runTasks(int begin, int end, int num_total_tasks) {}
+};
+
+/*
+ * Each task increments a shared counter.
+ */
+class CountTask: public IRunnable {
+    public:
+        std::atomic<long> count_;
+        CountTask() : count_(0) {}
+        ~CountTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            count_++;
+        }
 };
 
 /*
@@ -338,6 +471,62 @@ class SleepTask: public IRunnable {
         }
 };
 
+/*
+ * Each task sleeps for the given number of microseconds, standing in for
+ * a long-running stage whose duration does not depend on the core count.
+ */
+class MicroSleepTask: public IRunnable {
+    public:
+        int sleep_us_;
+        MicroSleepTask(int sleep_us) : sleep_us_(sleep_us) {}
+        ~MicroSleepTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            std::this_thread::sleep_for(std::chrono::microseconds(sleep_us_));
+        }
+};
+
+/*
+ * Like MicroSleepTask, but counts how many of its tasks actually ran, so
+ * tests can tell which tasks a cancellation skipped.
+ */
+class CountingSleepTask: public IRunnable {
+    public:
+        int sleep_us_;
+        std::atomic<int> num_run_;
+        CountingSleepTask(int sleep_us) : sleep_us_(sleep_us), num_run_(0) {}
+        ~CountingSleepTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (sleep_us_ > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(sleep_us_));
+            }
+            num_run_++;
+        }
+};
+
+/*
+ * One sleeping link of a chain of single-task launches.  Each link checks
+ * that the links before it have already run, then advances the shared
+ * counter.
+ */
+class ChainLinkTask: public IRunnable {
+    public:
+        int index_;
+        int sleep_us_;
+        std::atomic<int>* next_;
+        bool in_order_;
+        ChainLinkTask(int index, int sleep_us, std::atomic<int>* next)
+            : index_(index), sleep_us_(sleep_us), next_(next), in_order_(true) {}
+        ~ChainLinkTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            std::this_thread::sleep_for(std::chrono::microseconds(sleep_us_));
+            in_order_ = next_->load() == index_;
+            (*next_)++;
+        }
+};
+
 /*
  * This task sets its "done" flag when the following conditions are met:
  *  - All dependencies have their "done" flag set prior to the first
@@ -406,8 +595,21 @@ class StrictDependencyTask: public IRunnable {
  * is non-trival and so there are benefits to a thread pool. The amount of
  * computation per task is controlled using `num_elements` and base_iters`.
  */
+#ifdef TASKSYS_HAS_COROUTINES
+/*
+ * Coroutine that awaits the given launches one after another, each with
+ * num_tasks tasks.  Used by the coroutine variants of the chain tests.
+ */
+Pipeline launchChainCoro(AsyncTaskSystem ts, std::vector<IRunnable*> runnables,
+                         int num_tasks) {
+    for (IRunnable* runnable : runnables) {
+        co_await ts.launch(runnable, num_tasks);
+    }
+}
+#endif
+
 TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
-                         int num_elements, int base_iters) {
+                         int num_elements, int base_iters, bool do_coro = false) {
 
     int num_tasks = 64;
     int num_bulk_task_launches = 400;   
@@ -438,21 +640,29 @@ TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
 
     // Run the test
     double start_time = CycleTimer::currentSeconds();
-    TaskID prev_task_id;
-    for (int i=0; i<num_bulk_task_launches; i++) {
-        if (do_async) {
-            std::vector<TaskID> deps;
-            if (i > 0) {
-                deps.push_back(prev_task_id);
+    if (do_coro) {
+#ifdef TASKSYS_HAS_COROUTINES
+        Pipeline chain = launchChainCoro(AsyncTaskSystem(t),
+            std::vector<IRunnable*>(runnables.begin(), runnables.end()), num_tasks);
+        t->sync();
+#endif
+    } else {
+        TaskID prev_task_id;
+        for (int i=0; i<num_bulk_task_launches; i++) {
+            if (do_async) {
+                std::vector<TaskID> deps;
+                if (i > 0) {
+                    deps.push_back(prev_task_id);
+                }
+                prev_task_id = t->runAsyncWithDeps(
+                    runnables[i], num_tasks, deps);
+            } else {
+                t->run(runnables[i], num_tasks);
             }
-            prev_task_id = t->runAsyncWithDeps(
-                runnables[i], num_tasks, deps);
-        } else {
-            t->run(runnables[i], num_tasks);
         }
+        if (do_async)
+            t->sync();
     }
-    if (do_async)
-        t->sync();
     double end_time = CycleTimer::currentSeconds();
 
     // Correctness validation
@@ -499,6 +709,12 @@ TestResults superSuperLightAsyncTest(ITaskSystem* t) {
     return pingPongTest(t, true, true, num_elements, base_iters);
 }
 
+TestResults superLightCoroTest(ITaskSystem* t) {
+    int num_elements = 32 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, true, true, num_elements, base_iters, true);
+}
+
 TestResults superLightTest(ITaskSystem* t) {
     int num_elements = 32 * 1024;
     int base_iters = 32;
@@ -517,6 +733,12 @@ TestResults pingPongEqualTest(ITaskSystem* t) {
     return pingPongTest(t, true, false, num_elements, base_iters);
 }
 
+TestResults pingPongEqualCoroTest(ITaskSystem* t) {
+    int num_elements = 512 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, true, true, num_elements, base_iters, true);
+}
+
 TestResults pingPongUnequalTest(ITaskSystem* t) {
     int num_elements = 512 * 1024;
     int base_iters = 32;
@@ -605,7 +827,8 @@ TestResults recursiveFibonacciAsyncTest(ITaskSystem* t) {
  * new threads with every bulk task launch.
  */
 TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
-                                                 bool run_with_dependencies, bool do_async) {
+                                                 bool run_with_dependencies, bool do_async,
+                                                 bool do_coro = false) {
 
     int num_bulk_task_launches = 2000;
 
@@ -623,7 +846,16 @@ TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
     }
 
     double start_time = CycleTimer::currentSeconds();
-    if (do_async) {
+    if (do_coro) {
+#ifdef TASKSYS_HAS_COROUTINES
+        std::vector<IRunnable*> runnables;
+        for (auto& task : medium_tasks) {
+            runnables.push_back(&task);
+        }
+        Pipeline chain = launchChainCoro(AsyncTaskSystem(t), runnables, num_tasks);
+        t->sync();
+#endif
+    } else if (do_async) {
         if (run_with_dependencies) {
             TaskID prev_task_id;
             for (int i = 0; i < num_bulk_task_launches; i++) {
@@ -683,6 +915,10 @@ TestResults mathOperationsInTightForLoopAsyncTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopTestBase(t, 16, true, true);
 }
 
+TestResults mathOperationsInTightForLoopCoroTest(ITaskSystem* t) {
+    return mathOperationsInTightForLoopTestBase(t, 16, true, true, true);
+}
+
 TestResults mathOperationsInTightForLoopFewerTasksTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopTestBase(t, 9, false, false);
 }
@@ -918,6 +1154,60 @@ TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopReductionTreeTestBase(t, true);
 }
 
+/*
+ * Computation: the same result as the reduction tree tests, written as a
+ * single parallel_reduce() over every element of every one of the
+ * num_bulk_task_launches arrays.  Each worker adds the elements it claims
+ * straight into its own accumulator array, so the intermediate buffers
+ * and the launches of the reduction tree disappear.
+ */
+TestResults mathOperationsInTightForLoopParallelReduceTest(ITaskSystem* t) {
+
+    int num_tasks = 64;
+    int num_bulk_task_launches = 32;
+    int array_size = 16384;
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<float> sum = parallel_reduce(t,
+        IndexRange(0, num_bulk_task_launches * array_size, array_size / num_tasks),
+        std::vector<float>(array_size, 0.f),
+        [=](std::vector<float>& acc, int idx) {
+            int i = idx % array_size;
+            float output = 0.0;
+            for (int j = 1; j < 151; j++) {
+                float val;
+                if (i % 3 == 0) {
+                    val = exp(j / 100.);
+                } else if (i % 3 == 1) {
+                    val = log(j * 2.);
+                } else {
+                    val = j * 6;
+                }
+                output += val;
+            }
+            acc[i] += output;
+        },
+        [=](std::vector<float>& acc, const std::vector<float>& other) {
+            for (int i = 0; i < array_size; i++) {
+                acc[i] += other[i];
+            }
+        });
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < array_size; i++) {
+        int expected = i % 3 == 0 ? 11197 :
+                       i % 3 == 1 ? 22687 : 67950 * num_bulk_task_launches;
+        if (std::floor(sum[i]) != expected) {
+            printf("%d: %f expected=%d\n", i, std::floor(sum[i]), expected);
+            result.passed = false;
+        }
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
 /*
  * Computation: In between two calls to a light weight task, these tests spawn
  * a medium weight bulk task launch that only has enough enough tasks to
@@ -1225,3 +1515,572 @@ TestResults strictGraphDepsMedium(ITaskSystem* t) {
 TestResults strictGraphDepsLarge(ITaskSystem* t) {
     return strictGraphDepsTestBase(t,1000,20000,0);
 }
+
+/*
+ * Latency tests: a chain of long launches is interleaved with independent
+ * short launches.  The consumer reads each short launch's output as soon
+ * as it can, either by waitAny() on the short launches still pending or
+ * by a single sync().  The reported time is the mean latency from
+ * submitting a short launch to consuming its output, so the gap between
+ * the two tests is the gain from not waiting on unrelated launches.
+ */
+TestResults mixedLatencyTestBase(ITaskSystem* t, bool use_wait) {
+
+    int num_pairs = 16;
+    int num_long_tasks = 16;
+    int long_task_us = 2000;
+    int num_short_tasks = 64;
+
+    MicroSleepTask long_task(long_task_us);
+    std::vector<int*> outputs(num_pairs);
+    std::vector<LightTask*> short_tasks(num_pairs);
+    for (int i = 0; i < num_pairs; i++) {
+        outputs[i] = new int[num_short_tasks]();
+        short_tasks[i] = new LightTask(outputs[i]);
+    }
+
+    std::vector<TaskID> short_ids(num_pairs);
+    std::vector<double> submit_times(num_pairs);
+    std::vector<TaskID> no_deps;
+    TaskID last_long = -1;
+
+    for (int i = 0; i < num_pairs; i++) {
+        std::vector<TaskID> long_deps;
+        if (i > 0) {
+            long_deps.push_back(last_long);
+        }
+        last_long = t->runAsyncWithDeps(&long_task, num_long_tasks, long_deps);
+        submit_times[i] = CycleTimer::currentSeconds();
+        short_ids[i] = t->runAsyncWithDeps(short_tasks[i], num_short_tasks, no_deps);
+    }
+
+    // Consume the short launches in the order they complete.
+    TestResults result;
+    result.passed = true;
+    double total_latency = 0;
+    std::vector<TaskID> pending = short_ids;
+    if (!use_wait) {
+        t->sync();
+    }
+    while (!pending.empty()) {
+        TaskID done = use_wait ? t->waitAny(pending) : pending.back();
+        double latency = CycleTimer::currentSeconds();
+        pending.erase(std::find(pending.begin(), pending.end(), done));
+
+        int i = std::find(short_ids.begin(), short_ids.end(), done) - short_ids.begin();
+        total_latency += latency - submit_times[i];
+        for (int j = 0; j < num_short_tasks; j++) {
+            if (outputs[i][j] != j) {
+                result.passed = false;
+            }
+        }
+    }
+    if (use_wait) {
+        t->wait(last_long);
+        t->sync();
+    }
+    result.time = total_latency / num_pairs;
+
+    for (int i = 0; i < num_pairs; i++) {
+        delete short_tasks[i];
+        delete [] outputs[i];
+    }
+    return result;
+}
+
+TestResults mixedLatencyWaitAnyTest(ITaskSystem* t) {
+    return mixedLatencyTestBase(t, true);
+}
+
+TestResults mixedLatencySyncTest(ITaskSystem* t) {
+    return mixedLatencyTestBase(t, false);
+}
+
+/*
+ * Computation: a chain head -> mid -> tail of sleeping launches, plus an
+ * independent launch.  The head is cancelled right after it is submitted,
+ * and then one more launch that depends on it is submitted.  Its
+ * dependents must not run a single task, the independent launch must run
+ * completely, and sync() must report exactly the skipped launches.  Task
+ * systems without cancellation (cancel() returns false) must run
+ * everything and report nothing.
+ */
+TestResults cancelDependentsTest(ITaskSystem* t) {
+
+    int num_tasks = 256;
+    CountingSleepTask head(500);
+    CountingSleepTask mid(0);
+    CountingSleepTask tail(0);
+    CountingSleepTask late(0);
+    CountingSleepTask other(0);
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> no_deps;
+    TaskID head_id = t->runAsyncWithDeps(&head, num_tasks, no_deps);
+    TaskID mid_id = t->runAsyncWithDeps(&mid, num_tasks, std::vector<TaskID>(1, head_id));
+    TaskID tail_id = t->runAsyncWithDeps(&tail, num_tasks, std::vector<TaskID>(1, mid_id));
+    t->runAsyncWithDeps(&other, num_tasks, no_deps);
+    bool cancelled = t->cancel(head_id);
+    TaskID late_id = t->runAsyncWithDeps(&late, num_tasks, std::vector<TaskID>(1, head_id));
+    std::vector<TaskID> reported;
+    t->sync(&reported);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = other.num_run_ == num_tasks;
+    std::sort(reported.begin(), reported.end());
+    if (cancelled) {
+        std::vector<TaskID> expected = {head_id, mid_id, tail_id, late_id};
+        std::sort(expected.begin(), expected.end());
+        if (mid.num_run_ != 0 || tail.num_run_ != 0 || late.num_run_ != 0 ||
+            reported != expected) {
+            printf("cancelled launches ran %d/%d/%d tasks, %d reported\n",
+                   (int)mid.num_run_, (int)tail.num_run_, (int)late.num_run_,
+                   (int)reported.size());
+            result.passed = false;
+        }
+    } else {
+        if (head.num_run_ != num_tasks || mid.num_run_ != num_tasks ||
+            tail.num_run_ != num_tasks || late.num_run_ != num_tasks || !reported.empty()) {
+            result.passed = false;
+        }
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Computation: a launch of sleeping tasks that would take far longer than
+ * its deadline, followed by a dependent launch.  Once the deadline
+ * expires, workers must stop picking up its tasks, the dependent must be
+ * skipped, and sync() must report both.  The reported time is how long
+ * sync() took, i.e. the deadline plus the tasks that were already running
+ * when it expired.
+ */
+TestResults deadlineTest(ITaskSystem* t) {
+
+    int num_tasks = 400;
+    int deadline_ms = 10;
+    CountingSleepTask slow(1000);
+    CountingSleepTask dependent(0);
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID slow_id = t->runAsyncWithDeps(&slow, num_tasks, std::vector<TaskID>());
+    bool has_deadline = t->setDeadline(slow_id,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms));
+    TaskID dependent_id = t->runAsyncWithDeps(&dependent, num_tasks,
+                                              std::vector<TaskID>(1, slow_id));
+    std::vector<TaskID> reported;
+    t->sync(&reported);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    std::sort(reported.begin(), reported.end());
+    if (has_deadline) {
+        std::vector<TaskID> expected = {slow_id, dependent_id};
+        std::sort(expected.begin(), expected.end());
+        if (slow.num_run_ == num_tasks || dependent.num_run_ != 0 || reported != expected) {
+            printf("expired launch ran %d tasks, dependent ran %d, %d reported\n",
+                   (int)slow.num_run_, (int)dependent.num_run_, (int)reported.size());
+            result.passed = false;
+        }
+    } else if (slow.num_run_ != num_tasks || dependent.num_run_ != num_tasks ||
+               !reported.empty()) {
+        result.passed = false;
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Computation: a "batch" group submits a few launches of slow sleeping
+ * tasks, then an "interactive" group with three times its weight submits
+ * a few launches of empty tasks.  syncGroup() on the interactive group
+ * must return with all of its launches complete, and sync() must then
+ * finish the batch group.  The reported time is how long the interactive
+ * group took, which stays small when groups share the workers fairly
+ * instead of queueing behind the batch launches.
+ */
+TestResults groupSyncTest(ITaskSystem* t) {
+
+    int num_launches = 4;
+    int num_batch_tasks = 128;
+    int num_interactive_tasks = 64;
+    int batch = t->createGroup("batch", 1);
+    int interactive = t->createGroup("interactive", 3);
+
+    std::vector<CountingSleepTask*> batch_tasks;
+    std::vector<CountingSleepTask*> interactive_tasks;
+    std::vector<TaskID> no_deps;
+    for (int i = 0; i < num_launches; i++) {
+        batch_tasks.push_back(new CountingSleepTask(500));
+        t->runAsyncInGroup(batch, batch_tasks.back(), num_batch_tasks, no_deps);
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_launches; i++) {
+        interactive_tasks.push_back(new CountingSleepTask(0));
+        t->runAsyncInGroup(interactive, interactive_tasks.back(), num_interactive_tasks, no_deps);
+    }
+    t->syncGroup(interactive);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_launches; i++) {
+        if (interactive_tasks[i]->num_run_ != num_interactive_tasks) {
+            result.passed = false;
+        }
+    }
+    t->sync();
+    for (int i = 0; i < num_launches; i++) {
+        if (batch_tasks[i]->num_run_ != num_batch_tasks) {
+            result.passed = false;
+        }
+        delete batch_tasks[i];
+        delete interactive_tasks[i];
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+#ifdef TASKSYS_HAS_COROUTINES
+/*
+ * One logical pipeline of the many-pipelines tests: each stage is a
+ * launch that depends on the previous stage.
+ */
+Pipeline lightStagesCoro(AsyncTaskSystem ts, std::vector<IRunnable*> stages, int num_tasks) {
+    TaskID prev = -1;
+    for (IRunnable* stage : stages) {
+        std::vector<TaskID> deps;
+        if (prev >= 0) {
+            deps.push_back(prev);
+        }
+        prev = co_await ts.launch(stage, num_tasks, deps);
+    }
+}
+#endif
+
+/*
+ * Computation: a batch of independent sleeping launches, followed by a
+ * long chain of single-task sleeping launches that is submitted one link
+ * at a time.  The chain's first link is already ready when the rest of
+ * the chain arrives, so only a ready order that re-ranks it as the chain
+ * grows starts the chain before the batch.  Running the chain alongside
+ * the batch takes about (batch + chain) / num_threads sleeps; running it
+ * after the batch adds the whole chain on top.
+ */
+TestResults criticalPathChainTest(ITaskSystem* t) {
+
+    int num_fillers = 40;
+    int filler_tasks = 4;
+    int chain_length = 20;
+    int sleep_us = 2000;
+
+    CountingSleepTask filler(sleep_us);
+    std::atomic<int> next(0);
+    std::vector<ChainLinkTask*> links;
+    for (int i = 0; i < chain_length; i++) {
+        links.push_back(new ChainLinkTask(i, sleep_us, &next));
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> no_deps;
+    for (int i = 0; i < num_fillers; i++) {
+        t->runAsyncWithDeps(&filler, filler_tasks, no_deps);
+    }
+    TaskID prev_task_id = t->runAsyncWithDeps(links[0], 1, no_deps);
+    for (int i = 1; i < chain_length; i++) {
+        prev_task_id = t->runAsyncWithDeps(links[i], 1, std::vector<TaskID>(1, prev_task_id));
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = filler.num_run_ == num_fillers * filler_tasks && next == chain_length;
+    for (int i = 0; i < chain_length; i++) {
+        if (!links[i]->in_order_) {
+            printf("chain link %d ran out of order\n", i);
+            result.passed = false;
+        }
+        delete links[i];
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Computation: many independent pipelines, each a short chain of light
+ * launches, share one task system.  The async variant chains the stages
+ * with runAsyncWithDeps(); the coroutine variant runs every pipeline as a
+ * coroutine that co_awaits each stage, so the difference is the cost of
+ * suspending and resuming coroutines on the workers.
+ */
+TestResults manyPipelinesTestBase(ITaskSystem* t, bool do_coro) {
+
+    int num_pipelines = 1000;
+    int num_stages = 4;
+    int num_tasks = 16;
+
+    std::vector<int*> outputs(num_pipelines * num_stages);
+    std::vector<IRunnable*> stages(num_pipelines * num_stages);
+    for (int i = 0; i < num_pipelines * num_stages; i++) {
+        outputs[i] = new int[num_tasks]();
+        stages[i] = new LightTask(outputs[i]);
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    if (do_coro) {
+#ifdef TASKSYS_HAS_COROUTINES
+        std::vector<Pipeline> pipelines;
+        for (int p = 0; p < num_pipelines; p++) {
+            pipelines.push_back(lightStagesCoro(AsyncTaskSystem(t),
+                std::vector<IRunnable*>(stages.begin() + p * num_stages,
+                                        stages.begin() + (p + 1) * num_stages),
+                num_tasks));
+        }
+        t->sync();
+#endif
+    } else {
+        for (int p = 0; p < num_pipelines; p++) {
+            std::vector<TaskID> deps;
+            for (int s = 0; s < num_stages; s++) {
+                TaskID id = t->runAsyncWithDeps(stages[p * num_stages + s], num_tasks, deps);
+                deps.assign(1, id);
+            }
+        }
+        t->sync();
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_pipelines * num_stages; i++) {
+        for (int j = 0; j < num_tasks; j++) {
+            if (outputs[i][j] != j) {
+                result.passed = false;
+            }
+        }
+    }
+    result.time = end_time - start_time;
+
+    for (int i = 0; i < num_pipelines * num_stages; i++) {
+        delete stages[i];
+        delete [] outputs[i];
+    }
+    return result;
+}
+
+TestResults manyPipelinesAsyncTest(ITaskSystem* t) {
+    return manyPipelinesTestBase(t, false);
+}
+
+TestResults manyPipelinesCoroTest(ITaskSystem* t) {
+    return manyPipelinesTestBase(t, true);
+}
+
+/*
+ * Computation: like the recursive fibonacci tests, but the recursion
+ * above a cutoff is expressed as nested run() calls from inside
+ * runTask(), so the task system must make progress on child launches
+ * while their parent tasks wait.
+ */
+TestResults nestedFibonacciTest(ITaskSystem* t) {
+
+    int num_tasks = 64;
+    int fib_index = 25;
+    int cutoff = 15;
+
+    int* task_output = new int[num_tasks]();
+    NestedFibonacciTask root(t, fib_index, 0, cutoff, task_output);
+
+    double start_time = CycleTimer::currentSeconds();
+    t->run(&root, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_tasks; i++) {
+        if (task_output[i] != 121393) {
+            printf("%d\n", task_output[i]);
+            result.passed = false;
+            break;
+        }
+    }
+    result.time = end_time - start_time;
+
+    delete [] task_output;
+    return result;
+}
+
+TestResults nestedChainTest(ITaskSystem* t) {
+
+    int num_tasks = 64;
+    int depth = 48;
+
+    std::atomic<int> leaves(0);
+    NestedChainTask root(t, depth, &leaves);
+
+    double start_time = CycleTimer::currentSeconds();
+    t->run(&root, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = leaves.load() == num_tasks;
+    if (!result.passed) {
+        printf("%d leaves\n", leaves.load());
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Resident set size of this process in bytes, or 0 where it cannot be read.
+ */
+static long residentSetBytes() {
+#ifdef __linux__
+    long total_pages = 0, resident_pages = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fscanf(f, "%ld %ld", &total_pages, &resident_pages) != 2) {
+        resident_pages = 0;
+    }
+    fclose(f);
+    return resident_pages * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * The soak tests are not part of "all".  Run by name they submit a tenth
+ * of their full number of launches; --soak selects the full size, which
+ * takes minutes per task system on small hosts.
+ */
+static long soak_launch_divisor = 10;
+
+/*
+ * Soak test: pushes num_launches tiny bulk launches through the task
+ * system, in dependency chains of `chain_length` launches followed by a
+ * sync(). Each launch depends on its predecessor in the chain and on a
+ * launch of the previous chain, which has completed by then, so task systems
+ * that recycle TaskIDs see stale ids as dependencies. The test fails if the
+ * resident set grows by more than `max_growth_bytes` between the end of the
+ * warmup (the first tenth of the launches) and the end of the run, i.e. if
+ * the task system keeps state per launch forever.
+ *
+ * At full size (--soak) this test submits 10M launches; use -t to run it
+ * on a single task system.
+ */
+TestResults launchRecyclingSoakTestBase(ITaskSystem* t, long num_launches,
+                                        int chain_length, long max_growth_bytes) {
+    CountTask count_task;
+    long warm_rss = 0;
+    long warmup_launches = num_launches / 10;
+    TaskID prev_chain_task_id = -1;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (long i = 0; i < num_launches; i += chain_length) {
+        TaskID prev_task_id = -1;
+        TaskID first_task_id = -1;
+        for (int j = 0; j < chain_length; j++) {
+            std::vector<TaskID> deps;
+            if (prev_task_id >= 0) {
+                deps.push_back(prev_task_id);
+            }
+            if (prev_chain_task_id >= 0) {
+                deps.push_back(prev_chain_task_id);
+            }
+            prev_task_id = t->runAsyncWithDeps(&count_task, 2, deps);
+            if (j == 0) {
+                first_task_id = prev_task_id;
+            }
+        }
+        t->sync();
+        prev_chain_task_id = first_task_id;
+
+        if (warm_rss == 0 && i + chain_length >= warmup_launches) {
+            warm_rss = residentSetBytes();
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    long final_rss = residentSetBytes();
+
+    TestResults result;
+    long num_run = (num_launches + chain_length - 1) / chain_length * chain_length;
+    result.passed = count_task.count_ == 2 * num_run;
+    if (!result.passed) {
+        printf("ran %ld tasks, expected %ld\n", (long)count_task.count_, 2 * num_run);
+    }
+    if (final_rss - warm_rss > max_growth_bytes) {
+        printf("resident set grew from %.1f MB to %.1f MB\n",
+               warm_rss / 1e6, final_rss / 1e6);
+        result.passed = false;
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+TestResults launchRecyclingSoakTest(ITaskSystem* t) {
+    return launchRecyclingSoakTestBase(t, 10 * 1000 * 1000 / soak_launch_divisor,
+                                       64, 16 * 1024 * 1024);
+}
+
+/*
+ * Soak test: like launchRecyclingSoakTest, but every launch also depends
+ * on the TaskID of the very first launch, which finished long ago, and
+ * sync() is never called: each chain is awaited with wait() on its last
+ * launch.  A task system whose TaskIDs wrap lets that old id name a later
+ * launch, which can then depend on itself and hang; one that frees launch
+ * records only in sync() fails the resident set check.
+ *
+ * At full size (--soak) this test submits 4M launches; use -t to run it
+ * on a single task system.
+ */
+TestResults staleDependencySoakTest(ITaskSystem* t) {
+    const long num_launches = 4 * 1000 * 1000 / soak_launch_divisor;
+    const int chain_length = 64;
+    const long max_growth_bytes = 16 * 1024 * 1024;
+    CountTask count_task;
+    long warm_rss = 0;
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID first_task_id = t->runAsyncWithDeps(&count_task, 2, std::vector<TaskID>());
+    t->wait(first_task_id);
+    for (long i = 0; i < num_launches; i += chain_length) {
+        TaskID prev_task_id = -1;
+        for (int j = 0; j < chain_length; j++) {
+            std::vector<TaskID> deps(1, first_task_id);
+            if (prev_task_id >= 0) {
+                deps.push_back(prev_task_id);
+            }
+            prev_task_id = t->runAsyncWithDeps(&count_task, 2, deps);
+        }
+        t->wait(prev_task_id);
+
+        if (warm_rss == 0 && i + chain_length >= num_launches / 10) {
+            warm_rss = residentSetBytes();
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    long final_rss = residentSetBytes();
+    t->sync();
+
+    TestResults result;
+    long num_run = 1 + (num_launches + chain_length - 1) / chain_length * chain_length;
+    result.passed = count_task.count_ == 2 * num_run;
+    if (!result.passed) {
+        printf("ran %ld tasks, expected %ld\n", (long)count_task.count_, 2 * num_run);
+    }
+    if (final_rss - warm_rss > max_growth_bytes) {
+        printf("resident set grew from %.1f MB to %.1f MB\n",
+               warm_rss / 1e6, final_rss / 1e6);
+        result.passed = false;
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
@@ -5,9 +5,11 @@
 #include <string.h>
 #include <cstddef>
 #include <omp.h>
+#include <algorithm>
 
 #include "../common/CycleTimer.h"
 #include "../common/graph.h"
+#include "../common/compressed_graph.h"
 
 #define ROOT_NODE_ID 0
 #define NOT_VISITED_MARKER -1
@@ -30,24 +32,27 @@ void vertex_set_free(vertex_set* list) {
 // Take one step of "top-down" BFS.  For each vertex on the frontier,
 // follow all outgoing edges, and add all neighboring vertices to the
 // new_frontier.
+template <typename G>
 void top_down_step(
-    Graph g,
+    G* g,
     vertex_set* frontier,
     vertex_set* new_frontier,
     int* distances)
 {
+    typedef typename G::offset_type Offset;
 
     #pragma omp parallel  // 分配若干个线程
     {
         // 每个线程拥有一份变量
         vertex_set local_list;
-        vertex_set_init(&local_list, g->num_edges);
+        // 每个顶点在一步里最多被一个线程加入一次
+        vertex_set_init(&local_list, g->num_nodes);
 
         #pragma omp for // 将下面的for循环的任务分配个不同的线程处理
         for (int i=0; i<frontier->count; i++) {
             int node = frontier->vertices[i];
-            int start_edge = g->outgoing_starts[node];
-            int end_edge = (node == g->num_nodes - 1)
+            Offset start_edge = g->outgoing_starts[node];
+            Offset end_edge = (node == g->num_nodes - 1)
                             ? g->num_edges
                             : g->outgoing_starts[node + 1];
 
@@ -55,7 +60,7 @@ void top_down_step(
             // #pragma omp parallel for
 
             int new_dis = distances[node] + 1;
-            for (int neighbor=start_edge; neighbor<end_edge; neighbor++) {
+            for (Offset neighbor=start_edge; neighbor<end_edge; neighbor++) {
                 int outgoing = g->outgoing_edges[neighbor];
                 if (distances[outgoing] == NOT_VISITED_MARKER && __sync_bool_compare_and_swap(&distances[outgoing], NOT_VISITED_MARKER, new_dis)) {  // 如果当前线程更新了的话，就加入到本线程的队列中
                     local_list.vertices[local_list.count++] = outgoing;
@@ -74,11 +79,43 @@ void top_down_step(
     }
 }
 
+// Top-down step on compressed adjacency lists, decoding each frontier
+// vertex's outgoing list as it is walked.
+void top_down_step(
+    CompressedGraph g,
+    vertex_set* frontier,
+    vertex_set* new_frontier,
+    int* distances)
+{
+    #pragma omp parallel
+    {
+        vertex_set local_list;
+        vertex_set_init(&local_list, g->num_nodes);
+
+        #pragma omp for
+        for (int i=0; i<frontier->count; i++) {
+            int node = frontier->vertices[i];
+            int new_dis = distances[node] + 1;
+            for (Vertex outgoing : outgoing_neighbors(g, node)) {
+                if (distances[outgoing] == NOT_VISITED_MARKER && __sync_bool_compare_and_swap(&distances[outgoing], NOT_VISITED_MARKER, new_dis)) {
+                    local_list.vertices[local_list.count++] = outgoing;
+                }
+            }
+        }
+
+        int start_idx = __sync_fetch_and_add(&new_frontier->count, local_list.count);
+        memcpy(new_frontier->vertices + start_idx, local_list.vertices, sizeof(int) * local_list.count);
+        vertex_set_free(&local_list);
+    }
+}
+
 // Implements top-down BFS.
 //
 // Result of execution is that, for each node in the graph, the
 // distance to the root is stored in sol.distances.
-void bfs_top_down(Graph graph, solution* sol) {
+template <typename G>
+static void bfs_top_down_impl(G* graph, solution* sol)
+{
 
     vertex_set list1;
     vertex_set list2;
@@ -119,8 +156,9 @@ void bfs_top_down(Graph graph, solution* sol) {
     }
 }
 
+template <typename G>
 void bottom_up_step(
-    Graph g,
+    G* g,
     vertex_set* frontier,
     vertex_set* new_frontier,
     int* distances) {
@@ -133,7 +171,7 @@ void bottom_up_step(
     {
 
         vertex_set list;
-        vertex_set_init(&list, g->num_edges);
+        vertex_set_init(&list, g->num_nodes);
 
         #pragma omp for schedule(dynamic, 200)
         for (int i = 0; i < g->num_nodes; ++i) {
@@ -171,7 +209,63 @@ void bottom_up_step(
 }
 
 
-void bfs_bottom_up(Graph graph, solution* sol)
+// Bottom-up step on compressed adjacency lists.  Vertices are handed out
+// in chunks of whole index blocks.  Within a chunk the incoming lists are
+// walked in order, but only as far as the next unvisited vertex, jumping
+// through the block index over blocks that have none.
+void bottom_up_step(
+    CompressedGraph g,
+    vertex_set* frontier,
+    vertex_set* new_frontier,
+    int* distances) {
+
+    const int chunk = 16 * COMPRESSED_BLOCK_SIZE;
+    int num_chunks = (g->num_nodes + chunk - 1) / chunk;
+    int cur_dis = distances[frontier->vertices[0]];
+    int dis_plus_1 = cur_dis + 1;
+
+    #pragma omp parallel
+    {
+        vertex_set list;
+        vertex_set_init(&list, g->num_nodes);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int c = 0; c < num_chunks; ++c) {
+            int begin = c * chunk;
+            int end = std::min(g->num_nodes, begin + chunk);
+            // p is the start of the list of vertex at
+            const uint8_t* p = NULL;
+            int at = begin;
+            for (int i = begin; i < end; ++i) {
+                if (distances[i] != NOT_VISITED_MARKER)
+                    continue;
+                if (p == NULL || i / COMPRESSED_BLOCK_SIZE != at / COMPRESSED_BLOCK_SIZE) {
+                    at = i - i % COMPRESSED_BLOCK_SIZE;
+                    p = g->incoming.data + g->incoming.block_offsets[at / COMPRESSED_BLOCK_SIZE];
+                }
+                for (; at < i; at++)
+                    p = compressed_skip(p);
+                compressed_list in(p, i);
+                p = in.next();
+                at = i + 1;
+                for (Vertex fa : in) {
+                    if (distances[fa] == cur_dis) {
+                        list.vertices[list.count++] = i;
+                        distances[i] = dis_plus_1;
+                        break;
+                    }
+                }
+            }
+        }
+
+        int start_idx = __sync_fetch_and_add(&new_frontier->count, list.count);
+        memcpy(new_frontier->vertices + start_idx, list.vertices, sizeof(int) * list.count);
+        vertex_set_free(&list);
+    }
+}
+
+template <typename G>
+static void bfs_bottom_up_impl(G* graph, solution* sol)
 {
     // CS149 students:
     //
@@ -224,7 +318,8 @@ void bfs_bottom_up(Graph graph, solution* sol)
 
 }
 
-void bfs_hybrid(Graph graph, solution* sol)
+template <typename G>
+static void bfs_hybrid_impl(G* graph, solution* sol)
 {
     // CS149 students:
     //
@@ -275,3 +370,16 @@ void bfs_hybrid(Graph graph, solution* sol)
         new_frontier = tmp;
     }
 }
+
+void bfs_top_down(Graph graph, solution* sol) { bfs_top_down_impl(graph, sol); }
+void bfs_top_down(Graph64 graph, solution* sol) { bfs_top_down_impl(graph, sol); }
+
+void bfs_bottom_up(Graph graph, solution* sol) { bfs_bottom_up_impl(graph, sol); }
+void bfs_bottom_up(Graph64 graph, solution* sol) { bfs_bottom_up_impl(graph, sol); }
+
+void bfs_hybrid(Graph graph, solution* sol) { bfs_hybrid_impl(graph, sol); }
+void bfs_hybrid(Graph64 graph, solution* sol) { bfs_hybrid_impl(graph, sol); }
+
+void bfs_top_down(CompressedGraph graph, solution* sol) { bfs_top_down_impl(graph, sol); }
+void bfs_bottom_up(CompressedGraph graph, solution* sol) { bfs_bottom_up_impl(graph, sol); }
+void bfs_hybrid(CompressedGraph graph, solution* sol) { bfs_hybrid_impl(graph, sol); }
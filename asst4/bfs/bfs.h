@@ -4,6 +4,7 @@
 //#define DEBUG
 
 #include "common/graph.h"
+#include "common/compressed_graph.h"
 #include <stdlib.h>
 
 struct solution
@@ -25,4 +26,14 @@ void bfs_top_down(Graph graph, solution* sol);
 void bfs_bottom_up(Graph graph, solution* sol);
 void bfs_hybrid(Graph graph, solution* sol);
 
+// Same, for graphs with 64-bit edge offsets
+void bfs_top_down(Graph64 graph, solution* sol);
+void bfs_bottom_up(Graph64 graph, solution* sol);
+void bfs_hybrid(Graph64 graph, solution* sol);
+
+// Same, on compressed adjacency lists (see common/compressed_graph.h)
+void bfs_top_down(CompressedGraph graph, solution* sol);
+void bfs_bottom_up(CompressedGraph graph, solution* sol);
+void bfs_hybrid(CompressedGraph graph, solution* sol);
+
 #endif
@@ -41,7 +41,7 @@ graph* load_graph(std::string graph_filename) {
         g = load_graph(graph_filename);
         printf("storing binary form of graph!\n");
         store_graph_binary(graph_filename.append(".bin").c_str(), g);
-        delete g;
+        free_graph(g);
         exit(1);
     }
     return g;
@@ -301,7 +301,7 @@ int main(int argc, char** argv) {
         graph* g = load_graph(graph_dir + '/' + graph_name);
         std::cout << "\nGraph: " << graph_name << std::endl;
         run_on_graph(idx, g, num_threads, num_runs, graph_name, scores);    
-        delete g;
+        free_graph(g);
         idx++;
     }
 
@@ -3,6 +3,7 @@
 #include <omp.h>
 #include <string>
 #include <getopt.h>
+#include <climits>
 
 #include <iostream>
 #include <sstream>
@@ -18,16 +19,156 @@ void reference_bfs_bottom_up(Graph graph, solution* sol);
 void reference_bfs_top_down(Graph graph, solution* sol);
 void reference_bfs_hybrid(Graph graph, solution* sol);
 
+// Runs the three searches on a graph stored with 64-bit edge offsets.
+// The reference implementations only take 32-bit graphs, so if the edge
+// count fits in an int the results are checked against the reference on
+// a 32-bit copy; otherwise the three searches are checked against each
+// other.
+int run_graph64(const char* filename, int thread_count) {
+
+    Graph64 g = load_graph64_binary(filename);
+    printf("\n");
+    printf("Graph stats (64-bit offsets):\n");
+    printf("  Edges: %lld\n", (long long) g->num_edges);
+    printf("  Nodes: %d\n", g->num_nodes);
+
+    if (thread_count > 0)
+        omp_set_num_threads(thread_count);
+
+    const char* names[3] = { "Top Down", "Bottom Up", "Hybrid" };
+    void (*searches[3])(Graph64, solution*) = { bfs_top_down, bfs_bottom_up, bfs_hybrid };
+    solution sols[3];
+    double times[3];
+
+    for (int k=0; k<3; k++) {
+        sols[k].distances = (int*)malloc(sizeof(int) * g->num_nodes);
+        double start = CycleTimer::currentSeconds();
+        searches[k](g, &sols[k]);
+        times[k] = CycleTimer::currentSeconds() - start;
+    }
+
+    solution ref;
+    ref.distances = sols[0].distances;
+    if (g->num_edges <= INT_MAX) {
+        Graph g32 = load_graph_binary(filename);
+        ref.distances = (int*)malloc(sizeof(int) * g32->num_nodes);
+        reference_bfs_top_down(g32, &ref);
+        free_graph(g32);
+    }
+
+    bool correct = true;
+    for (int k=0; k<3; k++) {
+        std::cout << "Testing Correctness of " << names[k] << "\n";
+        for (int j=0; j<g->num_nodes; j++) {
+            if (sols[k].distances[j] != ref.distances[j]) {
+                fprintf(stderr, "*** Results disagree at %d: %d, %d\n", j, sols[k].distances[j], ref.distances[j]);
+                std::cout << names[k] << " Search is not Correct" << std::endl;
+                correct = false;
+                break;
+            }
+        }
+    }
+
+    printf("----------------------------------------------------------\n");
+    std::cout << "Your Code: Timing Summary" << std::endl;
+    std::cout << "Threads  Top Down          Bottom Up         Hybrid\n";
+    printf("%4d:     %8.2f     %8.2f     %8.2f\n",
+           omp_get_max_threads(), times[0], times[1], times[2]);
+    printf("----------------------------------------------------------\n");
+
+    free_graph(g);
+    return correct ? 0 : 1;
+}
+
+// Runs the three searches on plain CSR and on compressed adjacency lists
+// (see common/compressed_graph.h), and reports memory per edge and time
+// for both.
+int run_compressed(Graph g, int thread_count) {
+
+    if (thread_count > 0)
+        omp_set_num_threads(thread_count);
+
+    double start = CycleTimer::currentSeconds();
+    CompressedGraph cg = compress_graph(g);
+    double compress_time = CycleTimer::currentSeconds() - start;
+
+    // plain CSR: a 4-byte start per vertex and a 4-byte id per edge
+    double plain_bytes = 4.0 * ((double) g->num_nodes + g->num_edges);
+    printf("----------------------------------------------------------\n");
+    printf("Compressed in %.2f sec\n", compress_time);
+    printf("Bytes/edge         Plain CSR   Compressed\n");
+    printf("  Outgoing:       %8.2f     %8.2f\n",
+           plain_bytes / g->num_edges, (double) compressed_bytes(cg, &cg->outgoing) / g->num_edges);
+    printf("  Incoming:       %8.2f     %8.2f\n",
+           plain_bytes / g->num_edges, (double) compressed_bytes(cg, &cg->incoming) / g->num_edges);
+
+    const char* names[3] = { "Top Down", "Bottom Up", "Hybrid" };
+    void (*plain[3])(Graph, solution*) = { bfs_top_down, bfs_bottom_up, bfs_hybrid };
+    void (*compressed[3])(CompressedGraph, solution*) = { bfs_top_down, bfs_bottom_up, bfs_hybrid };
+    double plain_time[3], compressed_time[3];
+    solution plain_sol, compressed_sol;
+    plain_sol.distances = (int*)malloc(sizeof(int) * g->num_nodes);
+    compressed_sol.distances = (int*)malloc(sizeof(int) * g->num_nodes);
+
+    bool correct = true;
+    for (int k=0; k<3; k++) {
+        start = CycleTimer::currentSeconds();
+        plain[k](g, &plain_sol);
+        plain_time[k] = CycleTimer::currentSeconds() - start;
+
+        start = CycleTimer::currentSeconds();
+        compressed[k](cg, &compressed_sol);
+        compressed_time[k] = CycleTimer::currentSeconds() - start;
+
+        std::cout << "Testing Correctness of Compressed " << names[k] << "\n";
+        for (int j=0; j<g->num_nodes; j++) {
+            if (plain_sol.distances[j] != compressed_sol.distances[j]) {
+                fprintf(stderr, "*** Results disagree at %d: %d, %d\n", j, plain_sol.distances[j], compressed_sol.distances[j]);
+                std::cout << "Compressed " << names[k] << " Search is not Correct" << std::endl;
+                correct = false;
+                break;
+            }
+        }
+    }
+
+    printf("----------------------------------------------------------\n");
+    std::cout << "Timing Summary (" << omp_get_max_threads() << " threads)" << std::endl;
+    std::cout << "               Top Down    Bottom Up       Hybrid\n";
+    printf("Plain CSR:     %8.2f     %8.2f     %8.2f\n", plain_time[0], plain_time[1], plain_time[2]);
+    printf("Compressed:    %8.2f     %8.2f     %8.2f\n", compressed_time[0], compressed_time[1], compressed_time[2]);
+    printf("Slowdown:      %7.2fx     %7.2fx     %7.2fx\n",
+           compressed_time[0] / plain_time[0], compressed_time[1] / plain_time[1], compressed_time[2] / plain_time[2]);
+    printf("----------------------------------------------------------\n");
+
+    free(plain_sol.distances);
+    free(compressed_sol.distances);
+    free_compressed_graph(cg);
+    return correct ? 0 : 1;
+}
+
 int main(int argc, char** argv) {
 
     int  num_threads = -1;
     std::string graph_filename;
 
+    // --compressed may come anywhere; take it out before the positional args
+    bool use_compressed = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--compressed") {
+            use_compressed = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            break;
+        }
+    }
+
     if (argc < 2)
     {
-        std::cerr << "Usage: <path/to/graph/file> [num_threads]\n";
+        std::cerr << "Usage: <path/to/graph/file> [num_threads] [--compressed]\n";
         std::cerr << "  To run results for all thread counts: <path/to/graph/file>\n";
         std::cerr << "  Run with a certain number of threads (no correctness run): <path/to/graph/file> <num_threads>\n";
+        std::cerr << "  Compare plain and compressed adjacency lists: add --compressed\n";
         exit(1);
     }
 
@@ -51,13 +192,16 @@ int main(int argc, char** argv) {
     printf("----------------------------------------------------------\n");
 
     printf("Loading graph...\n");
+    if (USE_BINARY_GRAPH && graph_file_offset_bits(graph_filename.c_str()) == 64) {
+        return run_graph64(graph_filename.c_str(), thread_count);
+    }
     if (USE_BINARY_GRAPH) {
       g = load_graph_binary(graph_filename.c_str());
     } else {
         g = load_graph(argv[1]);
         printf("storing binary form of graph!\n");
         store_graph_binary(graph_filename.append(".bin").c_str(), g);
-        delete g;
+        free_graph(g);
         exit(1);
     }
     printf("\n");
@@ -65,6 +209,12 @@ int main(int argc, char** argv) {
     printf("  Edges: %d\n", g->num_edges);
     printf("  Nodes: %d\n", g->num_nodes);
 
+    if (use_compressed) {
+        int status = run_compressed(g, thread_count);
+        free_graph(g);
+        return status;
+    }
+
     //If we want to run on all threads
     if (thread_count <= -1)
     {
@@ -333,7 +483,7 @@ int main(int argc, char** argv) {
         printf("----------------------------------------------------------\n");
     }
 
-    delete g;
+    free_graph(g);
 
     return 0;
 }
@@ -0,0 +1,185 @@
+#ifndef __COMPRESSED_GRAPH_H__
+#define __COMPRESSED_GRAPH_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "graph.h"
+
+/* Compressed adjacency lists.
+ *
+ * Each vertex's neighbors are sorted and stored as:
+ *
+ *   degree                         varint
+ *   payload_bytes                  varint, only if degree > 0
+ *   zigzag(first neighbor - v)     varint          \
+ *   gaps to the next neighbors     group varint     > payload
+ *
+ * A varint has 7 bits per byte, with the high bit set on all but the last
+ * byte.  Group varint stores up to four gaps behind one control byte that
+ * gives each gap's length (1-4 bytes, two bits per gap), so decoding a
+ * group takes no data-dependent branches.  The data array is padded so
+ * that a 4-byte load at any gap stays in bounds.
+ *
+ * Lists are stored back to back in vertex order.  block_offsets[b] is
+ * the byte offset of the list of vertex b * COMPRESSED_BLOCK_SIZE, so
+ * finding a vertex's list takes one index lookup plus skipping at most
+ * COMPRESSED_BLOCK_SIZE-1 lists, each by its header alone.  Walking
+ * vertices in order needs no lookups at all: a list's next() is where
+ * the following vertex's list starts. */
+
+#define COMPRESSED_BLOCK_SIZE 16
+
+struct compressed_adjacency
+{
+    int64_t* block_offsets;  // one per block, plus the total size
+    uint8_t* data;
+};
+
+struct compressed_graph
+{
+    int num_edges;
+    int num_nodes;
+
+    compressed_adjacency outgoing;
+    compressed_adjacency incoming;
+};
+
+using CompressedGraph = compressed_graph*;
+
+/* Builds the compressed form of both edge directions of g. */
+CompressedGraph compress_graph(const graph* g);
+void free_compressed_graph(CompressedGraph);
+
+/* Bytes taken by one direction, including its block index. */
+int64_t compressed_bytes(const compressed_graph*, const compressed_adjacency*);
+
+
+static inline uint64_t decode_varint(const uint8_t** p)
+{
+    const uint8_t* q = *p;
+    uint64_t value = *q++;
+    if (value >= 0x80) {
+        value &= 0x7f;
+        int shift = 7;
+        uint64_t byte;
+        do {
+            byte = *q++;
+            value |= (byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte >= 0x80);
+    }
+    *p = q;
+    return value;
+}
+
+// Decodes the next group of `count` (1-4) gaps at *p into gaps[].
+static inline void decode_group(const uint8_t** p, int count, uint32_t* gaps)
+{
+    static const uint32_t mask[4] = { 0xff, 0xffff, 0xffffff, 0xffffffff };
+    const uint8_t* q = *p;
+    unsigned control = *q++;
+    for (int k = 0; k < count; k++) {
+        unsigned length = (control >> (2 * k)) & 3;
+        uint32_t gap;
+        memcpy(&gap, q, 4);
+        gaps[k] = gap & mask[length];
+        q += length + 1;
+    }
+    *p = q;
+}
+
+// Neighbors of one vertex, decoded as they are iterated:
+//
+//   for (Vertex u : outgoing_neighbors(cg, v)) ...
+class compressed_list
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(const uint8_t* p, int remaining, Vertex value)
+            : p_(p), remaining_(remaining), value_(value), next_gap_(4) {}
+
+        Vertex operator*() const { return value_; }
+
+        iterator& operator++() {
+            if (--remaining_ > 0) {
+                if (next_gap_ == 4) {
+                    decode_group(&p_, remaining_ < 4 ? remaining_ : 4, gaps_);
+                    next_gap_ = 0;
+                }
+                value_ += (Vertex) gaps_[next_gap_++];
+            }
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const { return remaining_ != other.remaining_; }
+
+    private:
+        const uint8_t* p_;
+        int remaining_;
+        Vertex value_;
+        int next_gap_;
+        uint32_t gaps_[4];
+    };
+
+    // p is the start of the list of vertex v
+    compressed_list(const uint8_t* p, Vertex v) {
+        size_ = (int) decode_varint(&p);
+        if (size_ == 0) {
+            payload_ = next_ = p;
+            first_ = 0;
+            return;
+        }
+        uint64_t bytes = decode_varint(&p);
+        next_ = p + bytes;
+        uint64_t zigzag = decode_varint(&p);
+        first_ = v + (Vertex) ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+        payload_ = p;
+    }
+
+    int size() const { return size_; }
+    iterator begin() const { return iterator(payload_, size_, first_); }
+    iterator end() const { return iterator(next_, 0, 0); }
+
+    // start of the next vertex's list
+    const uint8_t* next() const { return next_; }
+
+private:
+    const uint8_t* payload_;  // after the first neighbor
+    const uint8_t* next_;
+    int size_;
+    Vertex first_;
+};
+
+// Start of the list after the one at p, read from its header alone.
+static inline const uint8_t* compressed_skip(const uint8_t* p)
+{
+    if (decode_varint(&p) != 0) {
+        uint64_t bytes = decode_varint(&p);
+        p += bytes;
+    }
+    return p;
+}
+
+// Start of the list of vertex v.
+static inline const uint8_t* compressed_seek(const compressed_adjacency* adj, Vertex v)
+{
+    const uint8_t* p = adj->data + adj->block_offsets[v / COMPRESSED_BLOCK_SIZE];
+    for (int skip = v % COMPRESSED_BLOCK_SIZE; skip > 0; skip--)
+        p = compressed_skip(p);
+    return p;
+}
+
+static inline compressed_list outgoing_neighbors(const compressed_graph* g, Vertex v)
+{
+    return compressed_list(compressed_seek(&g->outgoing, v), v);
+}
+
+static inline compressed_list incoming_neighbors(const compressed_graph* g, Vertex v)
+{
+    return compressed_list(compressed_seek(&g->incoming, v), v);
+}
+
+#endif // __COMPRESSED_GRAPH_H__
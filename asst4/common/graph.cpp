@@ -1,17 +1,69 @@
 #include <string>
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <vector>
 #include <cstdlib>
-
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CycleTimer.h"
 #include "graph.h"
 #include "graph_internal.h"
+#include "compressed_graph.h"
 
 #define GRAPH_HEADER_TOKEN ((int) 0xDEADBEEF)
-
-
-void free_graph(Graph graph)
+// 64-bit binary format, see open_graph_binary()
+#define GRAPH_HEADER_TOKEN_V2 ((int) 0xDEADBEF2)
+
+// Memory-mapped format (store_graph_mmap() / load_graph_mmap()).  The
+// header fills the first page; each section starts on its own page.
+#define GRAPH_MMAP_MAGIC     0x48505247u  // "GRPH"
+#define GRAPH_MMAP_VERSION   1
+// same layout with int64_t starts sections, for graph64
+#define GRAPH_MMAP_VERSION_64 2
+#define GRAPH_MMAP_ALIGNMENT 4096
+
+enum graph_section {
+    SECTION_OUTGOING_STARTS,
+    SECTION_OUTGOING_EDGES,
+    SECTION_INCOMING_STARTS,
+    SECTION_INCOMING_EDGES,
+    NUM_SECTIONS
+};
+
+struct graph_file_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_bytes;     // sizeof(graph_file_header)
+    uint32_t alignment;        // sections start at multiples of this
+    int64_t num_nodes;
+    int64_t num_edges;
+    uint64_t section_offset[NUM_SECTIONS];
+    uint64_t section_bytes[NUM_SECTIONS];
+    uint64_t section_checksum[NUM_SECTIONS];
+    uint64_t header_checksum;  // of all fields above
+};
+
+
+template <typename G>
+static void free_graph_arrays(G* graph)
 {
+  if (graph->mapping) {
+    munmap(graph->mapping, graph->mapping_bytes);
+    free(graph);
+    return;
+  }
+
   free(graph->outgoing_starts);
   free(graph->outgoing_edges);
 
@@ -20,167 +72,303 @@ void free_graph(Graph graph)
   free(graph);
 }
 
-
-void build_start(graph* graph, int* scratch)
+void free_graph(Graph graph)
 {
-  int num_nodes = graph->num_nodes;
-  graph->outgoing_starts = (int*)malloc(sizeof(int) * num_nodes);
-  for(int i = 0; i < num_nodes; i++)
-  {
-    graph->outgoing_starts[i] = scratch[i];
-  }
+  free_graph_arrays(graph);
 }
 
-void build_edges(graph* graph, int* scratch)
+void free_graph(Graph64 graph)
 {
-  int num_nodes = graph->num_nodes;
-  graph->outgoing_edges = (int*)malloc(sizeof(int) * graph->num_edges);
-  for(int i = 0; i < graph->num_edges; i++)
-  {
-    graph->outgoing_edges[i] = scratch[num_nodes + i];
-  }
+  free_graph_arrays(graph);
 }
 
-// Given an outgoing edge adjacency list representation for a directed
-// graph, build an incoming adjacency list representation
-void build_incoming_edges(graph* graph) {
-
-    //printf("Beginning build_incoming... (%d nodes)\n", graph->num_nodes);
 
+// Given an outgoing edge adjacency list representation for a directed
+// graph, build an incoming adjacency list representation.
+//
+// Runs in parallel when compiled with OpenMP.  Source vertices are split
+// into one contiguous range per thread with about the same number of
+// edges.  The threads count in-degrees into one shared array with atomic
+// adds, a blocked prefix sum turns the counts into incoming_starts, and
+// the same array then serves as a per-target write cursor for the
+// scatter.  Threads interleave within an incoming list, so each list is
+// sorted by source afterwards, giving the same order as the serial
+// scatter.  Lists that came out in order are only checked, and a single
+// thread skips the atomics and the sort.  Scratch space is num_nodes
+// offsets, whatever the number of threads.
+template <typename G>
+static void build_incoming_edges_impl(G* graph) {
+
+    typedef typename G::offset_type Offset;
     int num_nodes = graph->num_nodes;
-    int* node_counts = (int*)malloc(sizeof(int) * num_nodes);
-    int* node_scatter = (int*)malloc(sizeof(int) * num_nodes);
-
-    graph->incoming_starts = (int*)malloc(sizeof(int) * num_nodes);
-    graph->incoming_edges = (int*)malloc(sizeof(int) * graph->num_edges);
-
-    for (int i=0; i<num_nodes; i++)
-        node_counts[i] = node_scatter[i] = 0;
-
-    int total_edges = 0;
-    // compute number of incoming edges per node
-    for (int i=0; i<num_nodes; i++) {
-        int start_edge = graph->outgoing_starts[i];
-        int end_edge = (i == graph->num_nodes-1) ? graph->num_edges : graph->outgoing_starts[i+1];
-        for (int j=start_edge; j<end_edge; j++) {
-            int target_node = graph->outgoing_edges[j];
-            node_counts[target_node]++;
-            total_edges++;
-        }
-    }
-    //printf("Total edges: %d\n", total_edges);
-    //printf("Computed incoming edge counts.\n");
-
-    // build the starts array
-    graph->incoming_starts[0] = 0;
-    for (int i=1; i<num_nodes; i++) {
-        graph->incoming_starts[i] = graph->incoming_starts[i-1] + node_counts[i-1];
-        //printf("%d: %d ", i, graph->incoming_starts[i]);
+    Offset num_edges = graph->num_edges;
+
+    graph->incoming_starts = (Offset*)malloc(sizeof(Offset) * num_nodes);
+    graph->incoming_edges = (Vertex*)malloc(sizeof(Vertex) * num_edges);
+    if (num_nodes == 0)
+        return;
+
+#ifdef _OPENMP
+    int num_threads = omp_get_max_threads();
+#else
+    int num_threads = 1;
+#endif
+
+    // source range [range_start[t], range_start[t+1]) belongs to thread t
+    int* range_start = (int*)malloc(sizeof(int) * (num_threads + 1));
+    for (int t=0; t<num_threads; t++) {
+        Offset target_edge = (int64_t)num_edges * t / num_threads;
+        range_start[t] = std::lower_bound(graph->outgoing_starts, graph->outgoing_starts + num_nodes,
+                                          target_edge) - graph->outgoing_starts;
     }
-    //printf("\n");
-    //printf("Last edge=%d\n", graph->incoming_starts[num_nodes-1] + node_counts[num_nodes-1]);
-
-    //printf("Computed per-node incoming starts.\n");
-
-    // now perform the scatter
-    for (int i=0; i<num_nodes; i++) {
-        int start_edge = graph->outgoing_starts[i];
-        int end_edge = (i == graph->num_nodes-1) ? graph->num_edges : graph->outgoing_starts[i+1];
-        for (int j=start_edge; j<end_edge; j++) {
-            int target_node = graph->outgoing_edges[j];
-            graph->incoming_edges[graph->incoming_starts[target_node] + node_scatter[target_node]] = i;
-            node_scatter[target_node]++;
+    range_start[num_threads] = num_nodes;
+
+    // in-degree of each target, then the next free slot of its list
+    Offset* cursor = (Offset*)malloc(sizeof(Offset) * num_nodes);
+    // per-thread sums of in-degree over a block of targets, for the prefix sum
+    int64_t* block_sums = (int64_t*)malloc(sizeof(int64_t) * (num_threads + 1));
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+#ifdef _OPENMP
+        int tid = omp_get_thread_num();
+        int team = omp_get_num_threads();
+#else
+        int tid = 0;
+        int team = 1;
+#endif
+        // the runtime may give us fewer threads than asked for
+        int first_range = (long)num_threads * tid / team;
+        int last_range = (long)num_threads * (tid + 1) / team;
+        int block_begin = (long)num_nodes * tid / team;
+        int block_end = (long)num_nodes * (tid + 1) / team;
+
+        for (int v=block_begin; v<block_end; v++)
+            cursor[v] = 0;
+        #pragma omp barrier
+
+        // count in-degrees
+        for (int i=range_start[first_range]; i<range_start[last_range]; i++) {
+            Offset start_edge = graph->outgoing_starts[i];
+            Offset end_edge = (i == num_nodes-1) ? num_edges : graph->outgoing_starts[i+1];
+            for (Offset j=start_edge; j<end_edge; j++) {
+                if (team == 1) {
+                    cursor[graph->outgoing_edges[j]]++;
+                } else {
+                    #pragma omp atomic
+                    cursor[graph->outgoing_edges[j]]++;
+                }
+            }
         }
-    }
-
-    /*
-    // verify
-    printf("Verifying graph...\n");
+        #pragma omp barrier
 
-    for (int i=0; i<num_nodes; i++) {
-        int outgoing_starts = graph->outgoing_starts[i];
-        int end_node = (i == graph->num_nodes-1) ? graph->num_edges : graph->outgoing_starts[i+1];
-        for (int j=outgoing_starts; j<end_node; j++) {
+        // sum this thread's block of in-degrees
+        int64_t block_sum = 0;
+        for (int v=block_begin; v<block_end; v++)
+            block_sum += cursor[v];
+        block_sums[tid + 1] = block_sum;
+        #pragma omp barrier
 
-            bool verified = false;
+        #pragma omp single
+        {
+            block_sums[0] = 0;
+            for (int t=1; t<=team; t++)
+                block_sums[t] += block_sums[t-1];
+        }
 
-            // make sure that i is a neighbor of target_node
-            int target_node = graph->outgoing_edges[j];
-            int j_start_edge = graph->incoming_starts[target_node];
-            int j_end_edge = (target_node == graph->num_nodes-1) ? graph->num_edges : graph->incoming_starts[target_node+1];
-            for (int k=j_start_edge; k<j_end_edge; k++) {
-                if (graph->incoming_edges[k] == i) {
-                    verified = true;
-                    break;
+        // exclusive prefix sum of in-degrees within the block
+        int64_t running = block_sums[tid];
+        for (int v=block_begin; v<block_end; v++) {
+            Offset degree = cursor[v];
+            graph->incoming_starts[v] = running;
+            cursor[v] = running;
+            running += degree;
+        }
+        #pragma omp barrier
+
+        // scatter: claim the next slot of each target's list.  On x86 each
+        // atomic is a full fence, so slots are claimed a batch at a time
+        // and the batch's writes, which mostly miss in cache, overlap.
+        const int kBatch = 64;
+        Offset slots[kBatch];
+        Vertex sources[kBatch];
+        int batched = 0;
+        for (int i=range_start[first_range]; i<range_start[last_range]; i++) {
+            Offset start_edge = graph->outgoing_starts[i];
+            Offset end_edge = (i == num_nodes-1) ? num_edges : graph->outgoing_starts[i+1];
+            for (Offset j=start_edge; j<end_edge; j++) {
+                int target_node = graph->outgoing_edges[j];
+                if (team == 1) {
+                    graph->incoming_edges[cursor[target_node]++] = i;
+                    continue;
+                }
+                #pragma omp atomic capture
+                slots[batched] = cursor[target_node]++;
+                sources[batched++] = i;
+                if (batched == kBatch) {
+                    for (int k=0; k<kBatch; k++)
+                        graph->incoming_edges[slots[k]] = sources[k];
+                    batched = 0;
                 }
             }
-
-            if (!verified) {
-                fprintf(stderr,"Error: %d,%d did not verify\n", i, target_node);
+        }
+        for (int k=0; k<batched; k++)
+            graph->incoming_edges[slots[k]] = sources[k];
+        #pragma omp barrier
+
+        // restore source order within lists that several threads wrote to
+        if (team > 1) {
+            #pragma omp for schedule(dynamic, 1024)
+            for (int v=0; v<num_nodes; v++) {
+                Vertex* begin = graph->incoming_edges + graph->incoming_starts[v];
+                Vertex* end = graph->incoming_edges + cursor[v];
+                if (!std::is_sorted(begin, end))
+                    std::sort(begin, end);
             }
         }
     }
 
-    printf("Done verifying\n");
-    */
-
-    free(node_counts);
-    free(node_scatter);
+    free(range_start);
+    free(cursor);
+    free(block_sums);
 }
 
-void get_meta_data(std::ifstream& file, graph* graph)
+void build_incoming_edges(Graph graph)
 {
-  // going back to the beginning of the file
-  file.clear();
-  file.seekg(0, std::ios::beg);
-  std::string buffer;
-  std::getline(file, buffer);
-  if ((buffer.compare(std::string("AdjacencyGraph"))))
-  {
-    std::cout << "Invalid input file" << buffer << std::endl;
-    exit(1);
-  }
-  buffer.clear();
+    build_incoming_edges_impl(graph);
+}
 
-  do {
-      std::getline(file, buffer);
-  } while (buffer.size() == 0 || buffer[0] == '#');
+void build_incoming_edges(Graph64 graph)
+{
+    build_incoming_edges_impl(graph);
+}
 
-  graph->num_nodes = atoi(buffer.c_str());
-  buffer.clear();
+static inline bool is_digit(char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
 
-  do {
-      std::getline(file, buffer);
-  } while (buffer.size() == 0 || buffer[0] == '#');
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-  graph->num_edges = atoi(buffer.c_str());
+// Returns the position after the next newline at or after p, or end.
+static inline const char* skip_line(const char* p, const char* end)
+{
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
 
+// Counts the leading ASCII digits of the 8 bytes at p (up to 8) and
+// stores their value, eight characters at a time instead of one.
+static inline int scan_digits8(const char* p, uint64_t* value)
+{
+    uint64_t x;
+    memcpy(&x, p, 8);
+    // digit characters become 0..9; the lowest byte with its high bit
+    // set in non_digit is exactly the first non-digit
+    x ^= 0x3030303030303030ULL;
+    uint64_t non_digit = ((x + 0x7676767676767676ULL) | x) & 0x8080808080808080ULL;
+    int n = non_digit ? __builtin_ctzll(non_digit) >> 3 : 8;
+    if (n == 0) {
+        *value = 0;
+        return 0;
+    }
+    // move the digits to the top so the cleared low bytes act as leading
+    // zeros, then combine pairs of digits, pairs of pairs, and so on
+    x <<= 8 * (8 - n);
+    x = ((x & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    x = ((x & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    x = ((x & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+    *value = x;
+    return n;
 }
 
-void read_graph_file(std::ifstream& file, int* scratch)
+// Scans the integers in [p, end), which starts at a line start.  Follows
+// the original stream-based reader: lines starting with '#' are skipped,
+// and a token that is not an integer ends its line.  When STORE is set,
+// the value with index k (counting from first_index) is written to
+// outgoing_starts[k] for k < num_nodes and to outgoing_edges otherwise.
+// Returns the number of integers found.
+template <bool STORE, typename G>
+static long scan_values(const char* p, const char* end, const char* map_end,
+                        long first_index, G* graph)
 {
-  std::string buffer;
-  int idx = 0;
-  while(!file.eof())
-  {
-    buffer.clear();
-    std::getline(file, buffer);
+    static const uint64_t pow10[9] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+    };
+    long index = first_index;
+
+    while (p < end) {
+        if (*p == '#') {
+            p = skip_line(p, end);
+            continue;
+        }
+        while (true) {
+            while (p < end && is_blank(*p))
+                p++;
+            if (p == end)
+                break;
+            if (*p == '\n') {
+                p++;
+                break;
+            }
 
-    if (buffer.size() > 0 && buffer[0] == '#')
-        continue;
+            bool negative = (*p == '-');
+            if ((*p == '-' || *p == '+') && p + 1 < end)
+                p++;
+            if (!is_digit(*p)) {
+                p = skip_line(p, end);
+                break;
+            }
 
-    std::stringstream parse(buffer);
-    while (!parse.fail()) {
-        int v;
-        parse >> v;
-        if (parse.fail())
-        {
-            break;
+            // a number always ends before `end`, which follows a newline
+            // or is the end of the file, so reading ahead up to map_end
+            // never runs past the chunk's own digits
+            uint64_t v = 0;
+            while (map_end - p >= 8) {
+                uint64_t digits;
+                int n = scan_digits8(p, &digits);
+                v = v * pow10[n] + digits;
+                p += n;
+                if (n < 8)
+                    break;
+            }
+            if (map_end - p < 8) {
+                while (p < end && is_digit(*p))
+                    v = v * 10 + (*p++ - '0');
+            }
+
+            if (STORE) {
+                int64_t value = negative ? -(int64_t)v : (int64_t)v;
+                if (index < graph->num_nodes)
+                    graph->outgoing_starts[index] = (typename G::offset_type) value;
+                else
+                    graph->outgoing_edges[index - graph->num_nodes] = (Vertex) value;
+            }
+            index++;
+
+            if (p < end && !is_blank(*p) && *p != '\n') {
+                p = skip_line(p, end);
+                break;
+            }
         }
-        scratch[idx] = v;
-        idx++;
     }
-  }
+    return index - first_index;
+}
+
+// Reads the next line that is neither empty nor a comment, as an integer.
+static int64_t read_header_value(const char** p, const char* end, const char* filename)
+{
+    while (*p < end) {
+        const char* line = *p;
+        *p = skip_line(line, end);
+        if (*line != '\n' && *line != '\r' && *line != '#')
+            return strtoll(std::string(line, *p - line).c_str(), NULL, 10);
+    }
+    fprintf(stderr, "Invalid input file: %s\n", filename);
+    exit(1);
 }
 
 void print_graph(const graph* graph)
@@ -212,21 +400,100 @@ void print_graph(const graph* graph)
     }
 }
 
-Graph load_graph(const char* filename)
+template <typename G>
+static G* load_graph_text(const char* filename, double* parse_seconds)
 {
-  graph* graph = (struct graph*)(malloc(sizeof(struct graph)));
+  typedef typename G::offset_type Offset;
+  double start_time = CycleTimer::currentSeconds();
+
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Could not open: %s\n", filename);
+    exit(1);
+  }
+  size_t file_bytes = st.st_size;
+  void* mapping = file_bytes ? mmap(NULL, file_bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Invalid input file: %s\n", filename);
+    exit(1);
+  }
+
+  const char* text = (const char*) mapping;
+  const char* text_end = text + file_bytes;
+
+  const char* p = text;
+  const char* first_line_end = skip_line(p, text_end);
+  std::string first_line(p, first_line_end - p);
+  while (!first_line.empty() && (first_line.back() == '\n' || first_line.back() == '\r'))
+    first_line.pop_back();
+  if (first_line.compare("AdjacencyGraph")) {
+    std::cout << "Invalid input file" << first_line << std::endl;
+    exit(1);
+  }
+  p = first_line_end;
+
+  int64_t header_nodes = read_header_value(&p, text_end, filename);
+  int64_t header_edges = read_header_value(&p, text_end, filename);
+  if (header_nodes < 0 || header_nodes > INT_MAX || header_edges < 0) {
+    fprintf(stderr, "Invalid graph size in: %s\n", filename);
+    exit(1);
+  }
+  if (sizeof(Offset) < sizeof(int64_t) && header_edges > INT_MAX) {
+    fprintf(stderr, "Graph has %lld edges, too many for 32-bit offsets. Use load_graph64().\n",
+            (long long) header_edges);
+    exit(1);
+  }
+
+  G* graph = (G*)(malloc(sizeof(G)));
+  graph->mapping = NULL;
+  graph->mapping_bytes = 0;
+  graph->num_nodes = header_nodes;
+  graph->num_edges = header_edges;
+
+  // split the rest into newline-aligned chunks, several per thread so
+  // that dynamic scheduling evens out uneven lines
+#ifdef _OPENMP
+  long num_threads = omp_get_max_threads();
+#else
+  long num_threads = 1;
+#endif
+  long body_bytes = text_end - p;
+  int num_chunks = std::max(1L, std::min(num_threads * 8, body_bytes >> 20));
+  std::vector<const char*> chunk_start(num_chunks + 1);
+  for (int c=0; c<num_chunks; c++) {
+    const char* split = p + body_bytes * c / num_chunks;
+    chunk_start[c] = (c == 0 || split[-1] == '\n') ? split : skip_line(split, text_end);
+  }
+  chunk_start[num_chunks] = text_end;
+
+  // first pass counts the values in each chunk so that the second can
+  // write them straight to their final positions
+  std::vector<long> first_index(num_chunks + 1, 0);
+  #pragma omp parallel for schedule(dynamic)
+  for (int c=0; c<num_chunks; c++)
+    first_index[c + 1] = scan_values<false>(chunk_start[c], chunk_start[c + 1], text_end, 0, graph);
+  for (int c=0; c<num_chunks; c++)
+    first_index[c + 1] += first_index[c];
+
+  long expected = (long)graph->num_nodes + graph->num_edges;
+  if (first_index[num_chunks] != expected) {
+    fprintf(stderr, "Invalid input file: %s has %ld values, expected %ld\n",
+            filename, first_index[num_chunks], expected);
+    exit(1);
+  }
 
-  // open the file
-  std::ifstream graph_file;
-  graph_file.open(filename);
-  get_meta_data(graph_file, graph);
+  graph->outgoing_starts = (Offset*)malloc(sizeof(Offset) * graph->num_nodes);
+  graph->outgoing_edges = (Vertex*)malloc(sizeof(Vertex) * graph->num_edges);
 
-  int* scratch = (int*) malloc(sizeof(int) * (graph->num_nodes + graph->num_edges));
-  read_graph_file(graph_file, scratch);
+  #pragma omp parallel for schedule(dynamic)
+  for (int c=0; c<num_chunks; c++)
+    scan_values<true>(chunk_start[c], chunk_start[c + 1], text_end, first_index[c], graph);
 
-  build_start(graph, scratch);
-  build_edges(graph, scratch);
-  free(scratch);
+  munmap(mapping, file_bytes);
+  if (parse_seconds)
+    *parse_seconds = CycleTimer::currentSeconds() - start_time;
 
   build_incoming_edges(graph);
 
@@ -235,10 +502,45 @@ Graph load_graph(const char* filename)
   return graph;
 }
 
-Graph load_graph_binary(const char* filename)
+Graph load_graph(const char* filename, double* parse_seconds)
+{
+  return load_graph_text<graph>(filename, parse_seconds);
+}
+
+Graph64 load_graph64(const char* filename, double* parse_seconds)
 {
-    graph* graph = (struct graph*)(malloc(sizeof(struct graph)));
+  return load_graph_text<graph64>(filename, parse_seconds);
+}
+
+// Reads count values of type From into to[], converting each to To.
+template <typename From, typename To>
+static bool read_converted(FILE* input, To* to, int64_t count)
+{
+    if (std::is_same<From, To>::value)
+        return fread(to, sizeof(To), count, input) == (size_t) count;
+
+    const int64_t block = 1 << 16;
+    std::vector<From> buffer(std::min(count, block));
+    for (int64_t i=0; i<count; i+=block) {
+        int64_t n = std::min(count - i, block);
+        if (fread(buffer.data(), sizeof(From), n, input) != (size_t) n)
+            return false;
+        for (int64_t j=0; j<n; j++)
+            to[i + j] = (To) buffer[j];
+    }
+    return true;
+}
 
+// Memory-mapped files, see below
+static const graph_file_header* map_graph_file(const char* filename, bool verify_checksums,
+                                               size_t* mapped_bytes);
+template <typename G> static G* load_mapped_as(const char* filename);
+
+// Opens a binary graph file and reads its header.  version is 1 for the
+// original format (int starts), 2 for the 64-bit format (int64_t starts)
+// and 0 for the memory-mapped format, whose header is left unread.
+static FILE* open_graph_binary(const char* filename, int* version, int* num_nodes, int64_t* num_edges)
+{
     FILE* input = fopen(filename, "rb");
 
     if (!input) {
@@ -253,23 +555,53 @@ Graph load_graph_binary(const char* filename)
         exit(1);
     }
 
-    if (header[0] != GRAPH_HEADER_TOKEN) {
+    if ((uint32_t) header[0] == GRAPH_MMAP_MAGIC) {
+        *version = 0;
+    } else if (header[0] == GRAPH_HEADER_TOKEN) {
+        *version = 1;
+        *num_nodes = header[1];
+        *num_edges = header[2];
+    } else if (header[0] == GRAPH_HEADER_TOKEN_V2) {
+        // token, version, num_nodes, reserved, int64_t num_edges
+        int reserved;
+        if (header[1] != 2 ||
+            fread(&reserved, sizeof(int), 1, input) != 1 ||
+            fread(num_edges, sizeof(int64_t), 1, input) != 1) {
+            fprintf(stderr, "Unsupported graph file version %d.\n", header[1]);
+            exit(1);
+        }
+        *version = 2;
+        *num_nodes = header[2];
+    } else {
         fprintf(stderr, "Invalid graph file header. File may be corrupt.\n");
         exit(1);
     }
+    return input;
+}
+
+template <typename G>
+static G* read_graph_binary(FILE* input, int version, int num_nodes, int64_t num_edges)
+{
+    typedef typename G::offset_type Offset;
 
-    graph->num_nodes = header[1];
-    graph->num_edges = header[2];
+    G* graph = (G*)(malloc(sizeof(G)));
+    graph->mapping = NULL;
+    graph->mapping_bytes = 0;
+    graph->num_nodes = num_nodes;
+    graph->num_edges = num_edges;
 
-    graph->outgoing_starts = (int*)malloc(sizeof(int) * graph->num_nodes);
-    graph->outgoing_edges = (int*)malloc(sizeof(int) * graph->num_edges);
+    graph->outgoing_starts = (Offset*)malloc(sizeof(Offset) * num_nodes);
+    graph->outgoing_edges = (Vertex*)malloc(sizeof(Vertex) * num_edges);
 
-    if (fread(graph->outgoing_starts, sizeof(int), graph->num_nodes, input) != (size_t) graph->num_nodes) {
+    bool read_starts = (version == 1)
+        ? read_converted<int>(input, graph->outgoing_starts, num_nodes)
+        : read_converted<int64_t>(input, graph->outgoing_starts, num_nodes);
+    if (!read_starts) {
         fprintf(stderr, "Error reading nodes.\n");
         exit(1);
     }
 
-    if (fread(graph->outgoing_edges, sizeof(int), graph->num_edges, input) != (size_t) graph->num_edges) {
+    if (fread(graph->outgoing_edges, sizeof(Vertex), num_edges, input) != (size_t) num_edges) {
         fprintf(stderr, "Error reading edges.\n");
         exit(1);
     }
@@ -281,6 +613,91 @@ Graph load_graph_binary(const char* filename)
     return graph;
 }
 
+Graph load_graph_binary(const char* filename)
+{
+    int version, num_nodes;
+    int64_t num_edges;
+    FILE* input = open_graph_binary(filename, &version, &num_nodes, &num_edges);
+
+    if (version == 0) {
+        fclose(input);
+        return load_mapped_as<graph>(filename);
+    }
+
+    if (num_edges > INT_MAX) {
+        fprintf(stderr, "Graph has %lld edges, too many for 32-bit offsets. Use load_graph64_binary().\n",
+                (long long) num_edges);
+        exit(1);
+    }
+
+    return read_graph_binary<graph>(input, version, num_nodes, num_edges);
+}
+
+Graph64 load_graph64_binary(const char* filename)
+{
+    int version, num_nodes;
+    int64_t num_edges;
+    FILE* input = open_graph_binary(filename, &version, &num_nodes, &num_edges);
+
+    if (version == 0) {
+        fclose(input);
+        return load_mapped_as<graph64>(filename);
+    }
+
+    return read_graph_binary<graph64>(input, version, num_nodes, num_edges);
+}
+
+int graph_file_offset_bits(const char* filename)
+{
+    int version, num_nodes;
+    int64_t num_edges;
+    FILE* input = open_graph_binary(filename, &version, &num_nodes, &num_edges);
+    fclose(input);
+
+    if (version == 0) {
+        size_t mapped_bytes;
+        const graph_file_header* header = map_graph_file(filename, false, &mapped_bytes);
+        bool wide = (header->version == GRAPH_MMAP_VERSION_64);
+        munmap((void*) header, mapped_bytes);
+        return wide ? 64 : 32;
+    }
+    return (version == 2) ? 64 : 32;
+}
+
+void store_graph64_binary(const char* filename, Graph64 graph) {
+
+    FILE* output = fopen(filename, "wb");
+
+    if (!output) {
+        fprintf(stderr, "Could not open: %s\n", filename);
+        exit(1);
+    }
+
+    int header[4];
+    header[0] = GRAPH_HEADER_TOKEN_V2;
+    header[1] = 2;
+    header[2] = graph->num_nodes;
+    header[3] = 0;
+
+    if (fwrite(header, sizeof(int), 4, output) != 4 ||
+        fwrite(&graph->num_edges, sizeof(int64_t), 1, output) != 1) {
+        fprintf(stderr, "Error writing header.\n");
+        exit(1);
+    }
+
+    if (fwrite(graph->outgoing_starts, sizeof(int64_t), graph->num_nodes, output) != (size_t) graph->num_nodes) {
+        fprintf(stderr, "Error writing nodes.\n");
+        exit(1);
+    }
+
+    if (fwrite(graph->outgoing_edges, sizeof(Vertex), graph->num_edges, output) != (size_t) graph->num_edges) {
+        fprintf(stderr, "Error writing edges.\n");
+        exit(1);
+    }
+
+    fclose(output);
+}
+
 void store_graph_binary(const char* filename, Graph graph) {
 
     FILE* output = fopen(filename, "wb");
@@ -312,3 +729,488 @@ void store_graph_binary(const char* filename, Graph graph) {
 
     fclose(output);
 }
+
+// 64-bit checksum of a section.  Four independent multiply-xor lanes over
+// 8-byte words, so that verifying a large file runs near memory bandwidth.
+static uint64_t graph_checksum(const void* data, size_t bytes)
+{
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t lane[4] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL,
+                         0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL };
+    const unsigned char* p = (const unsigned char*) data;
+    size_t i = 0;
+
+    for (; i + 32 <= bytes; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t w;
+            memcpy(&w, p + i + 8 * k, 8);
+            lane[k] = (lane[k] ^ w) * prime;
+        }
+    }
+    for (; i < bytes; i++)
+        lane[0] = (lane[0] ^ p[i]) * prime;
+
+    uint64_t h = bytes;
+    for (int k = 0; k < 4; k++)
+        h = (h ^ lane[k]) * prime;
+    return h ^ (h >> 32);
+}
+
+static uint64_t header_checksum(const graph_file_header* header)
+{
+    return graph_checksum(header, offsetof(graph_file_header, header_checksum));
+}
+
+static uint64_t align_up(uint64_t offset)
+{
+    return (offset + GRAPH_MMAP_ALIGNMENT - 1) / GRAPH_MMAP_ALIGNMENT * GRAPH_MMAP_ALIGNMENT;
+}
+
+// Format version of a memory-mapped file holding a G.
+template <typename G>
+static uint32_t mmap_version()
+{
+    return sizeof(typename G::offset_type) == sizeof(int64_t) ? GRAPH_MMAP_VERSION_64 : GRAPH_MMAP_VERSION;
+}
+
+// Bytes of one entry of section s in a file of the given version.
+static uint64_t section_entry_bytes(uint32_t version, int s)
+{
+    if (s == SECTION_OUTGOING_STARTS || s == SECTION_INCOMING_STARTS)
+        return (version == GRAPH_MMAP_VERSION_64) ? sizeof(int64_t) : sizeof(int);
+    return sizeof(Vertex);
+}
+
+template <typename G>
+static void store_graph_mmap_impl(const char* filename, G* graph)
+{
+    FILE* output = fopen(filename, "wb");
+
+    if (!output) {
+        fprintf(stderr, "Could not open: %s\n", filename);
+        exit(1);
+    }
+
+    const void* sections[NUM_SECTIONS] = {
+        graph->outgoing_starts, graph->outgoing_edges,
+        graph->incoming_starts, graph->incoming_edges
+    };
+
+    graph_file_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GRAPH_MMAP_MAGIC;
+    header.version = mmap_version<G>();
+    header.header_bytes = sizeof(header);
+    header.alignment = GRAPH_MMAP_ALIGNMENT;
+    header.num_nodes = graph->num_nodes;
+    header.num_edges = graph->num_edges;
+
+    uint64_t offset = align_up(sizeof(header));
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        bool is_starts = (s == SECTION_OUTGOING_STARTS || s == SECTION_INCOMING_STARTS);
+        header.section_offset[s] = offset;
+        header.section_bytes[s] = section_entry_bytes(header.version, s) *
+                                  (uint64_t) (is_starts ? graph->num_nodes : graph->num_edges);
+        header.section_checksum[s] = graph_checksum(sections[s], header.section_bytes[s]);
+        offset = align_up(offset + header.section_bytes[s]);
+    }
+    header.header_checksum = header_checksum(&header);
+
+    if (fwrite(&header, sizeof(header), 1, output) != 1) {
+        fprintf(stderr, "Error writing header.\n");
+        exit(1);
+    }
+
+    static const char zeros[GRAPH_MMAP_ALIGNMENT] = { 0 };
+    uint64_t written = sizeof(header);
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        size_t padding = header.section_offset[s] - written;
+        if (fwrite(zeros, 1, padding, output) != padding ||
+            fwrite(sections[s], 1, header.section_bytes[s], output) != header.section_bytes[s]) {
+            fprintf(stderr, "Error writing graph data.\n");
+            exit(1);
+        }
+        written = header.section_offset[s] + header.section_bytes[s];
+    }
+
+    if (fclose(output) != 0) {
+        fprintf(stderr, "Error writing: %s\n", filename);
+        exit(1);
+    }
+}
+
+void store_graph_mmap(const char* filename, Graph graph)
+{
+    store_graph_mmap_impl(filename, graph);
+}
+
+void store_graph_mmap(const char* filename, Graph64 graph)
+{
+    store_graph_mmap_impl(filename, graph);
+}
+
+// Maps a memory-mapped graph file of either version and checks its
+// header and section layout.  Returns the header, which is at the start
+// of the mapping.
+static const graph_file_header* map_graph_file(const char* filename, bool verify_checksums,
+                                               size_t* mapped_bytes)
+{
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Could not open: %s\n", filename);
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(graph_file_header)) {
+        fprintf(stderr, "Error reading header.\n");
+        exit(1);
+    }
+
+    size_t file_bytes = st.st_size;
+    void* mapping = mmap(NULL, file_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Could not map: %s\n", filename);
+        exit(1);
+    }
+
+    const char* base = (const char*) mapping;
+    const graph_file_header* header = (const graph_file_header*) base;
+
+    if (header->magic != GRAPH_MMAP_MAGIC) {
+        fprintf(stderr, "Invalid graph file header. File may be corrupt.\n");
+        exit(1);
+    }
+    if ((header->version != GRAPH_MMAP_VERSION && header->version != GRAPH_MMAP_VERSION_64) ||
+        header->header_bytes != sizeof(graph_file_header)) {
+        fprintf(stderr, "Unsupported graph file version %u.\n", header->version);
+        exit(1);
+    }
+    if (header->header_checksum != header_checksum(header)) {
+        fprintf(stderr, "Graph file header checksum mismatch. File may be corrupt.\n");
+        exit(1);
+    }
+    // edges beyond the file size are caught below; bounding them here
+    // keeps the section sizes from overflowing
+    int64_t max_edges = (header->version == GRAPH_MMAP_VERSION) ? INT_MAX : (int64_t) file_bytes;
+    if (header->num_nodes < 0 || header->num_nodes > INT_MAX ||
+        header->num_edges < 0 || header->num_edges > max_edges) {
+        fprintf(stderr, "Invalid graph size in header.\n");
+        exit(1);
+    }
+
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        bool is_starts = (s == SECTION_OUTGOING_STARTS || s == SECTION_INCOMING_STARTS);
+        uint64_t expected = section_entry_bytes(header->version, s) *
+                            (uint64_t) (is_starts ? header->num_nodes : header->num_edges);
+        uint64_t offset = header->section_offset[s];
+        if (header->section_bytes[s] != expected ||
+            offset % GRAPH_MMAP_ALIGNMENT != 0 ||
+            offset > file_bytes || expected > file_bytes - offset) {
+            fprintf(stderr, "Invalid section layout in graph file. File may be truncated.\n");
+            exit(1);
+        }
+        if (verify_checksums &&
+            graph_checksum(base + offset, expected) != header->section_checksum[s]) {
+            fprintf(stderr, "Graph file section %d checksum mismatch. File may be corrupt.\n", s);
+            exit(1);
+        }
+    }
+
+    *mapped_bytes = file_bytes;
+    return header;
+}
+
+// Points a G at the sections of a mapping checked by map_graph_file(),
+// which must hold a G.
+template <typename G>
+static G* graph_from_mapping(const graph_file_header* header, size_t mapped_bytes)
+{
+    typedef typename G::offset_type Offset;
+    const char* base = (const char*) header;
+
+    G* graph = (G*)(malloc(sizeof(G)));
+    graph->num_nodes = header->num_nodes;
+    graph->num_edges = header->num_edges;
+    graph->outgoing_starts = (Offset*) (base + header->section_offset[SECTION_OUTGOING_STARTS]);
+    graph->outgoing_edges = (Vertex*) (base + header->section_offset[SECTION_OUTGOING_EDGES]);
+    graph->incoming_starts = (Offset*) (base + header->section_offset[SECTION_INCOMING_STARTS]);
+    graph->incoming_edges = (Vertex*) (base + header->section_offset[SECTION_INCOMING_EDGES]);
+    graph->mapping = (void*) header;
+    graph->mapping_bytes = mapped_bytes;
+    return graph;
+}
+
+// Nonzero if a starts array does not describe lists inside [0, num_edges).
+template <typename Offset>
+static int starts_out_of_range(const Offset* starts, int num_nodes, int64_t num_edges)
+{
+    if (num_nodes == 0)
+        return 0;
+    int bad = (starts[0] < 0) | (starts[num_nodes - 1] > num_edges);
+    #pragma omp parallel for schedule(static) reduction(|:bad)
+    for (int v = 1; v < num_nodes; v++)
+        bad |= (starts[v - 1] > starts[v]);
+    return bad;
+}
+
+// Nonzero if an edge array names a vertex outside [0, num_nodes).
+static int edges_out_of_range(const Vertex* edges, int64_t num_edges, int num_nodes)
+{
+    int bad = 0;
+    #pragma omp parallel for schedule(static) reduction(|:bad)
+    for (int64_t i = 0; i < num_edges; i++)
+        bad |= ((unsigned) edges[i] >= (unsigned) num_nodes);
+    return bad;
+}
+
+// Checks that a mapped graph can be traversed without reading outside its
+// arrays.  The starts arrays are always checked, which reads O(V); the
+// edge ids only when check_edges is set, which reads the whole file.  A
+// file can pass its checksums and still fail here if it was written
+// wrong, and pass here with corrupted data that stays in bounds.
+template <typename G>
+static void check_mapped_bounds(const G* graph, bool check_edges)
+{
+    if (starts_out_of_range(graph->outgoing_starts, graph->num_nodes, graph->num_edges) ||
+        starts_out_of_range(graph->incoming_starts, graph->num_nodes, graph->num_edges)) {
+        fprintf(stderr, "Graph file has edge offsets out of range. File may be corrupt.\n");
+        exit(1);
+    }
+    if (check_edges &&
+        (edges_out_of_range(graph->outgoing_edges, graph->num_edges, graph->num_nodes) ||
+         edges_out_of_range(graph->incoming_edges, graph->num_edges, graph->num_nodes))) {
+        fprintf(stderr, "Graph file has vertex ids out of range. File may be corrupt.\n");
+        exit(1);
+    }
+}
+
+// Copies a graph into freshly malloc'ed arrays of the other offset width.
+template <typename To, typename From>
+static To* convert_graph(const From* from)
+{
+    typedef typename To::offset_type Offset;
+    int num_nodes = from->num_nodes;
+    int64_t num_edges = from->num_edges;
+
+    To* to = (To*)(malloc(sizeof(To)));
+    to->mapping = NULL;
+    to->mapping_bytes = 0;
+    to->num_nodes = num_nodes;
+    to->num_edges = num_edges;
+    to->outgoing_starts = (Offset*)malloc(sizeof(Offset) * num_nodes);
+    to->outgoing_edges = (Vertex*)malloc(sizeof(Vertex) * num_edges);
+    to->incoming_starts = (Offset*)malloc(sizeof(Offset) * num_nodes);
+    to->incoming_edges = (Vertex*)malloc(sizeof(Vertex) * num_edges);
+
+    std::copy(from->outgoing_starts, from->outgoing_starts + num_nodes, to->outgoing_starts);
+    std::copy(from->incoming_starts, from->incoming_starts + num_nodes, to->incoming_starts);
+    memcpy(to->outgoing_edges, from->outgoing_edges, sizeof(Vertex) * num_edges);
+    memcpy(to->incoming_edges, from->incoming_edges, sizeof(Vertex) * num_edges);
+    return to;
+}
+
+// Loads a memory-mapped file of either version as a G: mapped directly
+// when the widths match, copied otherwise.  Callers of the generic
+// loaders do not know they got a mapped file, so every bound is checked.
+template <typename G>
+static G* load_mapped_as(const char* filename)
+{
+    size_t mapped_bytes;
+    const graph_file_header* header = map_graph_file(filename, false, &mapped_bytes);
+
+    if (header->version == mmap_version<G>()) {
+        G* graph = graph_from_mapping<G>(header, mapped_bytes);
+        check_mapped_bounds(graph, true);
+        return graph;
+    }
+
+    if (header->version == GRAPH_MMAP_VERSION_64) {
+        if (header->num_edges > INT_MAX) {
+            fprintf(stderr, "Graph has %lld edges, too many for 32-bit offsets. Use load_graph64_binary().\n",
+                    (long long) header->num_edges);
+            exit(1);
+        }
+        graph64* mapped = graph_from_mapping<graph64>(header, mapped_bytes);
+        check_mapped_bounds(mapped, true);
+        G* graph = convert_graph<G>(mapped);
+        free_graph(mapped);
+        return graph;
+    }
+
+    graph* mapped = graph_from_mapping<graph>(header, mapped_bytes);
+    check_mapped_bounds(mapped, true);
+    G* graph = convert_graph<G>(mapped);
+    free_graph(mapped);
+    return graph;
+}
+
+template <typename G>
+static G* load_graph_mmap_impl(const char* filename, bool verify_checksums)
+{
+    size_t mapped_bytes;
+    const graph_file_header* header = map_graph_file(filename, verify_checksums, &mapped_bytes);
+
+    if (header->version != mmap_version<G>()) {
+        if (header->version == GRAPH_MMAP_VERSION_64)
+            fprintf(stderr, "Graph file has 64-bit offsets. Use load_graph64_mmap().\n");
+        else
+            fprintf(stderr, "Graph file has 32-bit offsets. Use load_graph_mmap().\n");
+        exit(1);
+    }
+    G* graph = graph_from_mapping<G>(header, mapped_bytes);
+    check_mapped_bounds(graph, verify_checksums);
+    return graph;
+}
+
+Graph load_graph_mmap(const char* filename, bool verify_checksums)
+{
+    return load_graph_mmap_impl<graph>(filename, verify_checksums);
+}
+
+Graph64 load_graph64_mmap(const char* filename, bool verify_checksums)
+{
+    return load_graph_mmap_impl<graph64>(filename, verify_checksums);
+}
+
+static inline int varint_size(uint64_t value)
+{
+    int bytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        bytes++;
+    }
+    return bytes;
+}
+
+static inline uint8_t* encode_varint(uint8_t* p, uint64_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+static inline int gap_size(uint32_t gap)
+{
+    return (gap < (1u << 8)) ? 1 : (gap < (1u << 16)) ? 2 : (gap < (1u << 24)) ? 3 : 4;
+}
+
+// Payload of vertex v's sorted list: the first neighbor relative to v,
+// zigzag-encoded since it may be smaller, then the gaps in groups of four.
+static inline uint64_t first_neighbor_code(Vertex v, Vertex first)
+{
+    int64_t delta = (int64_t) first - v;
+    return ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63);
+}
+
+static int64_t payload_size(Vertex v, const Vertex* sorted, int degree)
+{
+    int64_t bytes = varint_size(first_neighbor_code(v, sorted[0]));
+    for (int j=1; j<degree; j++) {
+        if ((j - 1) % 4 == 0)
+            bytes++;  // control byte
+        bytes += gap_size(sorted[j] - sorted[j-1]);
+    }
+    return bytes;
+}
+
+static uint8_t* encode_payload(uint8_t* p, Vertex v, const Vertex* sorted, int degree)
+{
+    p = encode_varint(p, first_neighbor_code(v, sorted[0]));
+    uint8_t* control = NULL;
+    for (int j=1; j<degree; j++) {
+        int k = (j - 1) % 4;
+        if (k == 0) {
+            control = p++;
+            *control = 0;
+        }
+        uint32_t gap = sorted[j] - sorted[j-1];
+        int length = gap_size(gap);
+        *control |= (length - 1) << (2 * k);
+        for (int b=0; b<length; b++)
+            *p++ = (uint8_t) (gap >> (8 * b));
+    }
+    return p;
+}
+
+static void compress_adjacency(int num_nodes, int num_edges, const int* starts,
+                               const Vertex* edges, compressed_adjacency* out)
+{
+    Vertex* sorted = (Vertex*)malloc(sizeof(Vertex) * num_edges);
+    int64_t* list_offset = (int64_t*)malloc(sizeof(int64_t) * (num_nodes + 1));
+
+    // sort each list and size its encoding
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int v=0; v<num_nodes; v++) {
+        int start_edge = starts[v];
+        int end_edge = (v == num_nodes-1) ? num_edges : starts[v+1];
+        std::copy(edges + start_edge, edges + end_edge, sorted + start_edge);
+        std::sort(sorted + start_edge, sorted + end_edge);
+
+        int64_t bytes = varint_size(end_edge - start_edge);
+        if (end_edge > start_edge) {
+            int64_t payload = payload_size(v, sorted + start_edge, end_edge - start_edge);
+            bytes += varint_size(payload) + payload;
+        }
+        list_offset[v + 1] = bytes;
+    }
+
+    list_offset[0] = 0;
+    for (int v=0; v<num_nodes; v++)
+        list_offset[v + 1] += list_offset[v];
+
+    int num_blocks = (num_nodes + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE;
+    out->block_offsets = (int64_t*)malloc(sizeof(int64_t) * (num_blocks + 1));
+    for (int b=0; b<num_blocks; b++)
+        out->block_offsets[b] = list_offset[(int64_t) b * COMPRESSED_BLOCK_SIZE];
+    out->block_offsets[num_blocks] = list_offset[num_nodes];
+    // padding for the 4-byte loads in decode_group()
+    out->data = (uint8_t*)calloc(list_offset[num_nodes] + 4, 1);
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int v=0; v<num_nodes; v++) {
+        int start_edge = starts[v];
+        int end_edge = (v == num_nodes-1) ? num_edges : starts[v+1];
+        uint8_t* p = encode_varint(out->data + list_offset[v], end_edge - start_edge);
+        if (end_edge > start_edge) {
+            int degree = end_edge - start_edge;
+            p = encode_varint(p, payload_size(v, sorted + start_edge, degree));
+            encode_payload(p, v, sorted + start_edge, degree);
+        }
+    }
+
+    free(sorted);
+    free(list_offset);
+}
+
+CompressedGraph compress_graph(const graph* g)
+{
+    compressed_graph* cg = (compressed_graph*)malloc(sizeof(compressed_graph));
+    cg->num_nodes = g->num_nodes;
+    cg->num_edges = g->num_edges;
+    compress_adjacency(g->num_nodes, g->num_edges, g->outgoing_starts, g->outgoing_edges, &cg->outgoing);
+    compress_adjacency(g->num_nodes, g->num_edges, g->incoming_starts, g->incoming_edges, &cg->incoming);
+    return cg;
+}
+
+void free_compressed_graph(CompressedGraph cg)
+{
+    free(cg->outgoing.block_offsets);
+    free(cg->outgoing.data);
+    free(cg->incoming.block_offsets);
+    free(cg->incoming.data);
+    free(cg);
+}
+
+int64_t compressed_bytes(const compressed_graph* cg, const compressed_adjacency* adj)
+{
+    int num_blocks = (cg->num_nodes + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE;
+    return sizeof(int64_t) * (num_blocks + 1) + adj->block_offsets[num_blocks];
+}
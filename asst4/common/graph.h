@@ -1,10 +1,16 @@
 #ifndef __GRAPH_H__
 #define __GRAPH_H__
 
+#include <cstddef>
+#include <stdint.h>
+
 using Vertex = int;
 
 struct graph
 {
+    // Type of edge counts and offsets; see graph64.
+    typedef int offset_type;
+
     // Number of edges in the graph
     int num_edges;
     // Number of vertices in the graph
@@ -18,33 +24,102 @@ struct graph
 
     int* incoming_starts;
     Vertex* incoming_edges;
+
+    // Non-NULL when the arrays above point into a read-only file
+    // mapping (see load_graph_mmap()).  The arrays must not be written
+    // to, and free_graph() unmaps them instead of freeing them.
+    void* mapping;
+    size_t mapping_bytes;
 };
 
 using Graph = graph*;
 
-/* Getters */
-static inline int num_nodes(const Graph);
-static inline int num_edges(const Graph);
+// Same as graph, but with 64-bit edge counts and offsets, for graphs
+// with more than 2^31-1 edges.  Vertex ids stay 32-bit, so the edge
+// arrays take no more space.
+struct graph64
+{
+    typedef int64_t offset_type;
+
+    int64_t num_edges;
+    int num_nodes;
+
+    int64_t* outgoing_starts;
+    Vertex* outgoing_edges;
+
+    int64_t* incoming_starts;
+    Vertex* incoming_edges;
+
+    void* mapping;
+    size_t mapping_bytes;
+};
+
+using Graph64 = graph64*;
+
+/* Getters.  These work on both graph and graph64; G::offset_type is the
+ * type of edge counts (int or int64_t). */
+template <typename G> static inline int num_nodes(const G*);
+template <typename G> static inline typename G::offset_type num_edges(const G*);
 
-static inline const Vertex* outgoing_begin(const Graph, Vertex);
-static inline const Vertex* outgoing_end(const Graph, Vertex);
-static inline int outgoing_size(const Graph, Vertex);
+template <typename G> static inline const Vertex* outgoing_begin(const G*, Vertex);
+template <typename G> static inline const Vertex* outgoing_end(const G*, Vertex);
+template <typename G> static inline typename G::offset_type outgoing_size(const G*, Vertex);
 
-static inline const Vertex* incoming_begin(const Graph, Vertex);
-static inline const Vertex* incoming_end(const Graph, Vertex);
-static inline int incoming_size(const Graph, Vertex);
+template <typename G> static inline const Vertex* incoming_begin(const G*, Vertex);
+template <typename G> static inline const Vertex* incoming_end(const G*, Vertex);
+template <typename G> static inline typename G::offset_type incoming_size(const G*, Vertex);
 
 
 /* IO */
-Graph load_graph(const char* filename);
+/* Parses the text format in parallel.  If parse_seconds is non-NULL it
+ * receives the time spent reading and parsing the file, not counting
+ * building the incoming edges. */
+Graph load_graph(const char* filename, double* parse_seconds = NULL);
+Graph64 load_graph64(const char* filename, double* parse_seconds = NULL);
 Graph load_graph_binary(const char* filename);
 void store_graph_binary(const char* filename, Graph);
 
+/* 64-bit binary format: the header carries a version and a 64-bit edge
+ * count, and the starts arrays are int64_t.  load_graph_binary() reads
+ * it as long as the edge count fits in an int;
+ * load_graph64_binary() reads every format, including memory-mapped
+ * files of either width. */
+Graph64 load_graph64_binary(const char* filename);
+void store_graph64_binary(const char* filename, Graph64);
+
+/* Returns 64 if filename has 64-bit offsets (64-bit binary or
+ * memory-mapped format), else 32. */
+int graph_file_offset_bits(const char* filename);
+
+/* Memory-mapped format: a page-aligned file holding both the outgoing
+ * and the incoming CSR arrays, with a versioned, checksummed header.
+ * load_graph_mmap() maps the file read-only and points the graph at it,
+ * so loading does no copying and processes that load the same file
+ * share its page cache.  The starts arrays are always bounds-checked
+ * (O(V)); section checksums and vertex ids are only checked when
+ * verify_checksums is set, because that reads the whole file, so run
+ * `graphTools verify` once on files copied from elsewhere.
+ * A graph64 is stored as format version 2, with int64_t starts, and is
+ * mapped by load_graph64_mmap(); each loader rejects the other version.
+ * load_graph_binary() and load_graph64_binary() accept both versions,
+ * copying when the width differs, and check every offset and vertex id
+ * (but not the checksums). */
+Graph load_graph_mmap(const char* filename, bool verify_checksums = false);
+Graph64 load_graph64_mmap(const char* filename, bool verify_checksums = false);
+void store_graph_mmap(const char* filename, Graph);
+void store_graph_mmap(const char* filename, Graph64);
+
 void print_graph(const graph*);
 
+/* Fills in incoming_starts/incoming_edges (freshly malloc'ed) from the
+ * outgoing arrays.  Parallel when compiled with OpenMP. */
+void build_incoming_edges(Graph);
+void build_incoming_edges(Graph64);
+
 
 /* Deallocation */
 void free_graph(Graph);
+void free_graph(Graph64);
 
 
 /* Included here to enable inlining. Don't look. */
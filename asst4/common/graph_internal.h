@@ -4,34 +4,39 @@
 #include <stdlib.h>
 #include "contracts.h"
 
-static inline int num_nodes(const Graph graph)
+template <typename G>
+static inline int num_nodes(const G* graph)
 {
   REQUIRES(graph != NULL);
   return graph->num_nodes;
 }
 
-static inline int num_edges(const Graph graph)
+template <typename G>
+static inline typename G::offset_type num_edges(const G* graph)
 {
   REQUIRES(graph != NULL);
   return graph->num_edges;
 }
 
-static inline const Vertex* outgoing_begin(const Graph g, Vertex v)
+template <typename G>
+static inline const Vertex* outgoing_begin(const G* g, Vertex v)
 {
   REQUIRES(g != NULL);
   REQUIRES(0 <= v && v < num_nodes(g));
   return g->outgoing_edges + g->outgoing_starts[v];
 }
 
-static inline const Vertex* outgoing_end(const Graph g, Vertex v)
+template <typename G>
+static inline const Vertex* outgoing_end(const G* g, Vertex v)
 {
   REQUIRES(g != NULL);
   REQUIRES(0 <= v && v < num_nodes(g));
-  int offset = (v == g->num_nodes - 1) ? g->num_edges : g->outgoing_starts[v + 1];
+  typename G::offset_type offset = (v == g->num_nodes - 1) ? g->num_edges : g->outgoing_starts[v + 1];
   return g->outgoing_edges + offset;
 }
 
-static inline int outgoing_size(const Graph g, Vertex v)
+template <typename G>
+static inline typename G::offset_type outgoing_size(const G* g, Vertex v)
 {
   REQUIRES(g != NULL);
   REQUIRES(0 <= v && v < num_nodes(g));
@@ -42,22 +47,25 @@ static inline int outgoing_size(const Graph g, Vertex v)
   }
 }
 
-static inline const Vertex* incoming_begin(const Graph g, Vertex v)
+template <typename G>
+static inline const Vertex* incoming_begin(const G* g, Vertex v)
 {
   REQUIRES(g != NULL);
   REQUIRES(0 <= v && v < num_nodes(g));
   return g->incoming_edges + g->incoming_starts[v];
 }
 
-static inline const Vertex* incoming_end(const Graph g, Vertex v)
+template <typename G>
+static inline const Vertex* incoming_end(const G* g, Vertex v)
 {
   REQUIRES(g != NULL);
   REQUIRES(0 <= v && v < num_nodes(g));
-  int offset = (v == g->num_nodes - 1) ? g->num_edges : g->incoming_starts[v + 1];
+  typename G::offset_type offset = (v == g->num_nodes - 1) ? g->num_edges : g->incoming_starts[v + 1];
   return g->incoming_edges + offset;
 }
 
-static inline int incoming_size(const Graph g, Vertex v)
+template <typename G>
+static inline typename G::offset_type incoming_size(const G* g, Vertex v)
 {
   REQUIRES(g != NULL);
   REQUIRES(0 <= v && v < num_nodes(g));
@@ -39,7 +39,7 @@ graph* load_graph(std::string graph_filename) {
         g = load_graph(graph_filename);
         printf("storing binary form of graph!\n");
         store_graph_binary(graph_filename.append(".bin").c_str(), g);
-        delete g;
+        free_graph(g);
         exit(1);
     }
     return g;
@@ -199,7 +199,7 @@ int main(int argc, char** argv) {
         graph* g = load_graph(graph_dir + '/' + graph_name);
         std::cout << "\nGraph: " << graph_name << std::endl;
         scores[i] = run_on_graph(g, num_threads, num_runs, graph_name);
-        delete g;
+        free_graph(g);
         i++;
     }
 
@@ -1,6 +1,7 @@
 #include "page_rank.h"
 
 #include <stdlib.h>
+#include <algorithm>
 #include <cmath>
 #include <omp.h>
 #include <utility>
@@ -8,6 +9,7 @@
 
 #include "../common/CycleTimer.h"
 #include "../common/graph.h"
+#include "../common/compressed_graph.h"
 
 // #define DEBUG
 
@@ -18,7 +20,8 @@
 // damping:     page-rank algorithm's damping parameter
 // convergence: page-rank algorithm's convergence threshold
 //
-void pageRank(Graph g, double* solution, double damping, double convergence)
+template <typename G>
+static void pageRank_impl(G* g, double* solution, double damping, double convergence)
 {
 
   // initialize vertex weights to uniform probability. Double
@@ -105,3 +108,74 @@ void pageRank(Graph g, double* solution, double damping, double convergence)
 
    */
 }
+
+void pageRank(Graph g, double* solution, double damping, double convergence)
+{
+  pageRank_impl(g, solution, damping, convergence);
+}
+
+void pageRank(Graph64 g, double* solution, double damping, double convergence)
+{
+  pageRank_impl(g, solution, damping, convergence);
+}
+
+// pageRank on compressed adjacency lists (see common/compressed_graph.h).
+// Same iteration as above.  Out-degrees are decoded once up front, and
+// incoming lists are walked in order, in chunks of whole index blocks.
+void pageRank(CompressedGraph g, double* solution, double damping, double convergence)
+{
+  int numNodes = g->num_nodes;
+  double equal_prob = 1.0 / numNodes;
+
+  std::vector<double> ans(numNodes, equal_prob);
+  std::vector<double> tmp(numNodes);
+  std::vector<int> out_degree(numNodes);
+
+  #pragma omp parallel for
+  for (int i = 0; i < numNodes; ++i) {
+    out_degree[i] = outgoing_neighbors(g, i).size();
+  }
+
+  const int chunk = 16 * COMPRESSED_BLOCK_SIZE;
+  int numChunks = (numNodes + chunk - 1) / chunk;
+  bool converged{false};
+
+  while (!converged) {
+
+    double no_out_score = 0;
+
+    #pragma omp parallel for reduction(+:no_out_score)
+    for (int i = 0; i < numNodes; ++i) {
+      no_out_score += out_degree[i] == 0 ? damping * ans[i] / numNodes : 0;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < numChunks; ++c) {
+      int begin = c * chunk;
+      int end = std::min(numNodes, begin + chunk);
+      const uint8_t* p = compressed_seek(&g->incoming, begin);
+      for (int i = begin; i < end; ++i) {
+        compressed_list in(p, i);
+        p = in.next();
+        double tmp_score = 0;
+        for (Vertex v : in) {
+          tmp_score += ans[v] / out_degree[v];
+        }
+        tmp_score = tmp_score * damping + (1.0 - damping) / numNodes;
+        tmp_score += no_out_score;
+        tmp[i] = tmp_score;
+      }
+    }
+
+    double diff = 0;
+    #pragma omp parallel for reduction(+:diff)
+    for (int i = 0; i < numNodes; ++i) {
+      diff += std::fabs(ans[i] - tmp[i]);
+    }
+
+    std::swap(ans, tmp);
+    converged = diff < convergence;
+  }
+
+  memcpy(solution, &*ans.begin(), sizeof(double) * numNodes);
+}
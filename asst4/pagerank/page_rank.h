@@ -2,7 +2,10 @@
 #define __PAGE_RANK_H__
 
 #include "common/graph.h"
+#include "common/compressed_graph.h"
 
 void pageRank(Graph g, double* solution, double damping, double convergence);
+void pageRank(Graph64 g, double* solution, double damping, double convergence);
+void pageRank(CompressedGraph g, double* solution, double damping, double convergence);
 
 #endif /* __PAGE_RANK_H__ */
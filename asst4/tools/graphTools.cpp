@@ -1,20 +1,28 @@
 
 #include <algorithm>
 #include <climits>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <omp.h>
 
-
+#include "../common/CycleTimer.h"
 #include "../common/graph.h"
 
 #define CMD_TEXT2BIN    "text2bin"
+#define CMD_BIN2MMAP    "bin2mmap"
+#define CMD_BIN2BIN64   "bin2bin64"
+#define CMD_VERIFY      "verify"
 #define CMD_INFO        "info"
 #define CMD_PRINT       "print"
 #define CMD_NOOUTEDGES  "noout"
 #define CMD_NOINEDGES   "noin"
 #define CMD_EDGESTATS   "edgestats"
+#define CMD_TRANSPOSE   "transposebench"
 
 
 void print_help(const char* binary_name) {
@@ -23,11 +31,141 @@ void print_help(const char* binary_name) {
     std::cerr << "\n";
     std::cerr << "Valid cmds are:\n\n"
               << CMD_TEXT2BIN << ": text file to binary file conversion\n"
+              << CMD_BIN2MMAP << ": binary file to memory-mapped file conversion\n"
+              << CMD_BIN2BIN64 << ": binary file to 64-bit-offset binary file conversion\n"
+              << CMD_VERIFY << ": check a memory-mapped file's checksums and bounds and time loading it\n"
               << CMD_INFO << ": print graph metadata\n"
               << CMD_PRINT << ": print graph topology (careful with big graphs)\n"
               << CMD_NOOUTEDGES << ": detect vertices with no outgoing edges\n"
               << CMD_NOINEDGES << ": detect vertices with no incoming edges\n"
-              << CMD_EDGESTATS << ": print stats on graph edges: e.g., min/max edges per node, etc.\n";
+              << CMD_EDGESTATS << ": print stats on graph edges: e.g., min/max edges per node, etc.\n"
+              << CMD_TRANSPOSE << ": time building incoming edges, serial vs. parallel\n";
+}
+
+// The original serial build_incoming_edges(), kept as the baseline for
+// CMD_TRANSPOSE.
+void build_incoming_edges_serial(graph* graph) {
+
+    int num_nodes = graph->num_nodes;
+    int* node_counts = (int*)malloc(sizeof(int) * num_nodes);
+    int* node_scatter = (int*)malloc(sizeof(int) * num_nodes);
+
+    graph->incoming_starts = (int*)malloc(sizeof(int) * num_nodes);
+    graph->incoming_edges = (int*)malloc(sizeof(int) * graph->num_edges);
+
+    for (int i=0; i<num_nodes; i++)
+        node_counts[i] = node_scatter[i] = 0;
+
+    // compute number of incoming edges per node
+    for (int i=0; i<num_nodes; i++) {
+        int start_edge = graph->outgoing_starts[i];
+        int end_edge = (i == graph->num_nodes-1) ? graph->num_edges : graph->outgoing_starts[i+1];
+        for (int j=start_edge; j<end_edge; j++) {
+            int target_node = graph->outgoing_edges[j];
+            node_counts[target_node]++;
+        }
+    }
+
+    // build the starts array
+    graph->incoming_starts[0] = 0;
+    for (int i=1; i<num_nodes; i++) {
+        graph->incoming_starts[i] = graph->incoming_starts[i-1] + node_counts[i-1];
+    }
+
+    // now perform the scatter
+    for (int i=0; i<num_nodes; i++) {
+        int start_edge = graph->outgoing_starts[i];
+        int end_edge = (i == graph->num_nodes-1) ? graph->num_edges : graph->outgoing_starts[i+1];
+        for (int j=start_edge; j<end_edge; j++) {
+            int target_node = graph->outgoing_edges[j];
+            graph->incoming_edges[graph->incoming_starts[target_node] + node_scatter[target_node]] = i;
+            node_scatter[target_node]++;
+        }
+    }
+
+    free(node_counts);
+    free(node_scatter);
+}
+
+// CMD_VERIFY for either offset width: times mapping the file, then
+// checking its checksums and vertex ids, which exits with an error
+// message on a mismatch.
+template <typename G>
+void verify_mmap(const char* filename, G* (*load)(const char*, bool)) {
+    double start = CycleTimer::currentSeconds();
+    G* g = load(filename, false);
+    double mapped = CycleTimer::currentSeconds();
+    free_graph(g);
+
+    double verify_start = CycleTimer::currentSeconds();
+    g = load(filename, true);
+    double verified = CycleTimer::currentSeconds();
+
+    double mb = g->mapping_bytes / (1024.0 * 1024.0);
+    std::cout << "Num vertices: " << num_nodes(g) << "\n";
+    std::cout << "Num edges:    " << num_edges(g) << "\n";
+    std::cout << std::fixed << std::setprecision(3)
+              << "Map time:      " << (mapped - start) * 1000 << " ms\n"
+              << "Verify time:   " << (verified - verify_start) * 1000 << " ms ("
+              << mb / (verified - verify_start) << " MB/s)\n";
+    std::cout << "Checksums and bounds OK.\n";
+    free_graph(g);
+}
+
+// Reads a "Field:  <n> kB" line of /proc/self/status, or -1.
+long status_kb(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t len = strlen(field);
+    while (std::getline(status, line)) {
+        if (!line.compare(0, len, field) && line[len] == ':')
+            return atol(line.c_str() + len + 1);
+    }
+    return -1;
+}
+
+// Resets the peak resident size (VmHWM) to the current one.  Returns
+// false where that is not supported.
+bool reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.close();
+    return clear_refs.good();
+}
+
+// Best of `runs` timings of build(), on a graph sharing g's outgoing
+// edges.  The incoming arrays of the last run are left in *out.  The
+// largest growth in resident memory during a run, which includes the
+// output arrays, goes in *peak_kb (-1 if it cannot be measured).
+double time_transpose(Graph g, void (*build)(graph*), int runs, graph* out, long* peak_kb) {
+    double best = 1e30;
+    *out = *g;
+    out->mapping = NULL;
+    *peak_kb = -1;
+    for (int r=0; r<runs; r++) {
+        if (r > 0) {
+            free(out->incoming_starts);
+            free(out->incoming_edges);
+        }
+        bool measure = reset_peak_rss();
+        long before = status_kb("VmRSS");
+        double start = CycleTimer::currentSeconds();
+        build(out);
+        best = std::min(best, CycleTimer::currentSeconds() - start);
+        long peak = status_kb("VmHWM");
+        if (measure && before >= 0 && peak >= 0)
+            *peak_kb = std::max(*peak_kb, peak - before);
+    }
+    return best;
+}
+
+// Prints a peak from time_transpose().
+std::string format_peak(long peak_kb) {
+    if (peak_kb < 0)
+        return "n/a";
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(1) << peak_kb / 1024.0 << " MB";
+    return s.str();
 }
 
 int main(int argc, char** argv) {
@@ -42,20 +180,100 @@ int main(int argc, char** argv) {
     if (!cmd.compare(CMD_TEXT2BIN)) {
 
         if (argc < 4) {
-            std::cerr << "Usage: " << argv[0] << " " << cmd << " textfilename binfilename\n";
-            std::cerr << "Converts a graph from text file format to binary file format\n";
+            std::cerr << "Usage: " << argv[0] << " " << cmd << " textfilename binfilename [64]\n";
+            std::cerr << "Converts a graph from text file format to binary file format.  With 64,\n"
+                      << "writes the 64-bit-offset binary format, needed for graphs with more\n"
+                      << "than 2^31-1 edges\n";
             exit(1);
         }
 
         std::string inputFilename = std::string(argv[2]);
         std::string outputFilename = std::string(argv[3]);
+        bool wide = (argc > 4 && !std::string(argv[4]).compare("64"));
 
-        Graph g;
+        Graph g = NULL;
+        Graph64 g64 = NULL;
         std::cout << "Loading graph: " << inputFilename << "\n";
-        g = load_graph(inputFilename.c_str());
+        double parse_seconds;
+        if (wide)
+            g64 = load_graph64(inputFilename.c_str(), &parse_seconds);
+        else
+            g = load_graph(inputFilename.c_str(), &parse_seconds);
         std::cout << "Done loading.\n";
-        store_graph_binary(outputFilename.c_str(), g);
-        delete g;
+
+        std::ifstream input(inputFilename.c_str(), std::ios::binary | std::ios::ate);
+        double mb = input.tellg() / (1024.0 * 1024.0);
+        std::cout << std::fixed << std::setprecision(3)
+                  << "Parsed " << mb << " MB in " << parse_seconds * 1000 << " ms ("
+                  << mb / parse_seconds << " MB/s, " << omp_get_max_threads() << " threads)\n";
+
+        if (wide) {
+            store_graph64_binary(outputFilename.c_str(), g64);
+            free_graph(g64);
+        } else {
+            store_graph_binary(outputFilename.c_str(), g);
+            free_graph(g);
+        }
+
+    } else if (!cmd.compare(CMD_BIN2MMAP)) {
+
+        if (argc < 4) {
+            std::cerr << "Usage: " << argv[0] << " " << cmd << " binfilename mmapfilename\n";
+            std::cerr << "Converts a graph from binary file format to the memory-mapped format,\n"
+                      << "which also stores incoming edges so that loading does no work.\n"
+                      << "Keeps the input's offset width\n";
+            exit(1);
+        }
+
+        std::string inputFilename = std::string(argv[2]);
+        std::string outputFilename = std::string(argv[3]);
+
+        std::cout << "Loading graph: " << inputFilename << "\n";
+        if (graph_file_offset_bits(inputFilename.c_str()) == 64) {
+            Graph64 g = load_graph64_binary(inputFilename.c_str());
+            std::cout << "Done loading.\n";
+            store_graph_mmap(outputFilename.c_str(), g);
+            free_graph(g);
+        } else {
+            Graph g = load_graph_binary(inputFilename.c_str());
+            std::cout << "Done loading.\n";
+            store_graph_mmap(outputFilename.c_str(), g);
+            free_graph(g);
+        }
+
+    } else if (!cmd.compare(CMD_BIN2BIN64)) {
+
+        if (argc < 4) {
+            std::cerr << "Usage: " << argv[0] << " " << cmd << " binfilename bin64filename\n";
+            std::cerr << "Converts a graph from any binary or memory-mapped file to the 64-bit-offset\n"
+                      << "binary format, needed for graphs with more than 2^31-1 edges\n";
+            exit(1);
+        }
+
+        std::string inputFilename = std::string(argv[2]);
+        std::string outputFilename = std::string(argv[3]);
+
+        Graph64 g;
+        std::cout << "Loading graph: " << inputFilename << "\n";
+        g = load_graph64_binary(inputFilename.c_str());
+        std::cout << "Done loading.\n";
+        store_graph64_binary(outputFilename.c_str(), g);
+        free_graph(g);
+
+    } else if (!cmd.compare(CMD_VERIFY)) {
+
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " " << cmd << " mmapfilename\n";
+            std::cerr << "Maps a memory-mapped graph file, then checks the checksums of all its sections\n";
+            exit(1);
+        }
+
+        std::string inputFilename = std::string(argv[2]);
+
+        if (graph_file_offset_bits(inputFilename.c_str()) == 64)
+            verify_mmap(inputFilename.c_str(), load_graph64_mmap);
+        else
+            verify_mmap(inputFilename.c_str(), load_graph_mmap);
 
     } else if (!cmd.compare(CMD_INFO)) {
         if (argc < 3) {
@@ -66,14 +284,20 @@ int main(int argc, char** argv) {
 
         std::string inputFilename = std::string(argv[2]);
 
-        Graph g;
         std::cout << "Loading graph: " << inputFilename << "\n";
-        g = load_graph_binary(inputFilename.c_str());
-        std::cout << "Done loading.\n";
-
-        std::cout << "Num vertices: " << num_nodes(g) << "\n";
-        std::cout << "Num edges:    " << num_edges(g) << "\n";
-        delete g;
+        if (graph_file_offset_bits(inputFilename.c_str()) == 64) {
+            Graph64 g = load_graph64_binary(inputFilename.c_str());
+            std::cout << "Done loading.\n";
+            std::cout << "Num vertices: " << num_nodes(g) << "\n";
+            std::cout << "Num edges:    " << num_edges(g) << " (64-bit offsets)\n";
+            free_graph(g);
+        } else {
+            Graph g = load_graph_binary(inputFilename.c_str());
+            std::cout << "Done loading.\n";
+            std::cout << "Num vertices: " << num_nodes(g) << "\n";
+            std::cout << "Num edges:    " << num_edges(g) << "\n";
+            free_graph(g);
+        }
 
     } else if (!cmd.compare(CMD_PRINT)) {
 
@@ -90,7 +314,7 @@ int main(int argc, char** argv) {
         g = load_graph_binary(inputFilename.c_str());
         std::cout << "Done loading.\n";
         print_graph(g);
-        delete g;
+        free_graph(g);
 
     } else if (!cmd.compare(CMD_NOOUTEDGES)) {
 
@@ -123,7 +347,7 @@ int main(int argc, char** argv) {
         std::cout << zero_outgoing.size() << " of " << num_nodes(g) << " nodes have zero outgoing edges ("
                   << std::setprecision(2)
                   << 100.0 * static_cast<double>(zero_outgoing.size())/num_nodes(g) << "\%).\n";
-        delete g;
+        free_graph(g);
 
     } else if (!cmd.compare(CMD_NOINEDGES)) {
 
@@ -156,7 +380,7 @@ int main(int argc, char** argv) {
         std::cout << zero_incoming.size() << " of " << num_nodes(g) << " nodes have zero incoming edges ("
                   << std::setprecision(2)
                   << 100.0 * static_cast<double>(zero_incoming.size())/num_nodes(g) << "\%).\n";
-        delete g;
+        free_graph(g);
 
     } else if (!cmd.compare(CMD_EDGESTATS)) {
 
@@ -265,6 +489,50 @@ int main(int argc, char** argv) {
                   << " max=" << max_incoming << "\n";
     }
 
+    else if (!cmd.compare(CMD_TRANSPOSE)) {
+
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " " << cmd << " filename [runs]\n";
+            std::cerr << "Times build_incoming_edges() against the original serial version,\n"
+                      << "reports the peak memory each takes, and checks that both produce the same incoming edges\n";
+            exit(1);
+        }
+
+        std::string inputFilename = std::string(argv[2]);
+        int runs = (argc > 3) ? std::max(1, atoi(argv[3])) : 5;
+
+        Graph g;
+        std::cout << "Loading graph: " << inputFilename << "\n";
+        g = load_graph_binary(inputFilename.c_str());
+        std::cout << "Done loading.\n";
+
+        graph serial, parallel;
+        long serial_peak, parallel_peak;
+        double serial_time = time_transpose(g, build_incoming_edges_serial, runs, &serial, &serial_peak);
+        double parallel_time = time_transpose(g, build_incoming_edges, runs, &parallel, &parallel_peak);
+
+        bool same =
+            !memcmp(serial.incoming_starts, parallel.incoming_starts, sizeof(int) * num_nodes(g)) &&
+            !memcmp(serial.incoming_edges, parallel.incoming_edges, sizeof(Vertex) * num_edges(g));
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "Serial:   " << serial_time * 1000 << " ms, peak memory "
+                  << format_peak(serial_peak) << "\n"
+                  << "Parallel: " << parallel_time * 1000 << " ms ("
+                  << omp_get_max_threads() << " threads, "
+                  << serial_time / parallel_time << "x), peak memory "
+                  << format_peak(parallel_peak) << "\n";
+        std::cout << "Incoming edges " << (same ? "match" : "DO NOT MATCH") << " the serial version.\n";
+
+        free(serial.incoming_starts);
+        free(serial.incoming_edges);
+        free(parallel.incoming_starts);
+        free(parallel.incoming_edges);
+        free_graph(g);
+        if (!same)
+            exit(1);
+    }
+
     else {
         print_help(argv[0]);
     }